@@ -5,15 +5,34 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <unistd.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <cmath>
+#include <atomic>
+#include <mutex>
 
 //Dynamixel includes
 #include "dynamixel_sdk.h"
 
 #include "dxl_servo_controller.h"
+#include "frame_pipeline.h"
+#include "frame_preview.h"
+#include "frame_ring.h"
+#include "frame_source.h"
+#include "latency_stats.h"
+#include "motion_acquirer.h"
+#include "multi_target_tracker.h"
+#include "options.h"
+#include "rt_config.h"
+#include "servo_pid.h"
+#include "startup_sequence.h"
+#include "target_predictor.h"
+#include "tracker_engine.h"
+#include "tracker_factory.h"
 
 //OpenCV includes
 #include <opencv2/dnn.hpp>
-#include <opencv2/highgui/highgui.hpp>
 #include <opencv2/videoio/videoio.hpp>
 #include <opencv2/imgcodecs/imgcodecs.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -28,193 +47,767 @@ using namespace std;
 using namespace cv;
 
 //Define message queue attributes
-#define CAPTURE_QUEUE_NAME "/capture_queue"
 #define SERVO_QUEUE_NAME "/servo_queue"
+#define SERVO_QUEUE_DEPTH 8
+#define SERVO_QUEUE_WAIT_MS 100 // How long the step loop waits for a command before checking the tracker is still running
 
-bool CAPTURE_RUNNING = false;
-bool TRACKER_RUNNING = false;
-bool CONTROLLER_RUNNING = false;
+// Camera and servo geometry for the PID loop
+#define PAN_PIXELS_PER_DEGREE 32.5  // Same calibration the step mode uses
+#define TILT_PIXELS_PER_DEGREE 20.0
+#define DEGREES_PER_POSITION_UNIT 0.29296875
+#define DPS_PER_SPEED_UNIT 0.666    // AX-12 moving speed unit, 0.111 rpm
+#define CONTROL_LOOKAHEAD_S 0.2     // Goals go this far ahead at the commanded speed
+#define TARGET_TIMEOUT_MS 300       // Stop when no command has mentioned the target for this long
+
+// Pre-allocated frames shared by the capture and tracker threads
+FrameChannel frame_channel;
+
+// Created by the capture thread, deleted by main() once nothing can still be
+// holding one of its buffers
+FrameSource *frame_source = nullptr;
+
+// Per-stage latency histograms, dumped on SIGUSR1, every --stats-interval and at exit
+LatencyReport latency_report;
+
+// Who is up yet; the threads wait on each other through this
+StartupSequence startup;
+
+// What the tracker sends the controller through the servo queue
+struct ServoCommand
+{
+    Point position;        // Target position in 1280x720 pixels: its centre for the PID loop, its corner for steps
+    FrameTimestamps times; // Of the frame the position came from
+};
+
+// Whether a goal issued with DxlController::track_goal() is still in flight
+static bool is_moving(const shared_future<GoalOutcome> &done)
+{
+    return done.valid() && done.wait_for(chrono::seconds(0)) != future_status::ready;
+}
+
+// Set by main() before the threads start, cleared by each thread on its way out
+atomic<bool> CAPTURE_RUNNING(false);
+atomic<bool> TRACKER_RUNNING(false);
+atomic<bool> CONTROLLER_RUNNING(false);
+
+/*
+ * The PID control mode. A timerfd ticks at --control-hz whatever the camera
+ * does; each tick takes the newest command off the (non-blocking) servo
+ * queue, and for each axis turns the target's angle off the camera axis into
+ * a velocity with a PidController. The velocity is streamed to the servos as
+ * a goal CONTROL_LOOKAHEAD_S ahead plus a moving speed, both axes in one sync
+ * write, and only when it changes.
+ *
+ * Between frames the error is corrected by how far the servo has turned since
+ * the frame's command arrived (from the cached servo state), so the loop
+ * doesn't keep pushing towards an error it has already closed.
+ */
+static void pid_control_loop(DxlController &controller, mqd_t mq)
+{
+    struct ControlAxis
+    {
+        int servo_id;
+        double pixels_per_degree;
+        double centre;    // Pixel the target is aimed at
+        int direction;    // Position units per unit of angle towards +pixels
+        PidController pid;
+        double frame_error; // Degrees, as of the latest command
+        double frame_angle; // Camera angle when it arrived
+        int last_goal;
+        int last_speed;
+    };
+    ControlAxis axes[2] = {
+        {DXL_ID_PAN, PAN_PIXELS_PER_DEGREE, 640, -1, PidController(options.pid), 0, 0, -1, -1},
+        {DXL_ID_TILT, TILT_PIXELS_PER_DEGREE, 360, 1, PidController(options.pid), 0, 0, -1, -1},
+    };
+
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer < 0)
+    {
+        fprintf(stderr, "[CONTROLLER]: Error, cannot create the control timer: %s.\n", strerror(errno));
+        return;
+    }
+    int64_t period_ns = int64_t(1e9 / options.control_hz);
+    // Absolute first expiry, so each tick's due time (and how late we woke) is known
+    int64_t due_ns = monotonic_ns() + period_ns;
+    struct itimerspec tick;
+    tick.it_interval.tv_sec = period_ns / 1000000000;
+    tick.it_interval.tv_nsec = period_ns % 1000000000;
+    tick.it_value.tv_sec = due_ns / 1000000000;
+    tick.it_value.tv_nsec = due_ns % 1000000000;
+    timerfd_settime(timer, TFD_TIMER_ABSTIME, &tick, NULL);
+
+    struct mq_attr queue_attr;
+    mq_getattr(mq, &queue_attr);
+    queue_attr.mq_flags = O_NONBLOCK;
+    mq_setattr(mq, &queue_attr, NULL);
+
+    printf("[CONTROLLER]: PID loop at %.0f Hz, gains %g,%g,%g, max %.0f deg/s\n", options.control_hz,
+           options.pid.kp, options.pid.ki, options.pid.kd, options.pid.output_limit);
+
+    ServoCommand *command = nullptr;
+    ServoCommand *newer;
+    bool have_target = false;
+    bool latency_pending = false;
+    int64_t target_ns = 0;
+    unsigned long ticks = 0;
+    unsigned long missed_ticks = 0;
+    unsigned long writes = 0;
+
+    while (TRACKER_RUNNING)
+    {
+        uint64_t expirations;
+        if (read(timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            fprintf(stderr, "[CONTROLLER]: Error reading the control timer: %s.\n", strerror(errno));
+            break;
+        }
+        due_ns += (expirations - 1) * period_ns;
+        latency_report.record_wakeup(monotonic_ns() - due_ns);
+        due_ns += period_ns;
+        ticks++;
+        missed_ticks += expirations - 1;
+        double dt = expirations * period_ns / 1e9;
+
+        // Only the newest command matters
+        bool new_target = false;
+        while (mq_receive(mq, (char *)&newer, sizeof(ServoCommand *), NULL) == sizeof(ServoCommand *))
+        {
+            delete command;
+            command = newer;
+            new_target = true;
+        }
+        if (new_target)
+        {
+            Point2d pixels(command->position.x, command->position.y);
+            for (ControlAxis &axis : axes)
+            {
+                ServoState state;
+                double pixel = axis.servo_id == DXL_ID_PAN ? pixels.x : pixels.y;
+                axis.frame_error = (pixel - axis.centre) / axis.pixels_per_degree;
+                axis.frame_angle = controller.cached_state(axis.servo_id, state)
+                                       ? axis.direction * state.position * DEGREES_PER_POSITION_UNIT
+                                       : 0;
+            }
+            target_ns = monotonic_ns();
+            have_target = true;
+            latency_pending = true;
+        }
+        if (!have_target)
+        {
+            continue;
+        }
+
+        vector<AxisDrive> drives;
+        bool lost = monotonic_ns() - target_ns > int64_t(TARGET_TIMEOUT_MS) * 1000000;
+        for (ControlAxis &axis : axes)
+        {
+            ServoState state;
+            if (!controller.cached_state(axis.servo_id, state))
+            {
+                continue;
+            }
+
+            int goal;
+            int speed;
+            if (lost)
+            {
+                // Stop where we are and start afresh with the next target. The
+                // cache can be SERVO_STATE_MAX_AGE_MS behind a moving servo, and
+                // speed 0 is full speed on the AX-12, so hold the position read now
+                // at the slowest speed
+                axis.pid.reset();
+                int present = controller.getPosition(axis.servo_id);
+                goal = present >= 0 ? present : state.position;
+                speed = 1;
+            }
+            else
+            {
+                double angle = axis.direction * state.position * DEGREES_PER_POSITION_UNIT;
+                double error = axis.frame_error - (angle - axis.frame_angle);
+                double velocity = axis.pid.update(error, angle, dt);
+                goal = state.position + int(lround(axis.direction * velocity * CONTROL_LOOKAHEAD_S / DEGREES_PER_POSITION_UNIT));
+                speed = max(1, int(lround(fabs(velocity) / DPS_PER_SPEED_UNIT)));
+            }
+            if (goal != axis.last_goal || speed != axis.last_speed)
+            {
+                drives.push_back({axis.servo_id, goal, speed});
+                axis.last_goal = goal;
+                axis.last_speed = speed;
+            }
+        }
+        if (lost)
+        {
+            have_target = false;
+        }
+
+        if (!drives.empty() && controller.drive_together(drives))
+        {
+            writes++;
+            if (latency_pending && !lost)
+            {
+                // The first goal packet influenced by this command is on the bus
+                command->times.goal_written_ns = monotonic_ns();
+                latency_report.record_command(command->times);
+                latency_pending = false;
+            }
+        }
+    }
+
+    // Leave the servos stopped where they are, at the MOVE_SPEED the rest of the program expects
+    vector<AxisDrive> stops;
+    for (ControlAxis &axis : axes)
+    {
+        int present = controller.getPosition(axis.servo_id);
+        if (present >= 0)
+        {
+            stops.push_back({axis.servo_id, present, MOVE_SPEED});
+        }
+    }
+    if (!stops.empty())
+    {
+        controller.drive_together(stops);
+    }
+
+    close(timer);
+    delete command;
+    printf("[CONTROLLER]: %lu control ticks, %lu missed, %lu goal updates written\n", ticks, missed_ticks, writes);
+}
 
 // Servo controller thread
 void *ControllServos(void *threadid)
 {
+    apply_rt_thread(pthread_self(), RT_CONTROLLER, options.rt);
     optional<DxlController> controller;
-    CONTROLLER_RUNNING = true;
     try
     {
-        controller.emplace();
+        controller.emplace(options.servo_poll_hz, options.servo_poll_load, options.lean_transport, options.async_io);
     }
-    catch (std::exception e)
+    catch (const std::exception &e)
     {
+        // Nothing was constructed to clean up; tracking carries on without commands
+        CONTROLLER_RUNNING = false;
+        startup.mark(STARTUP_SERVOS_READY, false);
         cerr << "Failed to create DxlController object." << endl;
         cerr << "ErrOut: " << e.what() << "." << endl;
         cout << "Exiting DxlController thread" << endl;
-
-        controller->clean_up();
         pthread_exit(NULL);
     }
+    // The poller started with our settings; it gets its own
+    apply_rt_thread(controller->poller_handle(), RT_SERVO_POLLER, options.rt);
+    ServoCommand *command;
+    ServoCommand *newer;
     Point *position;
+    int pan_goal;
+    int tilt_goal;
 
-    controller->return_home();
+    // Goals in flight; the controller never waits for the servos to arrive
+    shared_future<GoalOutcome> pan_done;
+    shared_future<GoalOutcome> tilt_done;
+    unsigned long stale_commands = 0;
 
-    mqd_t mq;
-    do
-    {
-        mq = mq_open(SERVO_QUEUE_NAME, O_RDONLY);
-        if (mq < 0)
-        {
-            fprintf(stderr, "[CONTROLLER]: Error, cannot open the capture queue: %s.\n", strerror(errno));
-            sleep(1);
-        }
+    // The camera opens and the tracker loads meanwhile; the tracker sends no commands until this is marked
+    startup.mark(STARTUP_SERVOS_READY, controller->return_home());
 
-    } while (mq == -1 || !TRACKER_RUNNING);
+    // Created by main() before any thread started
+    mqd_t mq = mq_open(SERVO_QUEUE_NAME, O_RDONLY);
+    if (mq == (mqd_t)-1)
+    {
+        fprintf(stderr, "[CONTROLLER]: Error, cannot open the servo queue: %s.\n", strerror(errno));
+        CONTROLLER_RUNNING = false;
+        pthread_exit(NULL);
+    }
     printf("[CONTROLLER]: servo queue opened\n");
+    if (options.control_mode == CONTROL_PID)
+    {
+        pid_control_loop(*controller, mq);
+        CONTROLLER_RUNNING = false;
+        printf("Exiting DxlController thread\n");
+        pthread_exit(NULL);
+    }
     ssize_t bytes_read;
     printf("[CONTROLLER]: Waiting for instructions...\n");
     int panDegrees;
     int tiltDegrees;
     do
     {
-        bytes_read = mq_receive(mq, (char *)&position, sizeof(Point *), NULL);
-        if (bytes_read == sizeof(Point *))
+        // Not forever: once the tracker has exited no command will ever come
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += SERVO_QUEUE_WAIT_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        bytes_read = mq_timedreceive(mq, (char *)&command, sizeof(ServoCommand *), NULL, &deadline);
+        if (bytes_read == sizeof(ServoCommand *))
         {
+            // Anything queued behind it is newer; only aim at the newest
+            struct mq_attr queue_attr;
+            while (mq_getattr(mq, &queue_attr) == 0 && queue_attr.mq_curmsgs > 0 &&
+                   mq_receive(mq, (char *)&newer, sizeof(ServoCommand *), NULL) == sizeof(ServoCommand *))
+            {
+                delete command;
+                command = newer;
+                stale_commands++;
+            }
+
+            position = &command->position;
             cout << "[CONTROLLER]: x = " << position->x << " y = " << position->y << endl;
 
-            //Pan
-            if (position->x > 640)
+            // Both axes go out in one sync write packet and move together
+            vector<AxisGoal> goals;
+
+            //Pan. A zero move would stop a servo that is still on its way, so leave that goal be
+            if (abs(position->x - 640) >= 65 || !is_moving(pan_done))
             {
-                panDegrees = (position->x - 640) / 32.5;
-                panDegrees = panDegrees / 2;
+                if (position->x > 640)
+                {
+                    panDegrees = (position->x - 640) / 32.5;
+                    panDegrees = panDegrees / 2;
+                }
+                else
+                {
+                    panDegrees = (640 - position->x) / 32.5;
+                    panDegrees = -(panDegrees / 2);
+                }
                 cout << "position:x = " << position->x << ". panDegrees = " << panDegrees << endl;
-                controller->WAIT_for_goal(DXL_ID_PAN, controller->relative_PAN(panDegrees));
-            }
-            else
-            {
-                panDegrees = (640 - position->x) / 32.5;
-                panDegrees = panDegrees / 2;
-                cout << "position:x = " << position->x << ". panDegrees = " << -panDegrees << endl;
-                controller->WAIT_for_goal(DXL_ID_PAN, controller->relative_PAN(-panDegrees));
+                pan_goal = controller->relative_goal(DXL_ID_PAN, panDegrees);
+                if (pan_goal >= 0)
+                {
+                    goals.push_back({DXL_ID_PAN, pan_goal, {}});
+                }
             }
 
-            //Tilt
-            if (position->y > 360)
+            //Tilt, the same way
+            if (abs(position->y - 360) >= 60 || !is_moving(tilt_done))
             {
-                tiltDegrees = (360 - position->y) / 20;
-                tiltDegrees = tiltDegrees / 3;
+                if (position->y > 360)
+                {
+                    tiltDegrees = (360 - position->y) / 20;
+                    tiltDegrees = tiltDegrees / 3;
+                }
+                else
+                {
+                    tiltDegrees = (position->y - 360) / 20;
+                    tiltDegrees = -(tiltDegrees / 3);
+                }
                 cout << "position:y = " << position->y << ". tiltDegrees = " << tiltDegrees << endl;
-                controller->WAIT_for_goal(DXL_ID_TILT, controller->relative_TILT(tiltDegrees));
+                tilt_goal = controller->relative_goal(DXL_ID_TILT, tiltDegrees);
+                if (tilt_goal >= 0)
+                {
+                    goals.push_back({DXL_ID_TILT, tilt_goal, {}});
+                }
             }
-            else
+
+            if (!goals.empty() && controller->move_together(goals))
             {
-                tiltDegrees = (position->y - 360) / 20;
-                tiltDegrees = tiltDegrees / 3;
-                cout << "position:y = " << position->y << ". tiltDegrees = " << -tiltDegrees << endl;
-                controller->WAIT_for_goal(DXL_ID_TILT, controller->relative_TILT(-tiltDegrees));
+                // The goal packet of this command is on the bus
+                command->times.goal_written_ns = monotonic_ns();
+                latency_report.record_command(command->times);
+                for (size_t i = 0; i < goals.size(); i++)
+                {
+                    (goals[i].servo_id == DXL_ID_PAN ? pan_done : tilt_done) = goals[i].done;
+                }
             }
-        }
 
-        delete position;
+            delete command;
+        }
     } while (TRACKER_RUNNING);
 
+    printf("[CONTROLLER]: skipped %lu stale commands\n", stale_commands);
+    CONTROLLER_RUNNING = false;
     printf("Exiting DxlController thread\n");
     pthread_exit(NULL);
 }
 
 // Tracking thread
-void *Track(void *threadid)
+/*
+ * Converts a YUYV frame to BGR in frame.converted, all of it or only window,
+ * unless that part has been converted already. BGR frames are left alone.
+ */
+static void convert_frame(PipelineFrame &frame, Rect window)
 {
-    TRACKER_RUNNING = true;
-    Ptr<Tracker> tracker = TrackerCSRT::create();
-    bool object_defined = false;
-    Rect2d obj_position;
-    Rect2d prev_position;
-    Point *position;
-    bool tracking = false;
-
-    // Create message queue between tracker and controller
-    struct mq_attr attr;
-    attr.mq_flags = 0;
-    attr.mq_maxmsg = 8;
-    attr.mq_msgsize = sizeof(Point *);
-    attr.mq_curmsgs = 0;
-
-    mqd_t mq_controller;
-    do
+    const Mat &yuyv = frame.slot->image;
+    if (frame.slot->format != FRAME_FORMAT_YUYV || frame.converted_whole)
     {
-        mq_controller = mq_open(SERVO_QUEUE_NAME, (O_WRONLY | O_CREAT), (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH), &attr);
-        if (mq_controller < 0)
+        return;
+    }
+    if (window.area() > 0)
+    {
+        // Pixel pairs share their chroma, so the window has to start and end on a pair
+        window.width += window.x & 1;
+        window.x &= ~1;
+        window.width = (window.width + 1) & ~1;
+        window &= Rect(0, 0, yuyv.cols, yuyv.rows);
+        if ((window & frame.converted_window) == window)
         {
-            fprintf(stderr, "[TRACKER]: Error, cannot open the controller queue: %s.\n", strerror(errno));
-            sleep(1);
+            return;
         }
-    } while (mq_controller == -1 || !CONTROLLER_RUNNING);
+    }
+
+    frame.converted.create(yuyv.size(), CV_8UC3);
+    if (window.area() > 0)
+    {
+        Mat converted_window = frame.converted(window);
+        cvtColor(yuyv(window), converted_window, COLOR_YUV2BGR_YUYV);
+        frame.converted_window = window;
+    }
+    else
+    {
+        cvtColor(yuyv, frame.converted, COLOR_YUV2BGR_YUYV);
+        frame.converted_whole = true;
+    }
+    frame.image = &frame.converted;
+}
+
+void *Track(void *threadid)
+{
+    apply_rt_thread(pthread_self(), RT_TRACKER, options.rt);
+    // The adaptive tracker aims to fit each update in one frame period
+    double budget_ms = options.frame_budget_ms;
+    if (budget_ms <= 0)
+    {
+        budget_ms = 1000.0 / (options.source_fps > 0 ? options.source_fps : DEFAULT_SOURCE_FPS);
+    }
+    // One tracker per target, updated in parallel when there's more than one
+    MultiTargetTracker tracker(options.tracker_ladder, int64_t(budget_ms * 1e6), options.max_downscale,
+                               options.search_padding, options.target_select);
+    // Loads its model alongside the tracker's; tracking goes ahead without it if it can't
+    TargetReacquirer reacquirer(options.reacquire);
+    if (options.reacquire.detector != REACQUIRE_OFF && !reacquirer.start())
+    {
+        fprintf(stderr, "[TRACKER]: Carrying on without re-acquisition\n");
+    }
+    startup.mark(STARTUP_TRACKER_LOADED, tracker.preload());
+    // Finds the target headless with --acquire=motion
+    MotionAcquirer acquirer(options.acquire_downscale, options.acquire_frames);
+
+    // Created by main() before any thread started
+    mqd_t mq_controller = mq_open(SERVO_QUEUE_NAME, O_WRONLY);
+    if (mq_controller == (mqd_t)-1)
+    {
+        fprintf(stderr, "[TRACKER]: Error, cannot open the servo queue: %s.\n", strerror(errno));
+        frame_channel.close();
+        TRACKER_RUNNING = false;
+        pthread_exit(NULL);
+    }
     printf("[TRACKER]: servo queue opened\n");
 
-    //Open the message queue between tracker and capture threads
-    mqd_t mq;
-    do
+    // Display and the interactive selection, at low priority off this thread
+    FramePreview preview(options.preview_fps, options.multi_target);
+    if (!options.headless && preview.start())
     {
-        mq = mq_open(CAPTURE_QUEUE_NAME, O_RDONLY);
-        if (mq < 0)
+        preview.allow_selection(options.acquisition == ACQUIRE_MANUAL && !options.has_roi);
+    }
+
+    // With --pipeline each stage below runs on its own thread, so each keeps
+    // its own state; what one needs from another travels with the frame.
+    FramePipeline pipeline(options.pipelined);
+
+    // Set by the track stage; the preprocess stage runs ahead of it on the next frames
+    atomic<bool> target_chosen(false);
+    std::mutex hint_mutex;
+    Rect search_hint; // Where the tracker will look next, empty for the whole frame
+
+    pipeline.add_stage("preprocess", [&](PipelineFrame &frame) {
+        startup.mark(STARTUP_FIRST_FRAME);
+        // Waiting for something to move needs no colour; the track stage converts the frame it's found on
+        if (!target_chosen.load(memory_order_relaxed) && options.acquisition == ACQUIRE_MOTION &&
+            !options.has_roi && !frame.slot->has_truth)
         {
-            fprintf(stderr, "[TRACKER]: Error, cannot open the capture queue: %s.\n", strerror(errno));
-            sleep(1);
+            return;
         }
-    } while (mq == -1 || CAPTURE_RUNNING == false);
-
-    printf("[TRACKER]: capture_queue opened\n");
-    Mat *frame;
-    ssize_t bytes_read;
+        // Once tracking, only the part the tracker will look at needs converting
+        Rect window;
+        {
+            lock_guard<std::mutex> lock(hint_mutex);
+            window = search_hint;
+        }
+        convert_frame(frame, window);
+    });
 
-    do
-    {
-        bytes_read = mq_receive(mq, (char *)&frame, sizeof(Mat *), NULL);
+    bool object_defined = false;
+    bool failed = false;
+    vector<Rect2d> targets; // As selected, the first is the priority target
+    Rect2d obj_position;    // What the selection step aims at
+    bool first_tracked = false;
+    // Throughput and accuracy, reported when the thread exits
+    uint64_t updates = 0;
+    int64_t update_ns = 0;
+    uint64_t truth_frames = 0;
+    double iou_sum = 0.0;
+    int64_t tracking_start_ns = 0;
+
+    pipeline.add_stage("track", [&](PipelineFrame &frame) {
+        if (failed)
+        {
+            return;
+        }
+        FrameSlot *slot = frame.slot;
+
+        // The worker found the lost target; the tracker starts again from there
+        Rect2d found;
+        bool reacquired = object_defined && !tracker.target(0).tracking && reacquirer.take(found);
+        bool searching = !object_defined && options.acquisition == ACQUIRE_MOTION && !options.has_roi && !slot->has_truth;
+        Rect2d moving;
+        bool acquired = searching && acquirer.update(slot->image, slot->format, moving);
+        // The preprocess stage guessed the window from an earlier frame; fill in what it missed
+        if (!searching || acquired)
+        {
+            convert_frame(frame, (object_defined && !reacquired) ? tracker.search_window() : Rect());
+        }
+        Mat *image = frame.image;
+        Mat selection_frame;
+        if (image->empty())
+        {
+            return;
+        }
 
-        if (bytes_read == sizeof(Mat *) && !(frame->empty()))
+        if (!object_defined)
         {
-            if (!object_defined)
+            // A box given on the command line or by the frame source
+            // lets the pipeline start without anyone at the screen
+            if (options.has_roi || slot->has_truth)
+            {
+                targets = options.has_roi ? options.rois : vector<Rect2d>{slot->truth};
+                object_defined = true;
+            }
+            else if (options.acquisition == ACQUIRE_MOTION)
             {
-                imshow("CaptureFrames", *frame);
-                if (waitKey(20) != -1)
+                if (acquired)
                 {
-                    tracker->init(*frame, selectROI("CaptureFrames", *frame, true, false));
+                    targets = {moving};
                     object_defined = true;
-                    destroyAllWindows();
+                    printf("[TRACKER]: Acquired a moving target at %.0f,%.0f, %.0fx%.0f\n", moving.x, moving.y,
+                           moving.width, moving.height);
+                }
+            }
+            else if (preview.running())
+            {
+                // Drawn on the preview thread; tracking starts on the frame the boxes were drawn on
+                object_defined = preview.take_selection(targets, selection_frame);
+                if (object_defined)
+                {
+                    image = &selection_frame;
                 }
             }
             else
             {
-                tracking = tracker->update(*frame, obj_position);
-                if (!tracking)
+                fprintf(stderr, "[TRACKER]: Nothing to select the target on; give it with --roi or use "
+                                "--acquire=motion\n");
+                failed = true;
+                frame_channel.close();
+                return;
+            }
+            if (object_defined && !tracker.init(*image, targets))
+            {
+                startup.mark(STARTUP_TARGET_SELECTED, false);
+                fprintf(stderr, "[TRACKER]: Can't start the %s tracker\n", tracker.name().c_str());
+                failed = true;
+                frame_channel.close();
+                return;
+            }
+            if (object_defined)
+            {
+                startup.mark(STARTUP_TARGET_SELECTED);
+                obj_position = targets[0];
+                printf("[TRACKER]: Tracking with %s%s at 1/%d resolution\n", tracker.name().c_str(),
+                       tracker.adaptive() ? " (adaptive)" : "", tracker.downscale());
+                if (tracker.count() > 1)
                 {
-                    putText(*frame, "Tracking failure detected", Point(100, 80), FONT_HERSHEY_SIMPLEX, 0.75, Scalar(0, 0, 255), 2);
-                    cout << "Tracking failure" << endl;
+                    printf("[TRACKER]: %zu targets, %d updated at a time, aiming at %s\n", tracker.count(),
+                           tracker.parallelism(),
+                           options.target_select == SELECT_GROUP ? "the group" : "the first one still tracked");
                 }
-                position = new Point(obj_position.x, obj_position.y);
-                //rectangle(*frame, obj_position, Scalar(255, 0, 0), 2, 1);
-                //imshow("CaptureFrames", *frame);
-                //waitKey(10);
+                target_chosen = true;
+                preview.allow_selection(false);
+            }
+            tracking_start_ns = monotonic_ns();
+        }
+        else
+        {
+            slot->times.track_start_ns = monotonic_ns();
+            // The re-acquirer follows the priority target; it restarts on this frame and the rest update
+            if (reacquired && tracker.reinit(0, *image, found))
+            {
+                printf("[TRACKER]: Re-acquired the target at %.0f,%.0f\n", found.x, found.y);
+            }
+            bool tracking = tracker.update(*image, obj_position);
+            slot->times.track_end_ns = monotonic_ns();
+            update_ns += slot->times.track_end_ns - slot->times.track_start_ns;
+            updates++;
+            if (slot->has_truth)
+            {
+                iou_sum += tracking ? box_iou(obj_position, slot->truth) : 0.0;
+                truth_frames++;
+            }
+            reacquirer.observe(slot->image, slot->format, tracker.target(0).box, tracker.target(0).tracking);
+            if (tracking && !first_tracked)
+            {
+                first_tracked = true;
+                startup.mark(STARTUP_FIRST_TRACKED_FRAME);
+            }
+            frame.updated = true;
+            frame.tracking = tracking;
+            frame.box = obj_position;
+            frame.selected = tracker.selected();
+        }
 
-                //Send obj_position.x and obj_position.y to DxlController thread
+        lock_guard<std::mutex> lock(hint_mutex);
+        search_hint = object_defined ? tracker.search_window() : Rect();
+    });
 
-                //Don't send if position isn't very different
-                if (abs(obj_position.x - prev_position.x) > 10 || abs(obj_position.y - prev_position.y) > 10 || abs(obj_position.x - 640) > 10 || abs(obj_position.y - 360) > 10)
-                {
-                    mq_send(mq_controller, (const char *)&position, sizeof(Point *), NULL);
-                }
+    // Leads the target by the measured grab -> goal written latency plus --lead-ms
+    TargetPredictor predictor(options.prediction);
+    int64_t expected_latency_ns = 0;
+    int64_t lead_ns = int64_t(options.lead_ms * 1e6);
+    uint64_t predictions = 0;
+    Rect2d prev_position;
+    int last_selected = -1; // Target the servos were following
+    // Commands only go out once the servos have been homed, and not at all if
+    // homing failed or the controller couldn't start
+    bool servos_ready = false;
+
+    pipeline.add_stage("command", [&](PipelineFrame &frame) {
+        if (!frame.updated)
+        {
+            return;
+        }
+        FrameSlot *slot = frame.slot;
+        // The controller works in 1280x720 pixels whatever the camera delivers
+        double to_reference_x = double(FRAME_WIDTH) / frame.image->cols;
+        double to_reference_y = double(FRAME_HEIGHT) / frame.image->rows;
+
+        // A different target took over; its motion has nothing to do with the last one's
+        if (frame.tracking && frame.selected >= 0)
+        {
+            if (last_selected >= 0 && frame.selected != last_selected)
+            {
+                printf("[TRACKER]: following target %d\n", frame.selected + 1);
+                predictor.reset();
+            }
+            last_selected = frame.selected;
+        }
+
+        Point position(frame.box.x * to_reference_x, frame.box.y * to_reference_y);
+        Point2d half(frame.box.width * to_reference_x / 2, frame.box.height * to_reference_y / 2);
+        // Without the predictor to coast on, the box of a lost target is stale
+        bool send = frame.tracking || options.prediction != PREDICT_OFF;
+        if (options.prediction != PREDICT_OFF)
+        {
+            // The percentile walks the whole histogram, so only refresh it now and then
+            if (predictions++ % 30 == 0)
+            {
+                const LatencyHistogram &latency = latency_report.stage(STAGE_END_TO_END).count() > 0
+                                                      ? latency_report.stage(STAGE_END_TO_END)
+                                                      : latency_report.stage(STAGE_VISION);
+                expected_latency_ns = latency.percentile(50);
+            }
+
+            // Filter the centre; position stays the corner until the control mode picks below
+            if (frame.tracking)
+            {
+                predictor.correct(Point2d(position.x + half.x, position.y + half.y), slot->times.grab_ns);
+            }
+            Point2d aim;
+            if (predictor.predict(slot->times.grab_ns + expected_latency_ns + lead_ns, aim))
+            {
+                position = Point(aim.x - half.x, aim.y - half.y);
+            }
+            else
+            {
+                // Lost for too long to guess; don't chase a stale box
+                send = false;
+            }
+        }
+
+        // The PID loop puts what it's sent on the frame centre, so it's sent the
+        // target's centre; the step mode is calibrated on the corner as before
+        if (options.control_mode == CONTROL_PID)
+        {
+            position = Point(position.x + half.x, position.y + half.y);
+        }
 
-                prev_position = obj_position;
+        //Send obj_position.x and obj_position.y to DxlController thread
+
+        //Don't send if position isn't very different
+        if (send && !servos_ready)
+        {
+            // Homing takes seconds; tracking carries on and the commands are dropped meanwhile
+            servos_ready = startup.reached(STARTUP_SERVOS_READY) && CONTROLLER_RUNNING;
+        }
+        if (send && servos_ready && (abs(frame.box.x - prev_position.x) > 10 || abs(frame.box.y - prev_position.y) > 10 || abs(position.x - 640) > 10 || abs(position.y - 360) > 10))
+        {
+            ServoCommand *command = new ServoCommand;
+            command->position = position;
+            command->times = slot->times;
+            command->times.command_ns = monotonic_ns();
+            if (mq_send(mq_controller, (const char *)&command, sizeof(ServoCommand *), 0) == 0)
+            {
+                latency_report.commands_sent++;
+            }
+            else
+            {
+                delete command;
             }
         }
-        delete frame;
 
-    } while (CAPTURE_RUNNING);
+        prev_position = frame.box;
+    });
+
+    int64_t next_stats_ns = options.stats_interval > 0 ? monotonic_ns() + int64_t(options.stats_interval * 1e9) : 0;
+
+    pipeline.add_stage("annotate", [&](PipelineFrame &frame) {
+        if (frame.updated && !frame.tracking)
+        {
+            cout << "Tracking failure" << endl;
+        }
+        // Draws on its own copy, and only every so often
+        preview.offer(frame);
 
-    //Delete message queue
-    if (!CAPTURE_RUNNING)
+        latency_report.record_frame(frame.slot->times);
+        if (latency_report.dump_requested.exchange(false) || (next_stats_ns != 0 && monotonic_ns() >= next_stats_ns))
+        {
+            latency_report.print(frame_channel.stats().dropped.load());
+            if (next_stats_ns != 0)
+            {
+                next_stats_ns = monotonic_ns() + int64_t(options.stats_interval * 1e9);
+            }
+        }
+    });
+
+    // Until the capture thread closes the channel
+    pipeline.run(frame_channel);
+
+    reacquirer.stop();
+    preview.stop();
+    frame_channel.print_stats();
+    pipeline.print_stats();
+    preview.print_stats();
+    reacquirer.print_stats();
+    acquirer.print_stats();
+    if (updates > 0)
+    {
+        double elapsed_s = (monotonic_ns() - tracking_start_ns) / 1e9;
+        printf("[TRACKER]: %llu updates, mean update = %.2f ms, throughput = %.1f fps\n",
+               (unsigned long long)updates, update_ns / 1e6 / updates, updates / elapsed_s);
+    }
+    if (tracker.adaptive())
+    {
+        printf("[TRACKER]: finished on %s after %llu tracker switches\n", tracker.name().c_str(),
+               (unsigned long long)tracker.switches());
+    }
+    for (size_t i = 0; tracker.count() > 1 && i < tracker.count(); i++)
     {
-        mq_close(mq);
-        mq_unlink(CAPTURE_QUEUE_NAME);
+        printf("[TRACKER]: target %zu lost on %llu updates\n", i + 1, (unsigned long long)tracker.target(i).lost);
+    }
+    if (truth_frames > 0)
+    {
+        printf("[TRACKER]: mean IoU against ground truth = %.3f over %llu frames\n",
+               iou_sum / truth_frames, (unsigned long long)truth_frames);
     }
     TRACKER_RUNNING = false;
 
@@ -225,60 +818,103 @@ void *Track(void *threadid)
 // Capture thread
 void *Capture(void *threadid)
 {
-    CAPTURE_RUNNING = true;
-    VideoCapture capture(0);
-    capture.set(cv::CAP_PROP_EXPOSURE, 4);
-    if (!capture.isOpened())
+    apply_rt_thread(pthread_self(), RT_CAPTURE, options.rt);
+    FrameSource *source = create_frame_source(options.source, options.pacing, options.source_fps);
+    frame_source = source;
+    startup.mark(STARTUP_CAMERA_OPEN, source != nullptr && source->isOpened());
+    if (source == nullptr || !source->isOpened())
     {
         cerr << "Error opening video!" << endl;
+        frame_channel.close();
+        CAPTURE_RUNNING = false;
         pthread_exit(NULL);
     }
+    printf("[CAPTURE]: Reading frames from %s\n", source->describe().c_str());
 
-    struct mq_attr attr;
-    attr.mq_flags = 0;
-    attr.mq_maxmsg = 8;
-    attr.mq_msgsize = sizeof(Mat *);
-    attr.mq_curmsgs = 0;
-
-    unsigned int prio = 0;
+    FrameSlot *slot;
 
-    mq_unlink(CAPTURE_QUEUE_NAME);
-    mqd_t mq = mq_open(CAPTURE_QUEUE_NAME, (O_WRONLY | O_CREAT), (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH), &attr);
-    if (mq < 0)
+    //Send frames while the source has them
+    while (true)
     {
-        fprintf(stderr, "[CAPTURE]: Error, cannot open the queue: %s.\n", strerror(errno));
-        printf("Exiting capture thread");
-        pthread_exit(NULL);
-    }
-
-    printf("[CAPTURE]: Created message queue!\n");
-
-    Mat frame;
-    Mat *heap_frame;
+        // Blocks only if the tracker is holding every slot
+        slot = frame_channel.acquire();
+        if (slot == nullptr)
+        {
+            break;
+        }
 
-    //Send rames while capture is
-    while (capture.isOpened())
-    {
-        capture >> frame;
-        resize(frame, frame, Size(1280, 720));
-        heap_frame = new Mat(frame);
-        mq_send(mq, (const char *)&heap_frame, sizeof(Mat *), prio);
+        // The source writes (and resizes) straight into the slot, or lends
+        // the slot one of its own buffers
+        if (!source->fill(*slot))
+        {
+            cerr << "[CAPTURE]: End of the video stream." << endl;
+            break;
+        }
+        slot->times = FrameTimestamps();
+        slot->times.grab_ns = monotonic_ns();
+        latency_report.frames_grabbed++;
+        slot->has_truth = source->ground_truth(slot->truth);
+        frame_channel.publish(slot);
     }
 
-    if (!TRACKER_RUNNING)
-    {
-        mq_close(mq);
-        mq_unlink(CAPTURE_QUEUE_NAME);
-    }
+    frame_channel.close();
     CAPTURE_RUNNING = false;
     printf("Exiting capture thread");
     pthread_exit(NULL);
 }
 
+// SIGUSR1 asks for a latency dump; the tracker thread does the printing
+static void request_latency_dump(int)
+{
+    latency_report.dump_requested = true;
+}
+
 int main(int argc, char *argv[])
 {
+    startup.start();
+    if (!parse_options(argc, argv, options))
+    {
+        return 1;
+    }
+    frame_channel.set_mode(options.handoff_mode);
 
-    namedWindow("CaptureFrames", WINDOW_AUTOSIZE);
+    // Lock everything allocated so far (the frame pool included) and whatever
+    // comes later, then touch the pool so it's resident before any frame
+    if (options.rt.enabled)
+    {
+        print_rt_config(options.rt);
+        lock_rt_memory(options.rt);
+        frame_channel.prefault();
+    }
+
+    struct sigaction dump_action;
+    memset(&dump_action, 0, sizeof(dump_action));
+    dump_action.sa_handler = request_latency_dump;
+    sigemptyset(&dump_action.sa_mask);
+    dump_action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &dump_action, nullptr);
+
+    // Create the queue between tracker and controller up front so neither
+    // has to wait for the other to open it. A queue left by a run that
+    // crashed holds pointers into that process; start from an empty one.
+    struct mq_attr attr;
+    attr.mq_flags = 0;
+    attr.mq_maxmsg = SERVO_QUEUE_DEPTH;
+    attr.mq_msgsize = sizeof(ServoCommand *);
+    attr.mq_curmsgs = 0;
+    mq_unlink(SERVO_QUEUE_NAME);
+    mqd_t servo_queue = mq_open(SERVO_QUEUE_NAME, (O_RDONLY | O_CREAT), (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH), &attr);
+    if (servo_queue == (mqd_t)-1)
+    {
+        fprintf(stderr, "Error, cannot create the servo queue: %s.\n", strerror(errno));
+        return 1;
+    }
+    mq_close(servo_queue);
+
+    // All three start at once; each brings its own device up in parallel
+    CONTROLLER_RUNNING = true;
+    TRACKER_RUNNING = true;
+    CAPTURE_RUNNING = true;
 
     // Set up threads
     int errorCheck;
@@ -320,5 +956,12 @@ int main(int argc, char *argv[])
     pthread_join(thread_Capture, nullptr);
     pthread_join(thread_Tracker, nullptr);
     pthread_join(thread_Controller, nullptr);
+    if (!startup.reached(STARTUP_FIRST_TRACKED_FRAME))
+    {
+        startup.print();
+    }
+    mq_unlink(SERVO_QUEUE_NAME);
+    latency_report.print(frame_channel.stats().dropped.load());
+    delete frame_source;
     return 0;
 }
@@ -0,0 +1,156 @@
+#include "bus_config.h"
+#include "dxl_servo_controller.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+BusConfig default_bus_config()
+{
+    BusConfig config;
+    const char *port = getenv(PORT_PATH_ENV);
+    config.port = (port != NULL && port[0] != '\0') ? port : PORT_PATH;
+    config.baud_rate = BAUDRATE;
+    config.pan_id = DXL_ID_PAN;
+    config.tilt_id = DXL_ID_TILT;
+    config.status_return_level = STATUS_RETURN_ALL;
+    config.return_delay_us = FACTORY_RETURN_DELAY_US;
+    return config;
+}
+
+std::string bus_config_path()
+{
+    const char *path = getenv(BUS_CONFIG_PATH_ENV);
+    if (path != NULL && path[0] != '\0')
+    {
+        return path;
+    }
+    const char *home = getenv("HOME");
+    return std::string(home != NULL ? home : ".") + "/" + BUS_CONFIG_DEFAULT_FILE;
+}
+
+bool load_bus_config(const std::string &path, BusConfig &config)
+{
+    FILE *file = fopen(path.c_str(), "r");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    BusConfig loaded = config;
+    char line[512];
+    int line_number = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line_number++;
+        line[strcspn(line, "#\r\n")] = '\0';
+        char key[64];
+        char value[448];
+        if (sscanf(line, " %63[^= ] = %447s", key, value) != 2)
+        {
+            if (strspn(line, " \t") != strlen(line))
+            {
+                fprintf(stderr, "[DXL]: %s:%d: expected key=value\n", path.c_str(), line_number);
+                ok = false;
+            }
+            continue;
+        }
+
+        if (strcmp(key, "port") == 0)
+        {
+            loaded.port = value;
+        }
+        else if (strcmp(key, "baud_rate") == 0)
+        {
+            loaded.baud_rate = atoi(value);
+        }
+        else if (strcmp(key, "pan_id") == 0)
+        {
+            loaded.pan_id = atoi(value);
+        }
+        else if (strcmp(key, "tilt_id") == 0)
+        {
+            loaded.tilt_id = atoi(value);
+        }
+        else if (strcmp(key, "status_return_level") == 0)
+        {
+            loaded.status_return_level = atoi(value);
+        }
+        else if (strcmp(key, "return_delay_us") == 0)
+        {
+            loaded.return_delay_us = atoi(value);
+        }
+        else
+        {
+            fprintf(stderr, "[DXL]: %s:%d: unknown key '%s'\n", path.c_str(), line_number, key);
+            ok = false;
+        }
+    }
+    fclose(file);
+
+    if (loaded.baud_rate <= 0 || loaded.pan_id < 0 || loaded.pan_id > 253 || loaded.tilt_id < 0 ||
+        loaded.tilt_id > 253 || loaded.pan_id == loaded.tilt_id ||
+        (loaded.status_return_level != STATUS_RETURN_READ && loaded.status_return_level != STATUS_RETURN_ALL))
+    {
+        fprintf(stderr, "[DXL]: %s has out of range settings\n", path.c_str());
+        ok = false;
+    }
+    if (ok)
+    {
+        config = loaded;
+    }
+    return ok;
+}
+
+bool save_bus_config(const std::string &path, const BusConfig &config)
+{
+    size_t slash = path.rfind('/');
+    if (slash != std::string::npos && slash > 0)
+    {
+        std::string directory = path.substr(0, slash);
+        if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            fprintf(stderr, "Can't create %s: %s\n", directory.c_str(), strerror(errno));
+            return false;
+        }
+    }
+
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Can't write %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    fprintf(file, "# Written by dxl_bus_setup\n");
+    fprintf(file, "port=%s\n", config.port.c_str());
+    fprintf(file, "baud_rate=%d\n", config.baud_rate);
+    fprintf(file, "pan_id=%d\n", config.pan_id);
+    fprintf(file, "tilt_id=%d\n", config.tilt_id);
+    fprintf(file, "status_return_level=%d\n", config.status_return_level);
+    fprintf(file, "return_delay_us=%d\n", config.return_delay_us);
+    bool ok = fclose(file) == 0;
+    if (!ok)
+    {
+        fprintf(stderr, "Can't write %s: %s\n", path.c_str(), strerror(errno));
+    }
+    return ok;
+}
+
+int baud_register_value(int baud_rate)
+{
+    if (baud_rate <= 0)
+    {
+        return -1;
+    }
+    int value = (2000000 + baud_rate / 2) / baud_rate - 1;
+    if (value < 0 || value > 254)
+    {
+        return -1;
+    }
+    double actual = 2000000.0 / (value + 1);
+    return fabs(actual - baud_rate) / baud_rate <= 0.03 ? value : -1;
+}
@@ -0,0 +1,80 @@
+/*
+ * Persistent servo bus settings, written by dxl_bus_setup and loaded by
+ * DxlController at start up.
+ *
+ * The file is a list of key=value lines ('#' starts a comment):
+ *
+ *      port=/dev/ttyUSB0
+ *      baud_rate=1000000
+ *      pan_id=5
+ *      tilt_id=10
+ *      status_return_level=1
+ *      return_delay_us=0
+ *
+ * It lives at $DXL_BUS_CONFIG, or ~/.cameramaan/dxl_bus.conf. Without a file
+ * the compile-time defaults (PORT_PATH, BAUDRATE, DXL_ID_PAN, DXL_ID_TILT,
+ * factory status return level and return delay) are used, and $DXL_PORT
+ * overrides the port either way.
+ *
+ * With status_return_level=1 the servos only answer READ and PING, so every
+ * write goes out without waiting for a status packet; with the default of 2
+ * every write is a full round trip.
+ */
+#ifndef BUS_CONFIG_H
+#define BUS_CONFIG_H
+
+#include <string>
+
+#define BUS_CONFIG_PATH_ENV "DXL_BUS_CONFIG"
+#define BUS_CONFIG_DEFAULT_FILE ".cameramaan/dxl_bus.conf" // Under $HOME
+
+// AX-12 EEPROM area
+#define ADDR_MX_ID 3
+#define ADDR_MX_BAUD_RATE 4
+#define ADDR_MX_RETURN_DELAY_TIME 5 // 2us per unit
+#define ADDR_MX_STATUS_RETURN_LEVEL 16
+
+#define STATUS_RETURN_NONE 0      // Only PING is answered
+#define STATUS_RETURN_READ 1      // READ and PING are answered
+#define STATUS_RETURN_ALL 2       // Every instruction is answered (factory)
+#define FACTORY_RETURN_DELAY_US 500
+
+struct BusConfig
+{
+    std::string port;
+    int baud_rate;
+    int pan_id;              // Bus ID of the servo DxlController calls DXL_ID_PAN
+    int tilt_id;             // Bus ID of the servo DxlController calls DXL_ID_TILT
+    int status_return_level; // STATUS_RETURN_READ or STATUS_RETURN_ALL
+    int return_delay_us;     // 0 to 508, what the servos are set to (for reporting)
+};
+
+// The compile-time settings, with $DXL_PORT applied.
+BusConfig default_bus_config();
+
+// $DXL_BUS_CONFIG, or ~/.cameramaan/dxl_bus.conf
+std::string bus_config_path();
+
+/*
+ * Reads path over config; keys missing from the file keep their value.
+ *
+ * @return false if the file doesn't exist or has a bad line (printed).
+ */
+bool load_bus_config(const std::string &path, BusConfig &config);
+
+/*
+ * Writes config to path, creating its directory if needed.
+ *
+ * @return false, after printing why, if it couldn't be written.
+ */
+bool save_bus_config(const std::string &path, const BusConfig &config);
+
+/*
+ * The AX-12 baud rate register value for a baud rate: 2000000 / (value + 1).
+ *
+ * @return the value, or -1 if the rate is more than 3% away from any the
+ * servo can do.
+ */
+int baud_register_value(int baud_rate);
+
+#endif
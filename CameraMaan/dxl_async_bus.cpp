@@ -0,0 +1,380 @@
+#include "dxl_async_bus.h"
+#include "dynamixel_sdk.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+static int64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+DxlAsyncBus::DxlAsyncBus(DxlTransport &transport)
+    : transport(transport), epoll_fd(-1), wake_fd(-1), timer_fd(-1), io_running(false), waiting(false),
+      deadline_ns(0)
+{
+    bus_stats = AsyncBusStats();
+}
+
+DxlAsyncBus::~DxlAsyncBus()
+{
+    stop();
+}
+
+bool DxlAsyncBus::running() const
+{
+    return io_running.load();
+}
+
+bool DxlAsyncBus::start()
+{
+    if (io_running.load())
+    {
+        return true;
+    }
+    if (!transport.is_open())
+    {
+        fprintf(stderr, "[DXL]: the async bus needs the lean transport\n");
+        return false;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    bool ok = epoll_fd >= 0 && wake_fd >= 0 && timer_fd >= 0;
+    for (int fd : {transport.port_fd(), wake_fd, timer_fd})
+    {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        ok = ok && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+
+    io_running = ok;
+    if (ok && pthread_create(&io_thread, NULL, run, this) != 0)
+    {
+        io_running = false;
+        ok = false;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "[DXL]: Can't start the async bus: %s\n", strerror(errno));
+        for (int *fd : {&epoll_fd, &wake_fd, &timer_fd})
+        {
+            if (*fd >= 0)
+            {
+                close(*fd);
+                *fd = -1;
+            }
+        }
+    }
+    return ok;
+}
+
+void DxlAsyncBus::stop()
+{
+    if (!io_running.exchange(false))
+    {
+        return;
+    }
+    uint64_t one = 1;
+    if (::write(wake_fd, &one, sizeof(one)) < 0)
+    {
+        perror("[DXL]: async bus wake up");
+    }
+    pthread_join(io_thread, NULL);
+
+    if (waiting)
+    {
+        waiting = false;
+        complete(in_flight, COMM_PORT_BUSY, 0, NULL, 0);
+    }
+    std::deque<Request> left;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        left.swap(queue);
+    }
+    for (Request &request : left)
+    {
+        complete(request, COMM_PORT_BUSY, 0, NULL, 0);
+    }
+
+    close(epoll_fd);
+    close(wake_fd);
+    close(timer_fd);
+    epoll_fd = wake_fd = timer_fd = -1;
+}
+
+AsyncBusStats DxlAsyncBus::stats()
+{
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return bus_stats;
+}
+
+std::future<AsyncReply> DxlAsyncBus::submit(Request &request)
+{
+    std::future<AsyncReply> reply = request.promise.get_future();
+    request.queued_ns = monotonic_ns();
+    request.sent_ns = 0;
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (io_running.load())
+        {
+            queue.push_back(std::move(request));
+            queued = true;
+            if (queue.size() > bus_stats.max_queue_depth)
+            {
+                bus_stats.max_queue_depth = queue.size();
+            }
+        }
+    }
+    if (!queued)
+    {
+        complete(request, COMM_PORT_BUSY, 0, NULL, 0);
+        return reply;
+    }
+
+    uint64_t one = 1;
+    if (::write(wake_fd, &one, sizeof(one)) < 0)
+    {
+        perror("[DXL]: async bus wake up");
+    }
+    return reply;
+}
+
+std::future<AsyncReply> DxlAsyncBus::read(uint8_t id, uint8_t address, uint8_t length)
+{
+    Request request;
+    request.kind = REQUEST_READ;
+    request.id = id;
+    request.address = address;
+    request.length = length;
+    request.count = 1;
+    request.wait_status = true;
+    return submit(request);
+}
+
+void DxlAsyncBus::read(uint8_t id, uint8_t address, uint8_t length, AsyncCallback callback)
+{
+    Request request;
+    request.kind = REQUEST_READ;
+    request.id = id;
+    request.address = address;
+    request.length = length;
+    request.count = 1;
+    request.wait_status = true;
+    request.callback = callback;
+    submit(request);
+}
+
+std::future<AsyncReply> DxlAsyncBus::write(uint8_t id, uint8_t address, const uint8_t *data, uint8_t length,
+                                           bool wait_status)
+{
+    Request request;
+    request.kind = REQUEST_WRITE;
+    request.id = id;
+    request.address = address;
+    request.length = length < sizeof(request.data) ? length : sizeof(request.data);
+    memcpy(request.data, data, request.length);
+    request.count = 1;
+    request.wait_status = wait_status;
+    return submit(request);
+}
+
+std::future<AsyncReply> DxlAsyncBus::sync_write(uint8_t address, uint8_t length, const uint8_t *ids,
+                                                const uint8_t *data, int count)
+{
+    Request request;
+    request.kind = REQUEST_SYNC_WRITE;
+    request.id = BROADCAST_ID;
+    request.address = address;
+    request.length = length;
+    request.count = count;
+    request.wait_status = false;
+    if (count < 1 || count > SYNC_WRITE_MAX_SERVOS || size_t(count) * length > sizeof(request.data))
+    {
+        request.count = 0; // Fails in dispatch()
+    }
+    else
+    {
+        memcpy(request.ids, ids, count);
+        memcpy(request.data, data, size_t(count) * length);
+    }
+    return submit(request);
+}
+
+void DxlAsyncBus::complete(Request &request, int result, uint8_t error, const uint8_t *data, size_t length)
+{
+    AsyncReply reply;
+    reply.result = result;
+    reply.error = error;
+    reply.length = data != NULL ? length : 0;
+    if (reply.length > 0)
+    {
+        memcpy(reply.data, data, reply.length);
+    }
+    reply.queued_ns = request.queued_ns;
+    reply.sent_ns = request.sent_ns;
+    reply.completed_ns = monotonic_ns();
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        bus_stats.requests++;
+        bus_stats.total_ns += reply.completed_ns - reply.queued_ns;
+    }
+
+    if (request.callback)
+    {
+        request.callback(reply);
+    }
+    else
+    {
+        request.promise.set_value(reply);
+    }
+}
+
+/*
+ * Sends queued requests until one is waiting for its status packet or the
+ * queue is empty.
+ */
+void DxlAsyncBus::dispatch()
+{
+    while (!waiting)
+    {
+        Request request;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (queue.empty())
+            {
+                return;
+            }
+            request = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        const PacketTemplate *packet = NULL;
+        switch (request.kind)
+        {
+        case REQUEST_READ:
+            packet = transport.prepare_read(request.id, request.address, request.length);
+            break;
+        case REQUEST_WRITE:
+            packet = transport.prepare_write(request.id, request.address, request.data, request.length);
+            break;
+        case REQUEST_SYNC_WRITE:
+            if (request.count > 0)
+            {
+                packet = transport.prepare_sync_write(request.address, request.length, request.ids, request.data,
+                                                      request.count);
+            }
+            break;
+        }
+        if (packet == NULL)
+        {
+            complete(request, COMM_TX_ERROR, 0, NULL, 0);
+            continue;
+        }
+
+        bool answered = request.kind == REQUEST_READ || (request.kind == REQUEST_WRITE && request.wait_status);
+        if (answered)
+        {
+            // Whatever is half parsed belongs to nobody now
+            parser.reset();
+        }
+        request.sent_ns = monotonic_ns();
+        int result = transport.send(*packet);
+        if (result != COMM_SUCCESS || !answered)
+        {
+            complete(request, result, 0, NULL, 0);
+            continue;
+        }
+
+        size_t parameters = request.kind == REQUEST_READ ? request.length : 0;
+        deadline_ns = transport.reply_deadline_ns(*packet, parameters, request.sent_ns);
+        struct itimerspec deadline = {};
+        deadline.it_value.tv_sec = deadline_ns / 1000000000;
+        deadline.it_value.tv_nsec = deadline_ns % 1000000000;
+        timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &deadline, NULL);
+        in_flight = std::move(request);
+        waiting = true;
+    }
+}
+
+// Reads what has arrived and completes the request in flight if its reply is there or overdue.
+void DxlAsyncBus::collect()
+{
+    uint8_t chunk[4 * DXL_TRANSPORT_MAX_PACKET];
+    ssize_t count;
+    while ((count = ::read(transport.port_fd(), chunk, sizeof(chunk))) > 0)
+    {
+        parser.feed(chunk, count);
+    }
+
+    StatusPacket packet;
+    while (parser.next(packet))
+    {
+        size_t expected = in_flight.kind == REQUEST_READ ? in_flight.length : 0;
+        if (waiting && packet.id == in_flight.id && packet.count == expected)
+        {
+            waiting = false;
+            struct itimerspec disarm = {};
+            timerfd_settime(timer_fd, 0, &disarm, NULL);
+            complete(in_flight, COMM_SUCCESS, packet.error, packet.parameters, packet.count);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            bus_stats.stray_packets++;
+        }
+    }
+
+    if (waiting && monotonic_ns() >= deadline_ns)
+    {
+        waiting = false;
+        int result = parser.buffered() > 0 ? COMM_RX_CORRUPT : COMM_RX_TIMEOUT;
+        parser.reset();
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            bus_stats.timeouts++;
+        }
+        complete(in_flight, result, 0, NULL, 0);
+    }
+}
+
+void *DxlAsyncBus::run(void *arg)
+{
+    DxlAsyncBus *bus = (DxlAsyncBus *)arg;
+    struct epoll_event events[3];
+
+    while (bus->io_running.load())
+    {
+        bus->dispatch();
+        int ready = epoll_wait(bus->epoll_fd, events, 3, -1);
+        if (ready < 0 && errno != EINTR)
+        {
+            perror("[DXL]: async bus epoll_wait");
+            break;
+        }
+        for (int i = 0; i < ready; i++)
+        {
+            if (events[i].data.fd == bus->wake_fd || events[i].data.fd == bus->timer_fd)
+            {
+                uint64_t value;
+                if (::read(events[i].data.fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+                {
+                    perror("[DXL]: async bus");
+                }
+            }
+        }
+        bus->collect();
+    }
+    return NULL;
+}
@@ -0,0 +1,138 @@
+/*
+ * Asynchronous servo bus on top of DxlTransport (--dxl-async).
+ *
+ * Callers queue instructions and get a future (or a callback) back straight
+ * away. One I/O thread owns the port: it waits in epoll on the serial fd, an
+ * eventfd that says the queue has work, and a timerfd armed for the reply
+ * deadline of the request on the wire. Status bytes are fed to a
+ * StatusParser as they arrive, so a reply is complete the moment its last
+ * byte is read rather than when a blocking read() returns.
+ *
+ * The bus is half duplex and servos only ever talk when asked, so at most
+ * one request that expects a reply (a READ, or a WRITE with status return
+ * level 2) is on the wire at a time. Packets that aren't answered (TxOnly
+ * writes, SYNC_WRITE) go out as soon as the bus is quiet, without waiting
+ * their turn behind a round trip. What gets pipelined is the caller: the
+ * control thread can queue a pan read, a tilt read and a goal write
+ * back-to-back and the I/O thread sends each the moment the previous one
+ * completes, with no thread wake up in between.
+ *
+ * Protocol 1.0 status packets don't echo the instruction, so a reply is
+ * matched to the request in flight by ID and by the parameter count that
+ * instruction gets back (length bytes for a READ, none for a WRITE).
+ * Anything else is counted as stray and dropped.
+ *
+ * The transport must be open and must not be used directly while the bus
+ * is running.
+ */
+#ifndef DXL_ASYNC_BUS_H
+#define DXL_ASYNC_BUS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+
+#include "dxl_transport.h"
+
+struct AsyncReply
+{
+    int result;    // COMM_* code
+    uint8_t error; // Servo error byte, 0 unless a status packet said otherwise
+    uint8_t data[DXL_TRANSPORT_MAX_PACKET];
+    size_t length;        // Bytes of data, for a READ
+    int64_t queued_ns;    // CLOCK_MONOTONIC times
+    int64_t sent_ns;
+    int64_t completed_ns;
+};
+
+// Called on the I/O thread; must not wait on the bus
+typedef std::function<void(const AsyncReply &)> AsyncCallback;
+
+struct AsyncBusStats
+{
+    unsigned long requests;
+    unsigned long timeouts;
+    unsigned long stray_packets; // Status packets nobody was waiting for
+    size_t max_queue_depth;
+    int64_t total_ns;            // Queued to completed, summed over requests
+};
+
+class DxlAsyncBus
+{
+public:
+    explicit DxlAsyncBus(DxlTransport &transport);
+    ~DxlAsyncBus();
+
+    // @return false, after printing why, if the I/O thread couldn't be started.
+    bool start();
+
+    // Fails whatever is still queued with COMM_PORT_BUSY and joins the I/O thread.
+    void stop();
+    bool running() const;
+
+    // READ of length bytes.
+    std::future<AsyncReply> read(uint8_t id, uint8_t address, uint8_t length);
+    void read(uint8_t id, uint8_t address, uint8_t length, AsyncCallback callback);
+
+    // WRITE of length bytes; with wait_status it completes when the status packet arrives.
+    std::future<AsyncReply> write(uint8_t id, uint8_t address, const uint8_t *data, uint8_t length, bool wait_status);
+
+    // SYNC_WRITE, as DxlTransport::sync_write(); completes once sent.
+    std::future<AsyncReply> sync_write(uint8_t address, uint8_t length, const uint8_t *ids, const uint8_t *data,
+                                       int count);
+
+    AsyncBusStats stats();
+
+private:
+    enum RequestKind
+    {
+        REQUEST_READ,
+        REQUEST_WRITE,
+        REQUEST_SYNC_WRITE
+    };
+
+    struct Request
+    {
+        RequestKind kind;
+        uint8_t id;
+        uint8_t address;
+        uint8_t length;
+        uint8_t data[DXL_TRANSPORT_MAX_PACKET];
+        uint8_t ids[SYNC_WRITE_MAX_SERVOS];
+        int count;
+        bool wait_status;
+        int64_t queued_ns;
+        int64_t sent_ns;
+        std::promise<AsyncReply> promise;
+        AsyncCallback callback;
+    };
+
+    DxlTransport &transport;
+    int epoll_fd;
+    int wake_fd;  // eventfd: the queue has work, or stop
+    int timer_fd; // Reply deadline of the request in flight
+    pthread_t io_thread;
+    std::atomic<bool> io_running;
+
+    std::mutex queue_mutex; // Guards queue and bus_stats
+    std::deque<Request> queue;
+    AsyncBusStats bus_stats;
+
+    // I/O thread only
+    StatusParser parser;
+    Request in_flight;
+    bool waiting;
+    int64_t deadline_ns;
+
+    std::future<AsyncReply> submit(Request &request);
+    void complete(Request &request, int result, uint8_t error, const uint8_t *data, size_t length);
+    void dispatch();
+    void collect();
+    static void *run(void *bus);
+};
+
+#endif
@@ -1,14 +1,524 @@
 #include "dxl_servo_controller.h"
+#include "rt_config.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <memory>
+
+static int64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+const char *DxlController::port_path()
+{
+    const char *path = getenv(PORT_PATH_ENV);
+    return (path != NULL && path[0] != '\0') ? path : PORT_PATH;
+}
+
+const BusConfig &DxlController::bus_config() const
+{
+    return bus;
+}
+
+uint8_t DxlController::bus_id(int servo_id) const
+{
+    if (servo_id == DXL_ID_PAN)
+    {
+        return bus.pan_id;
+    }
+    if (servo_id == DXL_ID_TILT)
+    {
+        return bus.tilt_id;
+    }
+    return servo_id;
+}
+
+void DxlController::record_transaction(int64_t start_ns, int dxl_comm_result)
+{
+    int64_t elapsed = monotonic_ns() - start_ns;
+    stats.transactions++;
+    stats.total_ns += elapsed;
+    if (elapsed > stats.max_ns)
+    {
+        stats.max_ns = elapsed;
+    }
+    if (dxl_comm_result != COMM_SUCCESS)
+    {
+        stats.failures++;
+    }
+}
+
+int DxlController::record_reply(const AsyncReply &reply)
+{
+    std::lock_guard<std::mutex> lock(bus_mutex);
+    record_transaction(reply.queued_ns, reply.result);
+    return reply.result;
+}
+
+int DxlController::write1ByteTxRx(uint8_t servo_id, uint16_t address, uint8_t data, uint8_t *dxl_error)
+{
+    if (async_bus.running())
+    {
+        AsyncReply reply = async_bus.write(bus_id(servo_id), address, &data, 1, bus.status_return_level >= STATUS_RETURN_ALL).get();
+        *dxl_error = reply.error;
+        return record_reply(reply);
+    }
+    std::lock_guard<std::mutex> lock(bus_mutex);
+    int64_t start = monotonic_ns();
+    int dxl_comm_result;
+    if (transport.is_open())
+    {
+        dxl_comm_result = transport.write(bus_id(servo_id), address, &data, 1, bus.status_return_level >= STATUS_RETURN_ALL, dxl_error);
+    }
+    else if (bus.status_return_level < STATUS_RETURN_ALL)
+    {
+        *dxl_error = 0;
+        dxl_comm_result = packet_handler->write1ByteTxOnly(port_handler, bus_id(servo_id), address, data);
+    }
+    else
+    {
+        dxl_comm_result = packet_handler->write1ByteTxRx(port_handler, bus_id(servo_id), address, data, dxl_error);
+    }
+    record_transaction(start, dxl_comm_result);
+    return dxl_comm_result;
+}
+
+int DxlController::write2ByteTxRx(uint8_t servo_id, uint16_t address, uint16_t data, uint8_t *dxl_error)
+{
+    if (async_bus.running())
+    {
+        uint8_t bytes[2] = {DXL_LOBYTE(data), DXL_HIBYTE(data)};
+        AsyncReply reply = async_bus.write(bus_id(servo_id), address, bytes, 2, bus.status_return_level >= STATUS_RETURN_ALL).get();
+        *dxl_error = reply.error;
+        return record_reply(reply);
+    }
+    std::lock_guard<std::mutex> lock(bus_mutex);
+    int64_t start = monotonic_ns();
+    int dxl_comm_result;
+    if (transport.is_open())
+    {
+        uint8_t bytes[2] = {DXL_LOBYTE(data), DXL_HIBYTE(data)};
+        dxl_comm_result = transport.write(bus_id(servo_id), address, bytes, 2, bus.status_return_level >= STATUS_RETURN_ALL, dxl_error);
+    }
+    else if (bus.status_return_level < STATUS_RETURN_ALL)
+    {
+        *dxl_error = 0;
+        dxl_comm_result = packet_handler->write2ByteTxOnly(port_handler, bus_id(servo_id), address, data);
+    }
+    else
+    {
+        dxl_comm_result = packet_handler->write2ByteTxRx(port_handler, bus_id(servo_id), address, data, dxl_error);
+    }
+    record_transaction(start, dxl_comm_result);
+    return dxl_comm_result;
+}
+
+int DxlController::read2ByteTxRx(uint8_t servo_id, uint16_t address, uint16_t *data, uint8_t *dxl_error)
+{
+    if (async_bus.running())
+    {
+        AsyncReply reply = async_bus.read(bus_id(servo_id), address, 2).get();
+        *dxl_error = reply.error;
+        *data = reply.length == 2 ? DXL_MAKEWORD(reply.data[0], reply.data[1]) : 0;
+        return record_reply(reply);
+    }
+    std::lock_guard<std::mutex> lock(bus_mutex);
+    int64_t start = monotonic_ns();
+    int dxl_comm_result;
+    if (transport.is_open())
+    {
+        uint8_t bytes[2] = {0, 0};
+        dxl_comm_result = transport.read(bus_id(servo_id), address, 2, bytes, dxl_error);
+        *data = DXL_MAKEWORD(bytes[0], bytes[1]);
+    }
+    else
+    {
+        dxl_comm_result = packet_handler->read2ByteTxRx(port_handler, bus_id(servo_id), address, data, dxl_error);
+    }
+    record_transaction(start, dxl_comm_result);
+    return dxl_comm_result;
+}
+
+int DxlController::readTxRx(uint8_t servo_id, uint16_t address, uint16_t length, uint8_t *data, uint8_t *dxl_error)
+{
+    if (async_bus.running())
+    {
+        AsyncReply reply = async_bus.read(bus_id(servo_id), address, length).get();
+        *dxl_error = reply.error;
+        memcpy(data, reply.data, reply.length);
+        return record_reply(reply);
+    }
+    std::lock_guard<std::mutex> lock(bus_mutex);
+    int64_t start = monotonic_ns();
+    int dxl_comm_result;
+    if (transport.is_open())
+    {
+        dxl_comm_result = transport.read(bus_id(servo_id), address, length, data, dxl_error);
+    }
+    else
+    {
+        dxl_comm_result = packet_handler->readTxRx(port_handler, bus_id(servo_id), address, length, data, dxl_error);
+    }
+    record_transaction(start, dxl_comm_result);
+    return dxl_comm_result;
+}
+
+int DxlController::syncWriteTxOnly(uint16_t address, uint16_t length, const uint8_t *ids, const uint8_t *data, int count)
+{
+    if (async_bus.running())
+    {
+        return record_reply(async_bus.sync_write(address, length, ids, data, count).get());
+    }
+    std::lock_guard<std::mutex> lock(bus_mutex);
+    int64_t start = monotonic_ns();
+    int dxl_comm_result;
+    if (transport.is_open())
+    {
+        dxl_comm_result = transport.sync_write(address, length, ids, data, count);
+    }
+    else
+    {
+        dynamixel::GroupSyncWrite sync_write(port_handler, packet_handler, address, length);
+        dxl_comm_result = COMM_SUCCESS;
+        for (int i = 0; i < count && dxl_comm_result == COMM_SUCCESS; i++)
+        {
+            // A servo that can't be added would be left out of the packet without a word
+            if (!sync_write.addParam(ids[i], const_cast<uint8_t *>(data + i * length)))
+            {
+                dxl_comm_result = COMM_TX_ERROR;
+            }
+        }
+        if (dxl_comm_result == COMM_SUCCESS)
+        {
+            dxl_comm_result = sync_write.txPacket();
+        }
+    }
+    record_transaction(start, dxl_comm_result);
+    return dxl_comm_result;
+}
+
+std::future<AsyncReply> DxlController::read_async(int servo_id, uint16_t address, uint16_t length)
+{
+    if (async_bus.running())
+    {
+        // Counted when it completes, on the I/O thread
+        std::shared_ptr<std::promise<AsyncReply>> done = std::make_shared<std::promise<AsyncReply>>();
+        std::future<AsyncReply> reply = done->get_future();
+        async_bus.read(bus_id(servo_id), address, length, [this, done](const AsyncReply &status) {
+            record_reply(status);
+            done->set_value(status);
+        });
+        return reply;
+    }
+
+    std::promise<AsyncReply> done;
+    AsyncReply status = AsyncReply();
+    status.queued_ns = status.sent_ns = monotonic_ns();
+    if (length <= sizeof(status.data))
+    {
+        status.result = readTxRx(servo_id, address, length, status.data, &status.error);
+        status.length = status.result == COMM_SUCCESS ? length : 0;
+    }
+    else
+    {
+        status.result = COMM_TX_ERROR;
+    }
+    status.completed_ns = monotonic_ns();
+    done.set_value(status);
+    return done.get_future();
+}
+
+const BusStats &DxlController::bus_stats() const
+{
+    return stats;
+}
+
+void DxlController::print_bus_stats()
+{
+    {
+        std::lock_guard<std::mutex> lock(bus_mutex);
+        printf("[DXL]: %lu bus transactions on %s, %lu failed", stats.transactions, bus.port.c_str(), stats.failures);
+        if (stats.transactions > 0)
+        {
+            printf(", mean round trip = %.2f ms, max = %.2f ms", stats.total_ns / 1e6 / stats.transactions, stats.max_ns / 1e6);
+        }
+        printf("\n");
+        if (transport.packets_encoded() > 0)
+        {
+            printf("[DXL]: lean transport encoded %llu packets, mean %.2f us each\n",
+                   (unsigned long long)transport.packets_encoded(), transport.encode_total_ns() / 1e3 / transport.packets_encoded());
+        }
+    }
+    AsyncBusStats async_stats = async_bus.stats();
+    if (async_stats.requests > 0)
+    {
+        printf("[DXL]: async bus completed %lu requests, mean %.2f ms from queued, %lu timed out, %lu stray status "
+               "packets, queue peaked at %zu\n",
+               async_stats.requests, async_stats.total_ns / 1e6 / async_stats.requests, async_stats.timeouts,
+               async_stats.stray_packets, async_stats.max_queue_depth);
+    }
+    unsigned long cycles = poll_cycles.load(std::memory_order_relaxed);
+    printf("[DXL]: servo state polled %lu times at %.0f Hz, %lu overruns", cycles, poll_hz,
+           poll_overruns.load(std::memory_order_relaxed));
+    if (cycles > 0)
+    {
+        printf(", woke up %.3f ms late on average, %.3f ms at worst",
+               poll_late_total_ns.load(std::memory_order_relaxed) / 1e6 / cycles,
+               poll_late_max_ns.load(std::memory_order_relaxed) / 1e6);
+    }
+    printf("\n");
+
+    std::lock_guard<std::mutex> lock(goals_mutex);
+    if (goal_stats.issued > 0)
+    {
+        printf("[DXL]: %lu goals, %lu reached", goal_stats.issued, goal_stats.reached);
+        if (goal_stats.reached > 0)
+        {
+            printf(" (mean %.1f ms)", goal_stats.reach_total_ns / 1e6 / goal_stats.reached);
+        }
+        printf(", %lu superseded, %lu failed\n", goal_stats.superseded, goal_stats.failed);
+    }
+}
+
+DxlController::InFlightGoal *DxlController::goal_for(int servo_id)
+{
+    for (InFlightGoal &goal : goals)
+    {
+        if (goal.servo_id == servo_id)
+        {
+            return &goal;
+        }
+    }
+    return NULL;
+}
+
+void DxlController::finish_goal(InFlightGoal &goal, GoalOutcome outcome)
+{
+    goal.active = false;
+    goal.promise.set_value(outcome);
+    switch (outcome)
+    {
+    case GOAL_REACHED:
+        goal_stats.reached++;
+        goal_stats.reach_total_ns += monotonic_ns() - goal.issued_ns;
+        break;
+    case GOAL_SUPERSEDED:
+        goal_stats.superseded++;
+        break;
+    case GOAL_FAILED:
+        goal_stats.failed++;
+        break;
+    case GOAL_CANCELLED:
+        break;
+    }
+}
+
+std::shared_future<GoalOutcome> DxlController::track_goal(int servo_id, int goal_position)
+{
+    std::lock_guard<std::mutex> lock(goals_mutex);
+    InFlightGoal *goal = goal_for(servo_id);
+    if (goal == NULL)
+    {
+        std::promise<GoalOutcome> unknown;
+        unknown.set_value(GOAL_FAILED);
+        return unknown.get_future().share();
+    }
+
+    if (goal->active)
+    {
+        finish_goal(*goal, GOAL_SUPERSEDED);
+    }
+    goal->promise = std::promise<GoalOutcome>();
+    std::shared_future<GoalOutcome> outcome = goal->promise.get_future().share();
+
+    goal->active = true;
+    goal->generation++;
+    goal->goal_position = goal_position;
+    goal->issued_ns = monotonic_ns();
+    goal_stats.issued++;
+
+    // relative_PAN/relative_TILT couldn't write it
+    if (goal_position < 0)
+    {
+        finish_goal(*goal, GOAL_FAILED);
+    }
+    return outcome;
+}
+
+bool DxlController::moving(int servo_id)
+{
+    std::lock_guard<std::mutex> lock(goals_mutex);
+    InFlightGoal *goal = goal_for(servo_id);
+    return goal != NULL && goal->active;
+}
+
+// AX-12 speed and load: bits 0-9 are the magnitude, bit 10 set means clockwise
+static int signed_magnitude(uint16_t value)
+{
+    int magnitude = value & 0x3ff;
+    return (value & 0x400) ? -magnitude : magnitude;
+}
+
+void DxlController::store_state(StateSnapshot &state, const AsyncReply &status)
+{
+    if (status.result != COMM_SUCCESS || status.error != 0 || status.length < 2)
+    {
+        state.failed_reads++;
+        return;
+    }
+    state.failed_reads = 0;
+    uint8_t data[6] = {0};
+    memcpy(data, status.data, status.length < sizeof(data) ? status.length : sizeof(data));
+
+    uint32_t sequence = state.sequence.load(std::memory_order_relaxed);
+    state.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    state.position.store(data[0] | (data[1] << 8), std::memory_order_relaxed);
+    state.speed.store(signed_magnitude(data[2] | (data[3] << 8)), std::memory_order_relaxed);
+    state.load.store(signed_magnitude(data[4] | (data[5] << 8)), std::memory_order_relaxed);
+    state.read_ns.store(monotonic_ns(), std::memory_order_relaxed);
+    state.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool DxlController::cached_state(int servo_id, ServoState &out) const
+{
+    for (const StateSnapshot &state : states)
+    {
+        if (state.servo_id != servo_id)
+        {
+            continue;
+        }
+        uint32_t before, after;
+        do
+        {
+            before = state.sequence.load(std::memory_order_acquire);
+            out.position = state.position.load(std::memory_order_relaxed);
+            out.speed = state.speed.load(std::memory_order_relaxed);
+            out.load = state.load.load(std::memory_order_relaxed);
+            out.read_ns = state.read_ns.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = state.sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        return out.read_ns != 0;
+    }
+    return false;
+}
+
+void DxlController::check_goals()
+{
+    std::lock_guard<std::mutex> lock(goals_mutex);
+    for (size_t i = 0; i < 2; i++)
+    {
+        InFlightGoal &goal = goals[i];
+        if (!goal.active)
+        {
+            continue;
+        }
+        if (states[i].failed_reads >= GOAL_MAX_FAILED_READS)
+        {
+            finish_goal(goal, GOAL_FAILED);
+            continue;
+        }
+
+        // Only a read from after the goal was written says anything about it
+        ServoState state;
+        if (cached_state(goal.servo_id, state) && state.read_ns > goal.issued_ns &&
+            abs(goal.goal_position - state.position) <= DXL_MOVING_STATUS_THRESHOLD)
+        {
+            finish_goal(goal, GOAL_REACHED);
+            continue;
+        }
+        if (monotonic_ns() - goal.issued_ns > int64_t(GOAL_TIMEOUT_MS) * 1000000)
+        {
+            printf("[DXL]: ID %d didn't reach %d within %d ms\n", goal.servo_id, goal.goal_position, GOAL_TIMEOUT_MS);
+            finish_goal(goal, GOAL_FAILED);
+        }
+    }
+}
+
+void *DxlController::poll_servos(void *arg)
+{
+    DxlController *controller = (DxlController *)arg;
+    // Its --rt settings are applied by the controller thread, which can't touch this stack
+    prefault_rt_stack();
+    int64_t period_ns = int64_t(1e9 / controller->poll_hz);
+    int64_t next_ns = monotonic_ns();
+
+    while (controller->poller_running.load())
+    {
+        int64_t late_ns = monotonic_ns() - next_ns;
+        controller->poll_late_total_ns.fetch_add(late_ns, std::memory_order_relaxed);
+        if (late_ns > controller->poll_late_max_ns.load(std::memory_order_relaxed))
+        {
+            controller->poll_late_max_ns.store(late_ns, std::memory_order_relaxed);
+        }
+        // Both reads are queued before either is waited for, so with the
+        // async bus the second goes out the moment the first is answered
+        std::future<AsyncReply> replies[2];
+        for (size_t i = 0; i < 2; i++)
+        {
+            // Position, speed and load are next to each other in the control table
+            replies[i] = controller->read_async(controller->states[i].servo_id, ADDR_MX_PRESENT_POSITION,
+                                                controller->poll_speed_load ? 6 : 2);
+        }
+        for (size_t i = 0; i < 2; i++)
+        {
+            controller->store_state(controller->states[i], replies[i].get());
+        }
+        controller->check_goals();
+        controller->poll_cycles.fetch_add(1, std::memory_order_relaxed);
+
+        // Fixed rate; if the bus made us miss ticks, start again from now
+        next_ns += period_ns;
+        int64_t now = monotonic_ns();
+        if (next_ns < now)
+        {
+            controller->poll_overruns.fetch_add(1, std::memory_order_relaxed);
+            next_ns = now;
+        }
+        struct timespec deadline = {time_t(next_ns / 1000000000), long(next_ns % 1000000000)};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    }
+    return NULL;
+}
+
+pthread_t DxlController::poller_handle() const
+{
+    return poller_thread;
+}
+
+void DxlController::stop_poller()
+{
+    if (poller_running.exchange(false))
+    {
+        pthread_join(poller_thread, NULL);
+    }
+
+    std::lock_guard<std::mutex> lock(goals_mutex);
+    for (InFlightGoal &goal : goals)
+    {
+        if (goal.active)
+        {
+            finish_goal(goal, GOAL_CANCELLED);
+        }
+    }
+}
 
 void DxlController::clean_up()
 {
     int dxl_comm_result = COMM_TX_FAIL; // Communication result
     uint8_t dxl_error = 0;              // Dynamixel error
 
+    stop_poller();
+
     cout << "Servo ID: " << DXL_ID_PAN << " -- [Disabling Torque!]" << endl;
 
     // Disable Dynamixel Torque for Pan servo
-    dxl_comm_result = packet_handler->write1ByteTxRx(port_handler, DXL_ID_PAN, ADDR_MX_TORQUE_ENABLE, TORQUE_DISABLE, &dxl_error);
+    dxl_comm_result = write1ByteTxRx(DXL_ID_PAN, ADDR_MX_TORQUE_ENABLE, TORQUE_DISABLE, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         printf("%s\n", packet_handler->getTxRxResult(dxl_comm_result));
@@ -21,7 +531,7 @@ void DxlController::clean_up()
     cout << "Servo ID: " << DXL_ID_TILT << " -- [Disabling Torque!]" << endl;
 
     // Disable Dynamixel Torque for Tilt servo
-    dxl_comm_result = packet_handler->write1ByteTxRx(port_handler, DXL_ID_TILT, ADDR_MX_TORQUE_ENABLE, TORQUE_DISABLE, &dxl_error);
+    dxl_comm_result = write1ByteTxRx(DXL_ID_TILT, ADDR_MX_TORQUE_ENABLE, TORQUE_DISABLE, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         printf("%s\n", packet_handler->getTxRxResult(dxl_comm_result));
@@ -31,42 +541,95 @@ void DxlController::clean_up()
         printf("%s\n", packet_handler->getRxPacketError(dxl_error));
     }
 
+    print_bus_stats();
+
     // Close ports
-    port_handler->closePort();
+    async_bus.stop();
+    if (transport.is_open())
+    {
+        transport.close();
+    }
+    else
+    {
+        port_handler->closePort();
+    }
     return;
 }
 
-DxlController::DxlController()
+DxlController::DxlController(double poll_hz, bool poll_speed_load, bool lean_transport, bool async_io)
+    : async_bus(transport), poll_hz(poll_hz > 0 ? poll_hz : DEFAULT_SERVO_POLL_HZ), poll_speed_load(poll_speed_load), poll_cycles(0),
+      poll_overruns(0), poll_late_total_ns(0), poll_late_max_ns(0), poller_running(false)
 {
-    port_handler = dynamixel::PortHandler::getPortHandler(PORT_PATH);
+    stats = BusStats();
+    goal_stats = GoalStats();
+    goals[0].servo_id = DXL_ID_PAN;
+    goals[1].servo_id = DXL_ID_TILT;
+    for (size_t i = 0; i < 2; i++)
+    {
+        goals[i].active = false;
+        goals[i].generation = 0;
+        states[i].servo_id = goals[i].servo_id;
+        states[i].sequence = 0;
+        states[i].position = 0;
+        states[i].speed = 0;
+        states[i].load = 0;
+        states[i].read_ns = 0;
+        states[i].failed_reads = 0;
+    }
+    // Saved by dxl_bus_setup; $DXL_PORT still wins, e.g. for dxl_emulator
+    bus = default_bus_config();
+    std::string config_path = bus_config_path();
+    if (load_bus_config(config_path, bus))
+    {
+        printf("[DXL]: bus config from %s: %d bps, pan ID %d, tilt ID %d, status return level %d\n", config_path.c_str(),
+               bus.baud_rate, bus.pan_id, bus.tilt_id, bus.status_return_level);
+    }
+    const char *port_override = getenv(PORT_PATH_ENV);
+    if (port_override != NULL && port_override[0] != '\0')
+    {
+        bus.port = port_override;
+    }
+    port_handler = dynamixel::PortHandler::getPortHandler(bus.port.c_str());
     packet_handler = dynamixel::PacketHandler::getPacketHandler(PROTOCOL_VERSION);
 
     int dxl_comm_result = COMM_TX_FAIL; // Communication result
 
     uint8_t dxl_error = 0; // Dynamixel error
 
-    // Open port for BOTH servos
-    if (port_handler->openPort())
+    if (lean_transport && transport.open(bus.port, bus.baud_rate, bus.return_delay_us))
     {
-        printf("Succeeded to open the port!\n");
+        printf("[DXL]: lean transport on %s at %d bps\n", bus.port.c_str(), bus.baud_rate);
     }
     else
     {
-        throw std::runtime_error("Failed to open the port!");
-    }
+        if (lean_transport)
+        {
+            printf("[DXL]: falling back to the SDK transport\n");
+        }
 
-    // Set port baudrate for servos
-    if (port_handler->setBaudRate(BAUDRATE))
-    {
-        printf("Succeeded to change the baudrate!\n");
-    }
-    else
-    {
-        throw std::runtime_error("Failed to change the baudrate");
+        // Open port for BOTH servos
+        if (port_handler->openPort())
+        {
+            printf("Succeeded to open the port!\n");
+        }
+        else
+        {
+            throw std::runtime_error("Failed to open the port!");
+        }
+
+        // Set port baudrate for servos
+        if (port_handler->setBaudRate(bus.baud_rate))
+        {
+            printf("Succeeded to change the baudrate!\n");
+        }
+        else
+        {
+            throw std::runtime_error("Failed to change the baudrate");
+        }
     }
 
     // Enable Torque for PAN servo (port1)
-    dxl_comm_result = packet_handler->write1ByteTxRx(port_handler, DXL_ID_PAN, ADDR_MX_TORQUE_ENABLE, TORQUE_ENABLE, &dxl_error);
+    dxl_comm_result = write1ByteTxRx(DXL_ID_PAN, ADDR_MX_TORQUE_ENABLE, TORQUE_ENABLE, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         throw std::runtime_error(packet_handler->getTxRxResult(dxl_comm_result));
@@ -81,7 +644,7 @@ DxlController::DxlController()
     }
 
     // Enable Torque for TILT servo (port2)
-    dxl_comm_result = packet_handler->write1ByteTxRx(port_handler, DXL_ID_PAN, ADDR_MX_TORQUE_ENABLE, TORQUE_ENABLE, &dxl_error);
+    dxl_comm_result = write1ByteTxRx(DXL_ID_TILT, ADDR_MX_TORQUE_ENABLE, TORQUE_ENABLE, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         throw std::runtime_error(packet_handler->getTxRxResult(dxl_comm_result));
@@ -96,7 +659,7 @@ DxlController::DxlController()
     }
 
     //Change PAN moving speed
-    dxl_comm_result = packet_handler->write2ByteTxRx(port_handler, DXL_ID_PAN, ADDR_MX_MOVEMENT_SPEED, MOVE_SPEED, &dxl_error);
+    dxl_comm_result = write2ByteTxRx(DXL_ID_PAN, ADDR_MX_MOVEMENT_SPEED, MOVE_SPEED, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         throw std::runtime_error(packet_handler->getTxRxResult(dxl_comm_result));
@@ -111,7 +674,7 @@ DxlController::DxlController()
     }
 
     // Change TILT moving speed
-    dxl_comm_result = packet_handler->write2ByteTxRx(port_handler, DXL_ID_TILT, ADDR_MX_MOVEMENT_SPEED, MOVE_SPEED, &dxl_error);
+    dxl_comm_result = write2ByteTxRx(DXL_ID_TILT, ADDR_MX_MOVEMENT_SPEED, MOVE_SPEED, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         throw std::runtime_error(packet_handler->getTxRxResult(dxl_comm_result));
@@ -125,6 +688,27 @@ DxlController::DxlController()
         printf("TILT Dynamixel speed has been changed \n");
     }
 
+    // Set up synchronously above; from here on the I/O thread owns the port
+    if (async_io)
+    {
+        if (transport.is_open() && async_bus.start())
+        {
+            printf("[DXL]: async bus I/O thread started\n");
+        }
+        else
+        {
+            printf("[DXL]: --dxl-async needs the lean transport; staying synchronous\n");
+        }
+    }
+
+    // Keeps the state cache fresh and watches goals issued with track_goal()
+    poller_running = true;
+    if (pthread_create(&poller_thread, NULL, poll_servos, this) != 0)
+    {
+        poller_running = false;
+        throw std::runtime_error("Failed to start the servo poller thread");
+    }
+
     printf("DxlController object has been created\n");
 }
 
@@ -134,31 +718,58 @@ DxlController::~DxlController()
     clean_up();
 }
 
-int DxlController::relative_PAN(int PAN_degrees)
+bool DxlController::goal_in_bounds(int servo_id, int goal_position)
 {
-    // Error checking variables
-    uint8_t dxl_error = 0;              // Dynamixel error
-    int dxl_comm_result = COMM_TX_FAIL; // Communication result
+    int minimum = servo_id == DXL_ID_TILT ? DXL_TILT_MINIMUM_POSITION_VALUE : DXL_PAN_MINIMUM_POSITION_VALUE;
+    int maximum = servo_id == DXL_ID_TILT ? DXL_TILT_MAXIMUM_POSITION_VALUE : DXL_PAN_MAXIMUM_POSITION_VALUE;
+    if (goal_position > maximum || goal_position < minimum)
+    {
+        printf("Target position %i for ID %d is out of bounds\n", goal_position, servo_id);
+        return false;
+    }
+    return true;
+}
 
-    // Get the current position of the servo
-    int current_pos = getPosition(DXL_ID_PAN);
+int DxlController::relative_goal(int servo_id, int degrees)
+{
+    // Get the current position of the servo, from the cache if it's fresh
+    ServoState state;
+    int current_pos;
+    if (cached_state(servo_id, state) && monotonic_ns() - state.read_ns <= int64_t(SERVO_STATE_MAX_AGE_MS) * 1000000)
+    {
+        current_pos = state.position;
+    }
+    else
+    {
+        current_pos = getPosition(servo_id);
+    }
+    if (current_pos < 0)
+    {
+        return -1;
+    }
 
     // Convert from degrees to servo position unit
-    int pos_diff = PAN_degrees / .29296875;
+    int pos_diff = degrees / .29296875;
 
     int goal_position = current_pos - pos_diff;
 
-    // Write goal position for PAN servo
-    if (goal_position <= DXL_PAN_MAXIMUM_POSITION_VALUE && goal_position >= DXL_PAN_MINIMUM_POSITION_VALUE)
-    {
-        dxl_comm_result = packet_handler->write2ByteTxRx(port_handler, DXL_ID_PAN, ADDR_MX_GOAL_POSITION, goal_position, &dxl_error);
-    }
-    else
+    return goal_in_bounds(servo_id, goal_position) ? goal_position : -1;
+}
+
+int DxlController::relative_PAN(int PAN_degrees)
+{
+    // Error checking variables
+    uint8_t dxl_error = 0;              // Dynamixel error
+    int dxl_comm_result = COMM_TX_FAIL; // Communication result
+
+    int goal_position = relative_goal(DXL_ID_PAN, PAN_degrees);
+    if (goal_position < 0)
     {
-        printf("Target position %i is out of bounds\n", goal_position);
         return -1;
     }
 
+    // Write goal position for PAN servo
+    dxl_comm_result = write2ByteTxRx(DXL_ID_PAN, ADDR_MX_GOAL_POSITION, goal_position, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         cout << "FAILED to write goal position for PAN servo. ID:" << DXL_ID_PAN << endl;
@@ -180,40 +791,78 @@ int DxlController::relative_TILT(int TILT_degrees)
     uint8_t dxl_error = 0;              // Dynamixel error
     int dxl_comm_result = COMM_TX_FAIL; // Communication result
 
-    // Get the current position of the servo
-    int current_pos = getPosition(DXL_ID_TILT);
-
-    // Convert from degrees to servo position unit
-    int pos_diff = TILT_degrees / .29296875;
-
-    int goal_position = current_pos - pos_diff;
-
-    // Write goal position for PAN servo
-    if (goal_position <= DXL_TILT_MAXIMUM_POSITION_VALUE && goal_position >= DXL_TILT_MINIMUM_POSITION_VALUE)
-    {
-        dxl_comm_result = packet_handler->write2ByteTxRx(port_handler, DXL_ID_TILT, ADDR_MX_GOAL_POSITION, goal_position, &dxl_error);
-    }
-    else
+    int goal_position = relative_goal(DXL_ID_TILT, TILT_degrees);
+    if (goal_position < 0)
     {
-        printf("Target position %i is out of bounds\n", goal_position);
         return -1;
     }
 
+    // Write goal position for TILT servo
+    dxl_comm_result = write2ByteTxRx(DXL_ID_TILT, ADDR_MX_GOAL_POSITION, goal_position, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
-        cout << "FAILED to write goal position for PAN servo. ID:" << DXL_ID_TILT << endl;
+        cout << "FAILED to write goal position for TILT servo. ID:" << DXL_ID_TILT << endl;
         printf("%s\n", packet_handler->getTxRxResult(dxl_comm_result));
         return -1;
     }
     else if (dxl_error != 0)
     {
-        cout << "FAILED to write goal position for PAN servo. ID:" << DXL_ID_TILT << endl;
+        cout << "FAILED to write goal position for TILT servo. ID:" << DXL_ID_TILT << endl;
         printf("%s\n", packet_handler->getRxPacketError(dxl_error));
         return -1;
     }
     return goal_position;
 }
 
+bool DxlController::move_together(vector<AxisGoal> &goals, bool wait)
+{
+    // Goal position is 2 bytes at ADDR_MX_GOAL_POSITION on every servo
+    if (goals.size() > 2)
+    {
+        printf("Can't sync write %zu servos\n", goals.size());
+        return false;
+    }
+    uint8_t ids[2];
+    uint8_t data[2 * 2];
+    for (size_t i = 0; i < goals.size(); i++)
+    {
+        int goal_position = goals[i].goal_position;
+        if (!goal_in_bounds(goals[i].servo_id, goal_position))
+        {
+            return false;
+        }
+
+        ids[i] = bus_id(goals[i].servo_id);
+        data[2 * i] = DXL_LOBYTE(goal_position);
+        data[2 * i + 1] = DXL_HIBYTE(goal_position);
+    }
+
+    int dxl_comm_result = syncWriteTxOnly(ADDR_MX_GOAL_POSITION, 2, ids, data, goals.size());
+    if (dxl_comm_result != COMM_SUCCESS)
+    {
+        cout << "FAILED to sync write goal positions" << endl;
+        printf("%s\n", packet_handler->getTxRxResult(dxl_comm_result));
+        return false;
+    }
+
+    for (size_t i = 0; i < goals.size(); i++)
+    {
+        goals[i].done = track_goal(goals[i].servo_id, goals[i].goal_position);
+    }
+    if (!wait)
+    {
+        return true;
+    }
+
+    // The poller thread watches all of them at once
+    bool reached = true;
+    for (size_t i = 0; i < goals.size(); i++)
+    {
+        reached = goals[i].done.get() == GOAL_REACHED && reached;
+    }
+    return reached;
+}
+
 int DxlController::getPosition(int servo_id)
 {
     // Error checking variables
@@ -222,7 +871,7 @@ int DxlController::getPosition(int servo_id)
     uint16_t dxl_present_position = 0;  // Present position
 
     // Read present position for PAN servo
-    dxl_comm_result = packet_handler->read2ByteTxRx(port_handler, servo_id, ADDR_MX_PRESENT_POSITION, &dxl_present_position, &dxl_error);
+    dxl_comm_result = read2ByteTxRx(servo_id, ADDR_MX_PRESENT_POSITION, &dxl_present_position, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         printf("%s\n", packet_handler->getTxRxResult(dxl_comm_result));
@@ -260,44 +909,49 @@ void DxlController::WAIT_for_goal(int servo_ID, int goal_position)
     } while ((abs(goal_position - current_position) > DXL_MOVING_STATUS_THRESHOLD));
 }
 
-bool DxlController::return_home()
+bool DxlController::drive_together(const vector<AxisDrive> &drives)
 {
-    cout << "Returning home..." << endl;
-    // Error checking variables
-    uint8_t dxl_error = 0;              // Dynamixel error
-    int dxl_comm_result = COMM_TX_FAIL; // Communication result
-
-    dxl_comm_result = packet_handler->write2ByteTxRx(port_handler, DXL_ID_PAN, ADDR_MX_GOAL_POSITION, 511, &dxl_error);
-    if (dxl_comm_result != COMM_SUCCESS)
+    // Goal position at 30-31 and moving speed at 32-33
+    if (drives.size() > 2)
     {
-        cout << "FAILED to write goal position for PAN servo. ID:" << DXL_ID_PAN << endl;
-        printf("%s\n", packet_handler->getTxRxResult(dxl_comm_result));
+        printf("Can't sync write %zu servos\n", drives.size());
         return false;
     }
-    else if (dxl_error != 0)
+    uint8_t ids[2];
+    uint8_t data[2 * 4];
+    for (size_t i = 0; i < drives.size(); i++)
     {
-        cout << "FAILED to write goal position for PAN servo. ID:" << DXL_ID_PAN << endl;
-        printf("%s\n", packet_handler->getRxPacketError(dxl_error));
-        return false;
-    }
+        int minimum = drives[i].servo_id == DXL_ID_TILT ? DXL_TILT_MINIMUM_POSITION_VALUE : DXL_PAN_MINIMUM_POSITION_VALUE;
+        int maximum = drives[i].servo_id == DXL_ID_TILT ? DXL_TILT_MAXIMUM_POSITION_VALUE : DXL_PAN_MAXIMUM_POSITION_VALUE;
+        int goal_position = drives[i].goal_position < minimum ? minimum : (drives[i].goal_position > maximum ? maximum : drives[i].goal_position);
+        int speed = drives[i].speed < 0 ? 0 : (drives[i].speed > 1023 ? 1023 : drives[i].speed);
 
-    WAIT_for_goal(DXL_ID_PAN, 511);
+        ids[i] = bus_id(drives[i].servo_id);
+        data[4 * i] = DXL_LOBYTE(goal_position);
+        data[4 * i + 1] = DXL_HIBYTE(goal_position);
+        data[4 * i + 2] = DXL_LOBYTE(speed);
+        data[4 * i + 3] = DXL_HIBYTE(speed);
+    }
 
-    dxl_comm_result = packet_handler->write2ByteTxRx(port_handler, DXL_ID_TILT, ADDR_MX_GOAL_POSITION, 511, &dxl_error);
+    int dxl_comm_result = syncWriteTxOnly(ADDR_MX_GOAL_POSITION, 4, ids, data, drives.size());
     if (dxl_comm_result != COMM_SUCCESS)
     {
-        cout << "FAILED to write goal position for TILT servo. ID:" << DXL_ID_TILT << endl;
         printf("%s\n", packet_handler->getTxRxResult(dxl_comm_result));
         return false;
     }
-    else if (dxl_error != 0)
+    return true;
+}
+
+bool DxlController::return_home()
+{
+    cout << "Returning home..." << endl;
+
+    // Both axes at once, arriving together
+    vector<AxisGoal> home = {{DXL_ID_PAN, 511, {}}, {DXL_ID_TILT, 511, {}}};
+    if (!move_together(home, true))
     {
-        cout << "FAILED to write goal position for TILT servo. ID:" << DXL_ID_TILT << endl;
-        printf("%s\n", packet_handler->getRxPacketError(dxl_error));
+        cout << "FAILED to return home" << endl;
         return false;
     }
-
-    WAIT_for_goal(DXL_ID_TILT, 511);
-
     return true;
 }
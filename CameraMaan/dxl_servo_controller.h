@@ -16,12 +16,25 @@
 #include <string>
 #include <iostream>
 #include <exception>
+#include <stdint.h>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <pthread.h>
+#include <vector>
+
+#include "bus_config.h"
+#include "dxl_async_bus.h"
+#include "dxl_transport.h"
+#include "servo_state.h"
 
 // Control table address
 #define ADDR_MX_TORQUE_ENABLE 24 // Control table address is different in Dynamixel model
 #define ADDR_MX_GOAL_POSITION 30
 #define ADDR_MX_PRESENT_POSITION 36
 #define ADDR_MX_MOVEMENT_SPEED 32
+#define ADDR_MX_PRESENT_SPEED 38
+#define ADDR_MX_PRESENT_LOAD 40
 
 // Protocol version
 #define PROTOCOL_VERSION 1.0 // See which protocol version is used in the Dynamixel
@@ -30,7 +43,11 @@
 #define DXL_ID_PAN 5   // Dynamixel ID: 5
 #define DXL_ID_TILT 10 // Dynamixel ID: 10
 #define BAUDRATE 57600
+#ifndef PORT_PATH
 #define PORT_PATH "/dev/ttyUSB0"
+#endif
+// Environment variable that overrides PORT_PATH, e.g. DXL_PORT=/tmp/ttyDXL for dxl_emulator
+#define PORT_PATH_ENV "DXL_PORT"
 
 #define TORQUE_ENABLE 1  // Value for enabling the torque
 #define TORQUE_DISABLE 0 // Value for disabling the torque
@@ -44,9 +61,56 @@
 
 #define MOVE_SPEED 10 //0 to 1023
 
+#define GOAL_TIMEOUT_MS 5000     // A goal not reached by then has failed (stalled, out of range, no torque)
+#define GOAL_MAX_FAILED_READS 5  // Consecutive failed position reads before a goal has failed
+
 #define ESC_ASCII_VALUE 0x1b
 
 using namespace std;
+
+// Request/status round trips on the servo bus
+struct BusStats
+{
+    unsigned long transactions;
+    unsigned long failures;
+    int64_t total_ns;
+    int64_t max_ns;
+};
+
+// How a goal issued with track_goal() ended
+enum GoalOutcome
+{
+    GOAL_REACHED,    // Within DXL_MOVING_STATUS_THRESHOLD of the goal
+    GOAL_SUPERSEDED, // A newer goal for the same servo replaced it
+    GOAL_FAILED,     // Couldn't be written, or not reached in GOAL_TIMEOUT_MS
+    GOAL_CANCELLED   // The controller was cleaned up first
+};
+
+// One servo's part of a coordinated move
+struct AxisGoal
+{
+    int servo_id;
+    int goal_position;
+    std::shared_future<GoalOutcome> done; // Filled in by move_together()
+};
+
+// One servo's part of a streamed velocity command
+struct AxisDrive
+{
+    int servo_id;
+    int goal_position;
+    int speed; // Moving speed register, 1 to 1023, or 0 for no speed control (full speed)
+};
+
+struct GoalStats
+{
+    unsigned long issued;
+    unsigned long reached;
+    unsigned long superseded;
+    unsigned long failed;
+    int64_t reach_total_ns; // Time from issue to reached, summed over reached goals
+};
+
 class DxlController
 {
 private:
@@ -60,10 +124,104 @@ private:
     // We are using Dynamixel AX-12's and they use PROTOCOL 1.0
     dynamixel::PacketHandler *packet_handler;
 
+    // Replaces port_handler and the SDK's TxRx calls when open
+    DxlTransport transport;
+
+    // Owns transport when running; the wrappers queue on it instead
+    DxlAsyncBus async_bus;
 
+    BusStats stats;
+    BusConfig bus; // Loaded from bus_config_path() at start up
+
+    // The SDK isn't thread safe; every bus transaction holds this
+    std::mutex bus_mutex;
+
+    /*
+     * Last state of each servo. The poller thread is the only writer; it
+     * bumps sequence to odd before writing and to even after, and readers
+     * retry until they see the same even sequence on both sides of their
+     * reads (a seqlock), so neither side ever waits for the other.
+     */
+    struct StateSnapshot
+    {
+        int servo_id;
+        std::atomic<uint32_t> sequence;
+        std::atomic<int> position;
+        std::atomic<int> speed;
+        std::atomic<int> load;
+        std::atomic<int64_t> read_ns;
+        int failed_reads; // Consecutive failed reads, poller thread only
+    };
+    StateSnapshot states[2]; // Pan, tilt
+    double poll_hz;
+    bool poll_speed_load;
+    // Written by the poller, read by print_bus_stats() from other threads
+    std::atomic<unsigned long> poll_cycles;
+    std::atomic<unsigned long> poll_overruns;
+    std::atomic<int64_t> poll_late_total_ns; // How late the poller woke up, summed over poll_cycles
+    std::atomic<int64_t> poll_late_max_ns;
+
+    // The goal in flight for each servo, checked against states by the poller thread
+    struct InFlightGoal
+    {
+        int servo_id;
+        bool active;
+        uint64_t generation; // Bumped on every new goal
+        int goal_position;
+        int64_t issued_ns;
+        std::promise<GoalOutcome> promise;
+    };
+    InFlightGoal goals[2]; // Pan, tilt
+    std::mutex goals_mutex;
+    GoalStats goal_stats;
+    pthread_t poller_thread;
+    std::atomic<bool> poller_running;
+
+    InFlightGoal *goal_for(int servo_id);
+    void finish_goal(InFlightGoal &goal, GoalOutcome outcome); // goals_mutex held
+    static void *poll_servos(void *controller);
+    void store_state(StateSnapshot &state, const AsyncReply &status);
+    void check_goals();
+    void stop_poller();
+
+    // DXL_ID_PAN/DXL_ID_TILT to the servo's ID on the bus
+    uint8_t bus_id(int servo_id) const;
+
+    // Whether goal_position is within the servo's range; prints why not
+    static bool goal_in_bounds(int servo_id, int goal_position);
+
+    /*
+     * Timed and counted wrappers around the SDK's TxRx calls. They take
+     * DXL_ID_PAN/DXL_ID_TILT and talk to the bus IDs from the bus config.
+     * When the servos only answer READs, the writes go out TxOnly and
+     * dxl_error is always 0. With the async bus they queue the request and
+     * wait for it without holding bus_mutex, so other threads' requests are
+     * queued behind it rather than blocked.
+     */
+    int write1ByteTxRx(uint8_t servo_id, uint16_t address, uint8_t data, uint8_t *dxl_error);
+    int write2ByteTxRx(uint8_t servo_id, uint16_t address, uint16_t data, uint8_t *dxl_error);
+    int read2ByteTxRx(uint8_t servo_id, uint16_t address, uint16_t *data, uint8_t *dxl_error);
+    int readTxRx(uint8_t servo_id, uint16_t address, uint16_t length, uint8_t *data, uint8_t *dxl_error);
+    // Never answered. data holds length bytes per servo, in the order of ids (bus IDs)
+    int syncWriteTxOnly(uint16_t address, uint16_t length, const uint8_t *ids, const uint8_t *data, int count);
+    void record_transaction(int64_t start_ns, int dxl_comm_result);
+    int record_reply(const AsyncReply &reply); // Takes bus_mutex
 
 public:
-    DxlController();
+    /*
+     * Loads the bus config (see bus_config.h), opens the port, enables
+     * torque and starts the poller thread.
+     *
+     * @param poll_hz how often every servo's state is read into the cache.
+     * @param poll_speed_load read present speed and load as well as position
+     * (6 bytes instead of 2 per read).
+     * @param lean_transport talk to the bus through DxlTransport instead of
+     * the SDK, falling back to the SDK if the port can't be set up for it.
+     * @param async_io with the lean transport, hand the bus to a DxlAsyncBus
+     * I/O thread once the servos are set up (see dxl_async_bus.h).
+     */
+    DxlController(double poll_hz = DEFAULT_SERVO_POLL_HZ, bool poll_speed_load = false, bool lean_transport = false,
+                  bool async_io = false);
     ~DxlController();
     void clean_up(); // Disables servo torque and closes ports.
 
@@ -75,6 +233,21 @@ public:
      */
     int getPosition(int servo_id);
 
+    /*
+     * Queues a READ of length bytes and returns without waiting for it, so
+     * several can be on their way at once. Without the async bus the read is
+     * done before returning and the future is already ready.
+     */
+    std::future<AsyncReply> read_async(int servo_id, uint16_t address, uint16_t length);
+
+    /*
+     * The servo's state as last read by the poller thread, without touching
+     * the bus. Lock-free; safe from any thread.
+     *
+     * @return false if the servo hasn't been read successfully yet.
+     */
+    bool cached_state(int servo_id, ServoState &state) const;
+
     /* +30 would rotate clockwise 30 degrees, while -30 will rotate counter-clockwise 30 degrees.
      *
      * @param an integer representing the desired change in orientation relative to the servos current position. 
@@ -84,9 +257,67 @@ public:
 
     int relative_TILT(int TILT_degrees);
 
+    /*
+     * The goal position relative_PAN/relative_TILT would write, without
+     * writing it. Computed from the cached position when it is at most
+     * SERVO_STATE_MAX_AGE_MS old, so it normally costs no bus round trip.
+     *
+     * @return the goal position, or -1 if it is out of bounds or the current
+     * position can't be read.
+     */
+    int relative_goal(int servo_id, int degrees);
+
+    /*
+     * Writes the goal positions of several servos in one SYNC_WRITE broadcast
+     * packet. Protocol 1.0 servos don't answer a broadcast, so it costs one
+     * packet on the bus instead of a request/status round trip per servo, and
+     * every servo starts moving at the same time. Each goal is tracked like
+     * track_goal() and its future is stored in goals[i].done.
+     *
+     * @param wait block until every servo has reached its goal (or failed).
+     * @return false if a goal is out of bounds (nothing is sent), the packet
+     * couldn't be sent, or, with wait, a servo didn't get there.
+     */
+    bool move_together(std::vector<AxisGoal> &goals, bool wait = false);
+
+    /*
+     * Writes goal position and moving speed (adjacent in the control table)
+     * for several servos in one SYNC_WRITE, for a control loop that streams
+     * updates. Goals are clamped to each servo's range and not tracked.
+     *
+     * @return false if the packet couldn't be sent.
+     */
+    bool drive_together(const std::vector<AxisDrive> &drives);
+
+    // Blocks until the servo is within DXL_MOVING_STATUS_THRESHOLD of goal_position.
     void WAIT_for_goal(int servo_ID, int goal_position);
 
+    /*
+     * Tracks a goal position that has just been written (e.g. by relative_PAN)
+     * without waiting for the servo to get there. A goal still in flight for
+     * the same servo is superseded straight away.
+     *
+     * @param goal_position as returned by relative_PAN/relative_TILT; a
+     * negative value gives a future that has already failed.
+     * @return a future that becomes ready with how the goal ended.
+     */
+    std::shared_future<GoalOutcome> track_goal(int servo_id, int goal_position);
+
+    // Whether a goal is still in flight for the servo.
+    bool moving(int servo_id);
+
     bool return_home();
+
+    // $DXL_PORT if set, otherwise PORT_PATH. The bus config can name another port.
+    static const char *port_path();
+
+    const BusConfig &bus_config() const;
+
+    const BusStats &bus_stats() const;
+    void print_bus_stats();
+
+    // The poller thread, e.g. to give it a real-time priority.
+    pthread_t poller_handle() const;
 };
 
 #endif
@@ -0,0 +1,565 @@
+#include "dxl_transport.h"
+#include "dynamixel_sdk.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+
+#define INST_READ 0x02
+#define INST_WRITE 0x03
+#define INST_SYNC_WRITE 0x83
+
+static int64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// The termios constant for a baud rate, or B0 if there isn't one
+static speed_t termios_speed(int baud_rate)
+{
+    switch (baud_rate)
+    {
+    case 9600:
+        return B9600;
+    case 19200:
+        return B19200;
+    case 57600:
+        return B57600;
+    case 115200:
+        return B115200;
+    case 230400:
+        return B230400;
+    case 460800:
+        return B460800;
+    case 500000:
+        return B500000;
+    case 1000000:
+        return B1000000;
+    case 2000000:
+        return B2000000;
+    default:
+        return B0;
+    }
+}
+
+DxlTransport::DxlTransport()
+    : fd(-1), baud_rate(0), return_delay_us(0), latency_timer_ms(0), byte_time_ns(0), encoded(0), encode_ns(0)
+{
+}
+
+DxlTransport::~DxlTransport()
+{
+    close();
+}
+
+bool DxlTransport::open(const std::string &path, int baud, int return_delay)
+{
+    speed_t speed = termios_speed(baud);
+    if (speed == B0)
+    {
+        fprintf(stderr, "[DXL]: The lean transport can't do %d bps\n", baud);
+        return false;
+    }
+
+    fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fprintf(stderr, "[DXL]: Can't open %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct termios tty;
+    memset(&tty, 0, sizeof(tty));
+    tty.c_cflag = CS8 | CLOCAL | CREAD;
+    tty.c_iflag = IGNPAR;
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+    if (tcsetattr(fd, TCSANOW, &tty) != 0)
+    {
+        fprintf(stderr, "[DXL]: Can't configure %s: %s\n", path.c_str(), strerror(errno));
+        close();
+        return false;
+    }
+    tcflush(fd, TCIOFLUSH);
+
+    baud_rate = baud;
+    return_delay_us = return_delay;
+    byte_time_ns = int64_t(10 * 1e9 / baud);
+    latency_timer_ms = 0;
+    set_low_latency(path);
+    return true;
+}
+
+void DxlTransport::set_low_latency(const std::string &path)
+{
+    // Hand received bytes to the tty layer straight away rather than batching them
+    struct serial_struct serial;
+    if (ioctl(fd, TIOCGSERIAL, &serial) == 0)
+    {
+        serial.flags |= ASYNC_LOW_LATENCY;
+        if (ioctl(fd, TIOCSSERIAL, &serial) != 0)
+        {
+            printf("[DXL]: Can't set ASYNC_LOW_LATENCY on %s: %s\n", path.c_str(), strerror(errno));
+        }
+    }
+    else
+    {
+        printf("[DXL]: %s has no serial driver settings (a pty?), skipping ASYNC_LOW_LATENCY\n", path.c_str());
+    }
+
+    // FTDI adapters hold partial USB packets for latency_timer ms (16 by default)
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved) == NULL)
+    {
+        return;
+    }
+    const char *name = strrchr(resolved, '/');
+    std::string timer_path = std::string("/sys/bus/usb-serial/devices/") + (name ? name + 1 : resolved) + "/latency_timer";
+    FILE *timer = fopen(timer_path.c_str(), "r+");
+    bool writable = timer != NULL;
+    if (timer == NULL && errno == ENOENT)
+    {
+        return;
+    }
+    if (timer == NULL)
+    {
+        // Usually root only to write, but anyone can read it
+        printf("[DXL]: Can't open %s: %s; the USB latency timer stays as it is\n", timer_path.c_str(), strerror(errno));
+        timer = fopen(timer_path.c_str(), "r");
+    }
+    // Whatever it is, replies can be held back that long
+    latency_timer_ms = DXL_TRANSPORT_FTDI_LATENCY_TIMER_MS;
+    int current = 0;
+    if (timer != NULL && fscanf(timer, "%d", &current) == 1)
+    {
+        latency_timer_ms = current;
+    }
+    if (writable && current > DXL_TRANSPORT_LATENCY_TIMER_MS)
+    {
+        rewind(timer);
+        if (fprintf(timer, "%d\n", DXL_TRANSPORT_LATENCY_TIMER_MS) > 0 && fflush(timer) == 0)
+        {
+            latency_timer_ms = DXL_TRANSPORT_LATENCY_TIMER_MS;
+            printf("[DXL]: USB latency timer %d ms -> %d ms\n", current, DXL_TRANSPORT_LATENCY_TIMER_MS);
+        }
+        else
+        {
+            printf("[DXL]: Can't set the USB latency timer: %s\n", strerror(errno));
+        }
+    }
+    if (timer != NULL)
+    {
+        fclose(timer);
+    }
+    if (latency_timer_ms > DXL_TRANSPORT_LATENCY_TIMER_MS)
+    {
+        printf("[DXL]: USB latency timer is %d ms; reply timeouts allow for it\n", latency_timer_ms);
+    }
+}
+
+void DxlTransport::close()
+{
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool DxlTransport::is_open() const
+{
+    return fd >= 0;
+}
+
+uint64_t DxlTransport::packets_encoded() const
+{
+    return encoded;
+}
+
+int64_t DxlTransport::encode_total_ns() const
+{
+    return encode_ns;
+}
+
+/*
+ * Finds or builds the template. For SYNC_WRITE, ids has count servos and
+ * each one's block is its ID followed by length data bytes.
+ */
+PacketTemplate &DxlTransport::get_template(uint8_t instruction, uint8_t id, uint8_t address, uint8_t length,
+                                           const uint8_t *ids, int count)
+{
+    uint64_t key = uint64_t(instruction) << 56 | uint64_t(address) << 48 | uint64_t(length) << 40 | uint64_t(count) << 32;
+    if (instruction == INST_SYNC_WRITE)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            key |= uint64_t(ids[i]) << (8 * i);
+        }
+    }
+    else
+    {
+        key |= id;
+    }
+
+    std::map<uint64_t, PacketTemplate>::iterator found = templates.find(key);
+    if (found != templates.end())
+    {
+        return found->second;
+    }
+
+    PacketTemplate &packet = templates[key];
+    memset(&packet, 0, sizeof(packet));
+    uint8_t *bytes = packet.bytes;
+    bytes[0] = 0xFF;
+    bytes[1] = 0xFF;
+    bytes[4] = instruction;
+    bytes[5] = address;
+    if (instruction == INST_READ)
+    {
+        bytes[2] = id;
+        bytes[6] = length;
+        packet.length = 8;
+    }
+    else if (instruction == INST_WRITE)
+    {
+        bytes[2] = id;
+        packet.data_offset = 6;
+        packet.data_length = length;
+        packet.length = 7 + length;
+    }
+    else
+    {
+        bytes[2] = BROADCAST_ID;
+        bytes[6] = length;
+        for (int i = 0; i < count; i++)
+        {
+            bytes[7 + i * (1 + length)] = ids[i];
+        }
+        packet.data_offset = 7;
+        packet.data_length = size_t(count) * (1 + length);
+        packet.length = 8 + packet.data_length;
+    }
+    bytes[3] = uint8_t(packet.length - 4);
+
+    // Everything between the header and the checksum; the data bytes are still 0
+    uint8_t sum = 0;
+    for (size_t i = 2; i < packet.length - 1; i++)
+    {
+        sum += bytes[i];
+    }
+    packet.fixed_sum = sum;
+    packet.bytes[packet.length - 1] = ~sum;
+    return packet;
+}
+
+/*
+ * Copies data into the template and updates the checksum. For SYNC_WRITE,
+ * data is packed (no IDs); the IDs already in the template are summed as
+ * part of fixed_sum and skipped here.
+ */
+void DxlTransport::fill(PacketTemplate &packet, const uint8_t *data)
+{
+    uint8_t sum = packet.fixed_sum;
+    if (packet.bytes[4] == INST_SYNC_WRITE)
+    {
+        size_t length = packet.bytes[6];
+        size_t block = 1 + length;
+        for (size_t offset = 0; offset < packet.data_length; offset += block)
+        {
+            uint8_t *out = packet.bytes + packet.data_offset + offset + 1;
+            for (size_t i = 0; i < length; i++)
+            {
+                out[i] = *data++;
+                sum += out[i];
+            }
+        }
+    }
+    else
+    {
+        uint8_t *out = packet.bytes + packet.data_offset;
+        for (size_t i = 0; i < packet.data_length; i++)
+        {
+            out[i] = data[i];
+            sum += data[i];
+        }
+    }
+    packet.bytes[packet.length - 1] = ~sum;
+}
+
+int DxlTransport::send(const PacketTemplate &packet)
+{
+    size_t sent = 0;
+    while (sent < packet.length)
+    {
+        ssize_t written = ::write(fd, packet.bytes + sent, packet.length - sent);
+        if (written > 0)
+        {
+            sent += written;
+        }
+        else if (written < 0 && errno == EAGAIN)
+        {
+            struct pollfd writable = {fd, POLLOUT, 0};
+            poll(&writable, 1, 10);
+        }
+        else if (written < 0 && errno != EINTR)
+        {
+            return COMM_TX_FAIL;
+        }
+    }
+    return COMM_SUCCESS;
+}
+
+StatusParser::StatusParser() : have(0), corrupt_packets(0)
+{
+}
+
+void StatusParser::reset()
+{
+    have = 0;
+}
+
+void StatusParser::feed(const uint8_t *data, size_t count)
+{
+    if (count > sizeof(buffer))
+    {
+        data += count - sizeof(buffer);
+        count = sizeof(buffer);
+    }
+    if (have + count > sizeof(buffer))
+    {
+        // Only a stream of garbage gets this far; keep the newest bytes
+        size_t drop = have + count - sizeof(buffer);
+        memmove(buffer, buffer + drop, have - drop);
+        have -= drop;
+    }
+    memcpy(buffer + have, data, count);
+    have += count;
+}
+
+void StatusParser::drop(size_t count)
+{
+    memmove(buffer, buffer + count, have - count);
+    have -= count;
+}
+
+bool StatusParser::next(StatusPacket &packet)
+{
+    while (true)
+    {
+        // Resync on the 0xFF 0xFF header
+        size_t start = 0;
+        while (start + 1 < have && !(buffer[start] == 0xFF && buffer[start + 1] == 0xFF))
+        {
+            start++;
+        }
+        drop(start);
+        if (have < 4)
+        {
+            return false;
+        }
+
+        // 0xFF 0xFF ID LENGTH ERROR PARAMETERS... CHECKSUM, LENGTH = parameters + 2
+        size_t length = buffer[3];
+        if (buffer[2] == 0xFF || length < 2 || 4 + length > DXL_TRANSPORT_MAX_PACKET)
+        {
+            drop(1);
+            continue;
+        }
+        if (have < 4 + length)
+        {
+            return false;
+        }
+        uint8_t sum = 0;
+        for (size_t i = 2; i < 3 + length; i++)
+        {
+            sum += buffer[i];
+        }
+        if (uint8_t(~sum) != buffer[3 + length])
+        {
+            corrupt_packets++;
+            drop(1);
+            continue;
+        }
+
+        packet.id = buffer[2];
+        packet.error = buffer[4];
+        packet.count = length - 2;
+        memcpy(packet.parameters, buffer + 5, packet.count);
+        drop(4 + length);
+        return true;
+    }
+}
+
+unsigned long StatusParser::corrupt() const
+{
+    return corrupt_packets;
+}
+
+size_t StatusParser::buffered() const
+{
+    return have;
+}
+
+int DxlTransport::port_fd() const
+{
+    return fd;
+}
+
+int64_t DxlTransport::reply_deadline_ns(const PacketTemplate &request, size_t parameters, int64_t sent_ns) const
+{
+    int64_t wire_ns = int64_t(request.length + 6 + parameters) * byte_time_ns;
+    return sent_ns + wire_ns + (return_delay_us + latency_timer_ms * 1000 + DXL_TRANSPORT_REPLY_MARGIN_US) * int64_t(1000);
+}
+
+const PacketTemplate *DxlTransport::prepare_read(uint8_t id, uint8_t address, uint8_t length)
+{
+    if (6 + size_t(length) > DXL_TRANSPORT_MAX_PACKET)
+    {
+        return NULL;
+    }
+    int64_t start = monotonic_ns();
+    PacketTemplate &packet = get_template(INST_READ, id, address, length, NULL, 1);
+    encode_ns += monotonic_ns() - start;
+    encoded++;
+    return &packet;
+}
+
+const PacketTemplate *DxlTransport::prepare_write(uint8_t id, uint8_t address, const uint8_t *data, uint8_t length)
+{
+    if (7 + size_t(length) > DXL_TRANSPORT_MAX_PACKET)
+    {
+        return NULL;
+    }
+    int64_t start = monotonic_ns();
+    PacketTemplate &packet = get_template(INST_WRITE, id, address, length, NULL, 1);
+    fill(packet, data);
+    encode_ns += monotonic_ns() - start;
+    encoded++;
+    return &packet;
+}
+
+const PacketTemplate *DxlTransport::prepare_sync_write(uint8_t address, uint8_t length, const uint8_t *ids,
+                                                       const uint8_t *data, int count)
+{
+    if (count < 1 || count > SYNC_WRITE_MAX_SERVOS || 8 + size_t(count) * (1 + length) > DXL_TRANSPORT_MAX_PACKET)
+    {
+        return NULL;
+    }
+    int64_t start = monotonic_ns();
+    PacketTemplate &packet = get_template(INST_SYNC_WRITE, BROADCAST_ID, address, length, ids, count);
+    fill(packet, data);
+    encode_ns += monotonic_ns() - start;
+    encoded++;
+    return &packet;
+}
+
+/*
+ * Waits until deadline_ns for the status packet from id with parameters
+ * bytes, skipping anything else.
+ */
+int DxlTransport::receive(uint8_t id, size_t parameters, int64_t deadline_ns, uint8_t *data, uint8_t *dxl_error)
+{
+    parser.reset();
+    unsigned long corrupt_before = parser.corrupt();
+    bool stray = false;
+    while (true)
+    {
+        StatusPacket packet;
+        while (parser.next(packet))
+        {
+            if (packet.id == id && packet.count == parameters)
+            {
+                *dxl_error = packet.error;
+                if (parameters > 0)
+                {
+                    memcpy(data, packet.parameters, parameters);
+                }
+                return COMM_SUCCESS;
+            }
+            stray = true;
+        }
+
+        int64_t remaining_ns = deadline_ns - monotonic_ns();
+        if (remaining_ns <= 0)
+        {
+            bool garbled = stray || parser.buffered() > 0 || parser.corrupt() != corrupt_before;
+            return garbled ? COMM_RX_CORRUPT : COMM_RX_TIMEOUT;
+        }
+        struct pollfd readable = {fd, POLLIN, 0};
+        struct timespec timeout = {time_t(remaining_ns / 1000000000), long(remaining_ns % 1000000000)};
+        if (ppoll(&readable, 1, &timeout, NULL) < 0 && errno != EINTR)
+        {
+            return COMM_RX_FAIL;
+        }
+        uint8_t chunk[DXL_TRANSPORT_MAX_PACKET];
+        ssize_t count = ::read(fd, chunk, sizeof(chunk));
+        if (count > 0)
+        {
+            parser.feed(chunk, count);
+        }
+    }
+}
+
+int DxlTransport::read(uint8_t id, uint8_t address, uint8_t length, uint8_t *data, uint8_t *dxl_error)
+{
+    const PacketTemplate *packet = prepare_read(id, address, length);
+    if (packet == NULL)
+    {
+        return COMM_TX_ERROR;
+    }
+
+    tcflush(fd, TCIFLUSH);
+    int64_t sent_ns = monotonic_ns();
+    int result = send(*packet);
+    if (result != COMM_SUCCESS)
+    {
+        return result;
+    }
+    return receive(id, length, reply_deadline_ns(*packet, length, sent_ns), data, dxl_error);
+}
+
+int DxlTransport::write(uint8_t id, uint8_t address, const uint8_t *data, uint8_t length, bool wait_status,
+                        uint8_t *dxl_error)
+{
+    const PacketTemplate *packet = prepare_write(id, address, data, length);
+    if (packet == NULL)
+    {
+        return COMM_TX_ERROR;
+    }
+
+    *dxl_error = 0;
+    if (wait_status)
+    {
+        tcflush(fd, TCIFLUSH);
+    }
+    int64_t sent_ns = monotonic_ns();
+    int result = send(*packet);
+    if (result != COMM_SUCCESS || !wait_status)
+    {
+        return result;
+    }
+    return receive(id, 0, reply_deadline_ns(*packet, 0, sent_ns), NULL, dxl_error);
+}
+
+int DxlTransport::sync_write(uint8_t address, uint8_t length, const uint8_t *ids, const uint8_t *data, int count)
+{
+    const PacketTemplate *packet = prepare_sync_write(address, length, ids, data, count);
+    if (packet == NULL)
+    {
+        return COMM_TX_ERROR;
+    }
+    return send(*packet);
+}
@@ -0,0 +1,156 @@
+/*
+ * Lean Protocol 1.0 transport for DxlController (--dxl-transport=lean).
+ *
+ * The SDK builds every packet from scratch, then waits for the reply with a
+ * timeout that allows for its assumed 16 ms USB latency. This transport
+ * opens the port itself, raw, with ASYNC_LOW_LATENCY set and, for an FTDI
+ * adapter, the latency timer turned down to 1 ms through sysfs when that
+ * file is writable. Both steps are skipped with a note when the port doesn't
+ * support them, e.g. dxl_emulator's pty.
+ *
+ * Packets come from templates built once per (instruction, ID, address,
+ * length): only the data bytes are patched on each use, and the checksum is
+ * the precomputed sum of the fixed bytes plus the patched ones. A reply is
+ * read with poll() against a deadline of the time the request and reply take
+ * on the wire, the servos' return delay, the latency timer as it was left
+ * (so a non-root user with the 16 ms default still gets replies) and
+ * DXL_TRANSPORT_REPLY_MARGIN_US, rather than a fixed timeout.
+ *
+ * Results use the SDK's COMM_* codes, so they go through getTxRxResult()
+ * the same as SDK results. Not thread safe; DxlController's bus_mutex
+ * serialises it.
+ */
+#ifndef DXL_TRANSPORT_H
+#define DXL_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+
+#define DXL_TRANSPORT_REPLY_MARGIN_US 3000 // Scheduling and USB frame slack on top of the wire time
+#define DXL_TRANSPORT_MAX_PACKET 64
+#define DXL_TRANSPORT_LATENCY_TIMER_MS 1
+#define DXL_TRANSPORT_FTDI_LATENCY_TIMER_MS 16 // Assumed when the timer can't be read
+#define SYNC_WRITE_MAX_SERVOS 4
+
+/*
+ * A preformatted packet. The header, ID, length, instruction and fixed
+ * parameters are written once; fixed_sum is their contribution to the
+ * checksum.
+ */
+struct PacketTemplate
+{
+    uint8_t bytes[DXL_TRANSPORT_MAX_PACKET];
+    size_t length;
+    size_t data_offset; // First byte patched per use
+    size_t data_length;
+    uint8_t fixed_sum;
+};
+
+// A status packet as it came off the wire
+struct StatusPacket
+{
+    uint8_t id;
+    uint8_t error;
+    uint8_t parameters[DXL_TRANSPORT_MAX_PACKET];
+    size_t count;
+};
+
+/*
+ * Incremental status packet parser. Bytes go in as they arrive, in any
+ * split; complete packets with a good checksum come out. Anything that isn't
+ * a packet (line noise, a torn packet) is skipped a byte at a time until the
+ * next 0xFF 0xFF header.
+ */
+class StatusParser
+{
+public:
+    StatusParser();
+
+    void reset();
+    void feed(const uint8_t *data, size_t count);
+
+    // @return true, with packet filled in, if a complete packet was buffered.
+    bool next(StatusPacket &packet);
+
+    unsigned long corrupt() const; // Packets dropped for a bad checksum
+    size_t buffered() const;
+
+private:
+    uint8_t buffer[2 * DXL_TRANSPORT_MAX_PACKET];
+    size_t have;
+    unsigned long corrupt_packets;
+
+    void drop(size_t count);
+};
+
+class DxlTransport
+{
+public:
+    DxlTransport();
+    ~DxlTransport();
+
+    /*
+     * Opens and configures the port.
+     *
+     * @param return_delay_us what the servos are set to, for the reply deadline.
+     * @return false, after printing why, if the port can't be used; the
+     * caller can fall back to the SDK.
+     */
+    bool open(const std::string &path, int baud_rate, int return_delay_us);
+    void close();
+    bool is_open() const;
+
+    // READ; data gets length bytes.
+    int read(uint8_t id, uint8_t address, uint8_t length, uint8_t *data, uint8_t *dxl_error);
+
+    // WRITE of length bytes (1 or 2); waits for the status packet only with wait_status.
+    int write(uint8_t id, uint8_t address, const uint8_t *data, uint8_t length, bool wait_status, uint8_t *dxl_error);
+
+    /*
+     * SYNC_WRITE of length bytes at address to count servos; data holds
+     * length bytes per servo in the order of ids. Never answered.
+     */
+    int sync_write(uint8_t address, uint8_t length, const uint8_t *ids, const uint8_t *data, int count);
+
+    /*
+     * The building blocks of read(), write() and sync_write(), for callers
+     * that do their own I/O on port_fd() (see DxlAsyncBus). The returned
+     * packet stays valid until the next prepare_* call.
+     *
+     * @return NULL if the packet would be too long.
+     */
+    const PacketTemplate *prepare_read(uint8_t id, uint8_t address, uint8_t length);
+    const PacketTemplate *prepare_write(uint8_t id, uint8_t address, const uint8_t *data, uint8_t length);
+    const PacketTemplate *prepare_sync_write(uint8_t address, uint8_t length, const uint8_t *ids, const uint8_t *data,
+                                             int count);
+    int send(const PacketTemplate &packet);
+
+    // When a reply with parameters bytes to request, sent at sent_ns, is overdue.
+    int64_t reply_deadline_ns(const PacketTemplate &request, size_t parameters, int64_t sent_ns) const;
+    int port_fd() const;
+
+    // Time spent formatting packets, to check the templates pay off.
+    uint64_t packets_encoded() const;
+    int64_t encode_total_ns() const;
+
+private:
+    int fd;
+    int baud_rate;
+    int return_delay_us;
+    int latency_timer_ms; // The FTDI latency timer as left by open(), 0 for other ports
+    int64_t byte_time_ns; // 10 bits per byte on the wire
+    std::map<uint64_t, PacketTemplate> templates;
+    StatusParser parser;
+    uint64_t encoded;
+    int64_t encode_ns;
+
+    PacketTemplate &get_template(uint8_t instruction, uint8_t id, uint8_t address, uint8_t length, const uint8_t *ids,
+                                 int count);
+    void fill(PacketTemplate &packet, const uint8_t *data);
+    int receive(uint8_t id, size_t parameters, int64_t deadline_ns, uint8_t *data, uint8_t *dxl_error);
+    void set_low_latency(const std::string &path);
+};
+
+#endif
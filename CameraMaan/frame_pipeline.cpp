@@ -0,0 +1,233 @@
+#include "frame_pipeline.h"
+
+#include <stdio.h>
+
+using namespace std;
+using namespace cv;
+
+FramePipeline::FramePipeline(bool threaded)
+    : threaded(threaded), channel(nullptr), first_frame_ns(0), last_frame_ns(0)
+{
+    for (int i = 0; i < PIPELINE_FRAMES; i++)
+    {
+        free_frames.push(&frames[i]);
+    }
+}
+
+void FramePipeline::add_stage(const string &name, PipelineStageFunction function)
+{
+    Stage *stage = new Stage();
+    stage->name = name;
+    stage->function = function;
+    stage->pipeline = this;
+    stage->index = stages.size();
+    stage->finished = false;
+    stage->stats = PipelineStageStats();
+    stages.emplace_back(stage);
+}
+
+void FramePipeline::process(Stage &stage, PipelineFrame *frame)
+{
+    int64_t start_ns = monotonic_ns();
+    stage.function(*frame);
+    stage.stats.busy_ns += monotonic_ns() - start_ns;
+    stage.stats.frames++;
+}
+
+// Hands frame to the stage after this one, or back to the channel after the last
+void FramePipeline::pass_on(Stage &stage, PipelineFrame *frame)
+{
+    if (stage.index + 1 == stages.size())
+    {
+        channel->release(frame->slot);
+        frame->slot = nullptr;
+        last_frame_ns = monotonic_ns();
+        // Can't fail, there are fewer frames than entries
+        free_frames.push(frame);
+        return;
+    }
+
+    Stage &next = *stages[stage.index + 1];
+    if (!next.input.push(frame))
+    {
+        int64_t wait_ns = monotonic_ns();
+        unsigned int spins = 0;
+        while (!next.input.push(frame))
+        {
+            ring_backoff(spins);
+        }
+        stage.stats.blocked_ns += monotonic_ns() - wait_ns;
+    }
+}
+
+void *FramePipeline::run_stage(void *arg)
+{
+    Stage &stage = *(Stage *)arg;
+    FramePipeline &pipeline = *stage.pipeline;
+    Stage &previous = *pipeline.stages[stage.index - 1];
+
+    while (true)
+    {
+        PipelineFrame *frame;
+        int64_t wait_ns = monotonic_ns();
+        unsigned int spins = 0;
+        bool have = true;
+        while (!stage.input.pop(frame))
+        {
+            // The stage before may have passed on its last frame just before finishing
+            if (previous.finished.load(memory_order_acquire))
+            {
+                have = stage.input.pop(frame);
+                break;
+            }
+            ring_backoff(spins);
+        }
+        stage.stats.starved_ns += monotonic_ns() - wait_ns;
+        if (!have)
+        {
+            break;
+        }
+        pipeline.process(stage, frame);
+        pipeline.pass_on(stage, frame);
+    }
+
+    stage.finished.store(true, memory_order_release);
+    return NULL;
+}
+
+void FramePipeline::run(FrameChannel &frame_channel)
+{
+    channel = &frame_channel;
+    if (stages.empty())
+    {
+        return;
+    }
+
+    size_t started = 1;
+    for (; threaded && started < stages.size(); started++)
+    {
+        if (pthread_create(&stages[started]->thread, NULL, run_stage, stages[started].get()) != 0)
+        {
+            // The stages already started are waiting on ones that never will
+            fprintf(stderr, "[PIPELINE]: Can't start the %s stage, running every stage on one thread\n",
+                    stages[started]->name.c_str());
+            stages[0]->finished.store(true, memory_order_release);
+            for (size_t i = 1; i < started; i++)
+            {
+                pthread_join(stages[i]->thread, NULL);
+                stages[i]->finished = false;
+            }
+            stages[0]->finished = false;
+            started = 1;
+            threaded = false;
+            break;
+        }
+    }
+
+    Stage &first = *stages[0];
+    while (true)
+    {
+        // Free frames only run short when the stages are behind, and then the
+        // channel fills up until capture waits
+        PipelineFrame *frame;
+        int64_t wait_ns = monotonic_ns();
+        if (!free_frames.pop(frame))
+        {
+            unsigned int spins = 0;
+            while (!free_frames.pop(frame))
+            {
+                ring_backoff(spins);
+            }
+            first.stats.blocked_ns += monotonic_ns() - wait_ns;
+            wait_ns = monotonic_ns();
+        }
+        FrameSlot *slot = channel->consume();
+        first.stats.starved_ns += monotonic_ns() - wait_ns;
+        if (slot == nullptr)
+        {
+            // Not pushed back: the last stage may still be returning frames, and
+            // free_frames takes only the one producer. Nothing uses it after this.
+            break;
+        }
+        slot->times.dequeue_ns = monotonic_ns();
+        if (first_frame_ns == 0)
+        {
+            first_frame_ns = slot->times.dequeue_ns;
+        }
+
+        frame->slot = slot;
+        frame->image = &slot->image;
+        frame->converted_whole = false;
+        frame->converted_window = Rect();
+        frame->updated = false;
+        frame->tracking = false;
+        frame->selected = -1;
+
+        process(first, frame);
+        if (threaded)
+        {
+            pass_on(first, frame);
+            continue;
+        }
+        for (size_t i = 1; i < stages.size(); i++)
+        {
+            process(*stages[i], frame);
+        }
+        pass_on(*stages.back(), frame);
+    }
+
+    first.finished.store(true, memory_order_release);
+    for (size_t i = 1; i < started; i++)
+    {
+        pthread_join(stages[i]->thread, NULL);
+    }
+}
+
+void FramePipeline::print_stats() const
+{
+    if (stages.empty() || stages.back()->stats.frames == 0)
+    {
+        return;
+    }
+    uint64_t frames_done = stages.back()->stats.frames;
+    double elapsed_ns = double(last_frame_ns - first_frame_ns);
+    printf("[PIPELINE]: %zu stages %s, %llu frames in %.1f s = %.1f fps\n", stages.size(),
+           threaded ? "on a thread each" : "on one thread", (unsigned long long)frames_done, elapsed_ns / 1e9,
+           elapsed_ns > 0 ? frames_done * 1e9 / elapsed_ns : 0.0);
+
+    const Stage *slowest = nullptr;
+    double slowest_ns = 0;
+    double total_ns = 0;
+    for (const unique_ptr<Stage> &stage : stages)
+    {
+        const PipelineStageStats &stats = stage->stats;
+        double mean_ns = stats.frames ? double(stats.busy_ns) / stats.frames : 0.0;
+        total_ns += mean_ns;
+        if (mean_ns >= slowest_ns)
+        {
+            slowest_ns = mean_ns;
+            slowest = stage.get();
+        }
+        if (elapsed_ns <= 0)
+        {
+            continue;
+        }
+        if (threaded)
+        {
+            printf("[PIPELINE]: %-10s busy %5.1f%%, mean %6.2f ms, starved %5.1f%%, blocked %5.1f%%\n",
+                   stage->name.c_str(), 100.0 * stats.busy_ns / elapsed_ns, mean_ns / 1e6,
+                   100.0 * stats.starved_ns / elapsed_ns, 100.0 * stats.blocked_ns / elapsed_ns);
+        }
+        else
+        {
+            printf("[PIPELINE]: %-10s busy %5.1f%%, mean %6.2f ms\n", stage->name.c_str(),
+                   100.0 * stats.busy_ns / elapsed_ns, mean_ns / 1e6);
+        }
+    }
+    if (slowest != nullptr && slowest_ns > 0)
+    {
+        printf("[PIPELINE]: slowest stage is %s at %.2f ms, %.1f fps at most pipelined; all stages in a row "
+               "take %.2f ms, %.1f fps\n",
+               slowest->name.c_str(), slowest_ns / 1e6, 1e9 / slowest_ns, total_ns / 1e6, 1e9 / total_ns);
+    }
+}
@@ -0,0 +1,114 @@
+/*
+ * The tracker thread's per-frame work, split into stages:
+ *
+ *      preprocess -> track -> command -> annotate
+ *
+ * Serially (the default) every stage runs on the tracker thread, one frame
+ * at a time, as the work always has. With --pipeline each stage after the
+ * first gets its own thread and frames are handed from one to the next
+ * through a bounded lock-free ring, so frame N+1 is being converted while
+ * frame N is tracked and frame N-1's command goes out. A frame is then done
+ * about as often as the slowest stage can manage rather than the sum of all
+ * of them, at the cost of a handoff per stage on each frame's latency.
+ *
+ * The first stage runs on the thread that calls run() and takes frames from
+ * the FrameChannel; the last one releases the slot back to it. At most
+ * PIPELINE_FRAMES frames are in the pipeline at once, which leaves the
+ * capture thread slots to fill. A stage that finds the next one's ring full
+ * waits for it, so a slow stage holds the ones before it back instead of
+ * frames piling up. Frames go through every stage in order.
+ *
+ * Each stage counts how long it was busy, waiting for a frame (starved) and
+ * waiting for room downstream (blocked); print_stats() names the bottleneck.
+ * Stage threads are created by the tracker thread and inherit its --rt
+ * policy, priority and CPUs.
+ */
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "frame_ring.h"
+
+#define PIPELINE_QUEUE_DEPTH 2                  // Frames waiting between two stages, a power of two
+#define PIPELINE_FRAMES (FRAME_POOL_SIZE - 2)   // In flight at once; capture keeps the rest
+
+// One frame on its way through the stages, and what they found out about it
+struct PipelineFrame
+{
+    FrameSlot *slot;
+    cv::Mat *image;            // slot->image, or converted once a YUYV frame has been converted
+    cv::Mat converted;         // BGR, allocated the first time it's needed and reused
+    bool converted_whole;      // All of converted is valid ...
+    cv::Rect converted_window; // ... or only this part of it
+
+    // Filled in by the track stage for the ones after it
+    bool updated;    // The tracker ran on this frame
+    bool tracking;   // and found the target
+    cv::Rect2d box;  // What the servos should aim at
+    int selected;    // Target the box came from, -1 for a group or none
+};
+
+typedef std::function<void(PipelineFrame &frame)> PipelineStageFunction;
+
+struct PipelineStageStats
+{
+    uint64_t frames;
+    int64_t busy_ns;
+    int64_t starved_ns; // Waiting for the stage before (or the camera)
+    int64_t blocked_ns; // Waiting for room in the next stage
+};
+
+class FramePipeline
+{
+public:
+    // @param threaded a thread per stage, or every stage on the caller's.
+    explicit FramePipeline(bool threaded);
+
+    // Stages run in the order they are added; add them all before run().
+    void add_stage(const std::string &name, PipelineStageFunction function);
+
+    /*
+     * Takes frames from channel and passes each one through every stage
+     * until the channel is closed and drained. Returns once the last frame
+     * has left the last stage and the stage threads have exited.
+     */
+    void run(FrameChannel &channel);
+
+    void print_stats() const;
+
+private:
+    struct Stage
+    {
+        std::string name;
+        PipelineStageFunction function;
+        FramePipeline *pipeline;
+        size_t index;
+        pthread_t thread;
+        SpscRing<PipelineFrame *, PIPELINE_QUEUE_DEPTH> input; // From the stage before
+        std::atomic<bool> finished; // Won't pass on any more frames
+        PipelineStageStats stats;   // Only written by the stage's own thread
+    };
+
+    bool threaded;
+    std::vector<std::unique_ptr<Stage>> stages;
+    PipelineFrame frames[PIPELINE_FRAMES];
+    SpscRing<PipelineFrame *, FRAME_RING_CAPACITY> free_frames; // Last stage -> first
+    FrameChannel *channel;
+    int64_t first_frame_ns;
+    int64_t last_frame_ns;
+
+    static void *run_stage(void *stage);
+    void process(Stage &stage, PipelineFrame *frame);
+    void pass_on(Stage &stage, PipelineFrame *frame);
+};
+
+#endif
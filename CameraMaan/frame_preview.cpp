@@ -0,0 +1,221 @@
+#include "frame_preview.h"
+#include "rt_config.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include <chrono>
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace std;
+using namespace cv;
+
+FramePreview::FramePreview(double fps, bool multi_target)
+    : fps(fps > 0 ? fps : DEFAULT_PREVIEW_FPS), multi_target(multi_target), next_due_ns(0),
+      started(false), preview_running(false), pending(false), selection_allowed(false), selection_ready(false),
+      offered(0), shown(0), replaced(0)
+{
+    period_ns = int64_t(1e9 / this->fps);
+}
+
+FramePreview::~FramePreview()
+{
+    stop();
+}
+
+bool FramePreview::running() const
+{
+    return preview_running.load();
+}
+
+bool FramePreview::start()
+{
+    if (started)
+    {
+        return preview_running.load();
+    }
+    preview_running = true;
+    if (create_background_thread(&preview_thread, run, this) != 0)
+    {
+        preview_running = false;
+        fprintf(stderr, "[PREVIEW]: Can't start the preview thread\n");
+        return false;
+    }
+    started = true;
+    return true;
+}
+
+void FramePreview::stop()
+{
+    if (!started)
+    {
+        return;
+    }
+    {
+        lock_guard<std::mutex> lock(mutex);
+        preview_running = false;
+    }
+    wake.notify_all();
+    pthread_join(preview_thread, NULL);
+    started = false;
+}
+
+void FramePreview::offer(const PipelineFrame &frame)
+{
+    offered.fetch_add(1, memory_order_relaxed);
+    int64_t now = monotonic_ns();
+    if (!preview_running.load(memory_order_relaxed) || now < next_due_ns)
+    {
+        return;
+    }
+    next_due_ns = now + period_ns;
+
+    // The tracker may only have converted its search window
+    const FrameSlot *slot = frame.slot;
+    if (frame.converted_whole)
+    {
+        frame.converted.copyTo(staging);
+    }
+    else if (slot->format == FRAME_FORMAT_YUYV)
+    {
+        cvtColor(slot->image, staging, COLOR_YUV2BGR_YUYV);
+    }
+    else
+    {
+        slot->image.copyTo(staging);
+    }
+
+    if (frame.updated && frame.tracking)
+    {
+        rectangle(staging, frame.box, Scalar(255, 0, 0), 2, 1);
+    }
+    else if (frame.updated)
+    {
+        putText(staging, "Tracking failure detected", Point(100, 80), FONT_HERSHEY_SIMPLEX, 0.75, Scalar(0, 0, 255), 2);
+    }
+
+    {
+        lock_guard<std::mutex> lock(mutex);
+        swap(staging, latest);
+        if (pending)
+        {
+            replaced.fetch_add(1, memory_order_relaxed);
+        }
+        pending = true;
+    }
+    wake.notify_one();
+}
+
+void FramePreview::allow_selection(bool allow)
+{
+    selection_allowed = allow;
+}
+
+bool FramePreview::take_selection(vector<Rect2d> &boxes, Mat &frame)
+{
+    if (!selection_ready.load(memory_order_acquire))
+    {
+        return false;
+    }
+    boxes = selected_boxes;
+    frame = selected_frame;
+    selection_ready.store(false, memory_order_relaxed);
+    return true;
+}
+
+// Blocks the preview thread, and only it, until the boxes have been drawn
+void FramePreview::select()
+{
+    // selectROI draws on the image it's given
+    Mat frame = showing.clone();
+    vector<Rect2d> boxes;
+    if (multi_target)
+    {
+        vector<Rect> picked;
+        selectROIs(PREVIEW_WINDOW, frame, picked, true, false);
+        boxes.assign(picked.begin(), picked.end());
+    }
+    else
+    {
+        Rect picked = selectROI(PREVIEW_WINDOW, frame, true, false);
+        if (picked.area() > 0)
+        {
+            boxes.push_back(picked);
+        }
+    }
+    if (boxes.empty())
+    {
+        return;
+    }
+    selected_boxes = boxes;
+    selected_frame = showing.clone();
+    selection_ready.store(true, memory_order_release);
+}
+
+void *FramePreview::run(void *arg)
+{
+    FramePreview *preview = (FramePreview *)arg;
+    // Behind every other thread in the process for the CPU
+    if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), PREVIEW_NICE) != 0)
+    {
+        perror("[PREVIEW]: setpriority");
+    }
+
+    try
+    {
+        namedWindow(PREVIEW_WINDOW, WINDOW_AUTOSIZE);
+    }
+    catch (const cv::Exception &e)
+    {
+        fprintf(stderr, "[PREVIEW]: Can't open the preview window (no display? try --headless): %s\n", e.what());
+        preview->preview_running = false;
+        return NULL;
+    }
+
+    while (preview->preview_running.load())
+    {
+        bool fresh = false;
+        {
+            unique_lock<std::mutex> lock(preview->mutex);
+            preview->wake.wait_for(lock, chrono::milliseconds(PREVIEW_IDLE_MS),
+                                   [&] { return preview->pending || !preview->preview_running.load(); });
+            if (preview->pending)
+            {
+                swap(preview->latest, preview->showing);
+                preview->pending = false;
+                fresh = true;
+            }
+        }
+
+        if (fresh)
+        {
+            imshow(PREVIEW_WINDOW, preview->showing);
+            preview->shown.fetch_add(1, memory_order_relaxed);
+        }
+        // Also what keeps the window responsive between frames
+        int key = waitKey(1);
+        if (key != -1 && preview->selection_allowed.load() && !preview->selection_ready.load() &&
+            !preview->showing.empty())
+        {
+            preview->select();
+        }
+    }
+
+    destroyAllWindows();
+    return NULL;
+}
+
+void FramePreview::print_stats() const
+{
+    if (offered.load() == 0)
+    {
+        return;
+    }
+    printf("[PREVIEW]: showed %llu of %llu frames (at most %.0f fps), %llu replaced before they were shown\n",
+           (unsigned long long)shown.load(), (unsigned long long)offered.load(), fps,
+           (unsigned long long)replaced.load());
+}
@@ -0,0 +1,111 @@
+/*
+ * The preview window, on a thread of its own (not with --headless).
+ *
+ * All of HighGUI lives on this thread: the window, imshow(), waitKey() and
+ * the interactive selectROI. The annotate stage offers it every frame, and
+ * at --preview-fps one of them is converted to BGR in full, has the
+ * tracker's box drawn on it and is swapped into a one-frame mailbox.
+ * Everything in between is skipped before any pixel is touched. The preview
+ * thread shows whatever is in the mailbox when it gets round to it; if it
+ * is behind, the frame waiting there is simply replaced. Tracking never
+ * waits for the display, and at worst pays for one conversion every preview
+ * period.
+ *
+ * The thread runs at normal priority, niced by PREVIEW_NICE, on any CPU, so
+ * under --rt it only gets the time the pipeline threads leave.
+ *
+ * Until a target is chosen a key press in the window opens selectROI (or
+ * selectROIs with --multi-target) on the frame being shown. The tracker
+ * thread picks the boxes up, with that frame, from take_selection().
+ */
+#ifndef FRAME_PREVIEW_H
+#define FRAME_PREVIEW_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "frame_pipeline.h"
+
+#define PREVIEW_WINDOW "CaptureFrames"
+#define DEFAULT_PREVIEW_FPS 10.0
+#define PREVIEW_NICE 10         // Added to the preview thread's nice value
+#define PREVIEW_IDLE_MS 50      // Longest the window goes without its events handled
+
+class FramePreview
+{
+public:
+    /*
+     * @param fps how many frames a second are shown at most.
+     * @param multi_target selections are made with selectROIs.
+     */
+    FramePreview(double fps, bool multi_target);
+    ~FramePreview();
+
+    // Starts the preview thread. @return false, after printing why, if it can't.
+    bool start();
+    void stop();
+
+    // False before start(), after stop() or if the window couldn't be opened.
+    bool running() const;
+
+    /*
+     * Called by the annotate stage with every frame. Returns at once unless
+     * a preview frame is due.
+     */
+    void offer(const PipelineFrame &frame);
+
+    /*
+     * Lets a key press in the window select the target(s), or stops it once
+     * tracking has started.
+     */
+    void allow_selection(bool allow);
+
+    /*
+     * @return true, once, after someone has selected at least one box.
+     * boxes are in the coordinates of frame, the BGR frame they were drawn
+     * on.
+     */
+    bool take_selection(std::vector<cv::Rect2d> &boxes, cv::Mat &frame);
+
+    void print_stats() const;
+
+private:
+    double fps;
+    bool multi_target;
+    int64_t period_ns;
+    int64_t next_due_ns; // Annotate stage only
+
+    pthread_t preview_thread;
+    bool started;                      // preview_thread needs joining, owner's thread only
+    std::atomic<bool> preview_running; // Also cleared by the thread if the window won't open
+    std::mutex mutex;
+    std::condition_variable wake;
+
+    // Three buffers so neither side copies under the lock: the annotate stage
+    // draws into staging and swaps it with latest; the preview thread swaps
+    // latest with showing
+    cv::Mat staging;
+    cv::Mat latest;  // Guarded by mutex
+    bool pending;    // latest holds a frame not shown yet, guarded by mutex
+    cv::Mat showing; // Preview thread only
+
+    std::atomic<bool> selection_allowed;
+    std::atomic<bool> selection_ready;
+    std::vector<cv::Rect2d> selected_boxes; // Written before selection_ready is set
+    cv::Mat selected_frame;
+
+    std::atomic<uint64_t> offered;
+    std::atomic<uint64_t> shown;
+    std::atomic<uint64_t> replaced; // Overwritten in the mailbox before being shown
+
+    static void *run(void *preview);
+    void select();
+};
+
+#endif
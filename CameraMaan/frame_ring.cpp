@@ -0,0 +1,216 @@
+#include "frame_ring.h"
+
+#include <stdio.h>
+#include <sched.h>
+#include <time.h>
+
+void ring_backoff(unsigned int &spins)
+{
+    if (spins < 64)
+    {
+        spins++;
+        return;
+    }
+    if (spins < 128)
+    {
+        spins++;
+        sched_yield();
+        return;
+    }
+    struct timespec pause = {0, 200000}; // 200us
+    nanosleep(&pause, NULL);
+}
+
+FrameChannel::FrameChannel(int width, int height)
+    : mailbox(nullptr), spare(nullptr), closed(false), next_sequence(0), mode(HANDOFF_FIFO)
+{
+    for (int i = 0; i < FRAME_POOL_SIZE; i++)
+    {
+        slots[i].storage.create(height, width, CV_8UC3);
+        slots[i].image = slots[i].storage;
+        slots[i].format = FRAME_FORMAT_BGR;
+        slots[i].buffer_owner = nullptr;
+        slots[i].buffer_index = -1;
+        slots[i].sequence = 0;
+        slots[i].publish_ns = 0;
+        slots[i].has_truth = false;
+        slots[i].times = FrameTimestamps();
+        free_ring.push(&slots[i]);
+    }
+}
+
+void FrameChannel::set_mode(FrameHandoffMode handoff_mode)
+{
+    mode = handoff_mode;
+}
+
+void FrameChannel::prefault()
+{
+    for (int i = 0; i < FRAME_POOL_SIZE; i++)
+    {
+        slots[i].storage.setTo(cv::Scalar::all(0));
+    }
+}
+
+FrameHandoffMode FrameChannel::get_mode() const
+{
+    return mode;
+}
+
+FrameSlot *FrameChannel::acquire()
+{
+    FrameSlot *slot;
+    unsigned int spins = 0;
+
+    // A frame the tracker never saw is overwritten first
+    if (spare != nullptr)
+    {
+        slot = spare;
+        spare = nullptr;
+        return_buffer(slot);
+        slot->sequence = next_sequence++;
+        return slot;
+    }
+
+    while (!free_ring.pop(slot))
+    {
+        if (closed.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+        ring_backoff(spins);
+    }
+    slot->sequence = next_sequence++;
+    return slot;
+}
+
+void FrameChannel::publish(FrameSlot *slot)
+{
+    slot->publish_ns = monotonic_ns();
+    handoff_stats.published.fetch_add(1, std::memory_order_relaxed);
+
+    if (mode == HANDOFF_LATEST)
+    {
+        FrameSlot *stale = mailbox.exchange(slot, std::memory_order_acq_rel);
+        if (stale != nullptr)
+        {
+            handoff_stats.dropped.fetch_add(1, std::memory_order_relaxed);
+            spare = stale;
+        }
+        return;
+    }
+
+    // Can't fail, the ring holds more entries than there are slots
+    ready_ring.push(slot);
+}
+
+FrameSlot *FrameChannel::consume()
+{
+    FrameSlot *slot;
+    unsigned int spins = 0;
+
+    if (mode == HANDOFF_LATEST)
+    {
+        while ((slot = mailbox.exchange(nullptr, std::memory_order_acq_rel)) == nullptr)
+        {
+            if (closed.load(std::memory_order_acquire))
+            {
+                slot = mailbox.exchange(nullptr, std::memory_order_acq_rel);
+                if (slot != nullptr)
+                {
+                    record_consumed(slot);
+                }
+                return slot;
+            }
+            ring_backoff(spins);
+        }
+        record_consumed(slot);
+        return slot;
+    }
+
+    while (!ready_ring.pop(slot))
+    {
+        if (closed.load(std::memory_order_acquire))
+        {
+            // Frames published right before close() are still handed out
+            if (!ready_ring.pop(slot))
+            {
+                return nullptr;
+            }
+            break;
+        }
+        ring_backoff(spins);
+    }
+    record_consumed(slot);
+    return slot;
+}
+
+void FrameChannel::record_consumed(FrameSlot *slot)
+{
+    int64_t age = monotonic_ns() - slot->publish_ns;
+
+    handoff_stats.consumed.fetch_add(1, std::memory_order_relaxed);
+    handoff_stats.last_age_ns.store(age, std::memory_order_relaxed);
+    handoff_stats.total_age_ns.fetch_add(age, std::memory_order_relaxed);
+    if (age > handoff_stats.max_age_ns.load(std::memory_order_relaxed))
+    {
+        // Only the tracker thread writes the ages, so no CAS loop is needed
+        handoff_stats.max_age_ns.store(age, std::memory_order_relaxed);
+    }
+}
+
+void FrameChannel::release(FrameSlot *slot)
+{
+    return_buffer(slot);
+    free_ring.push(slot);
+}
+
+void FrameChannel::return_buffer(FrameSlot *slot)
+{
+    if (slot->buffer_owner != nullptr)
+    {
+        slot->buffer_owner->requeue(slot->buffer_index);
+        slot->buffer_owner = nullptr;
+        slot->buffer_index = -1;
+        slot->image = slot->storage;
+        slot->format = FRAME_FORMAT_BGR;
+    }
+}
+
+void FrameChannel::close()
+{
+    closed.store(true, std::memory_order_release);
+}
+
+bool FrameChannel::is_closed() const
+{
+    return closed.load(std::memory_order_acquire);
+}
+
+size_t FrameChannel::queued() const
+{
+    if (mode == HANDOFF_LATEST)
+    {
+        return mailbox.load(std::memory_order_acquire) != nullptr ? 1 : 0;
+    }
+    return ready_ring.size();
+}
+
+const HandoffStats &FrameChannel::stats() const
+{
+    return handoff_stats;
+}
+
+void FrameChannel::print_stats() const
+{
+    uint64_t consumed = handoff_stats.consumed.load();
+    double mean_age_ms = consumed ? handoff_stats.total_age_ns.load() / 1e6 / consumed : 0.0;
+
+    printf("[HANDOFF]: mode = %s, published = %llu, consumed = %llu, dropped = %llu\n",
+           mode == HANDOFF_LATEST ? "latest" : "fifo",
+           (unsigned long long)handoff_stats.published.load(),
+           (unsigned long long)consumed,
+           (unsigned long long)handoff_stats.dropped.load());
+    printf("[HANDOFF]: frame age at consume: last = %.2f ms, mean = %.2f ms, max = %.2f ms\n",
+           handoff_stats.last_age_ns.load() / 1e6, mean_age_ms, handoff_stats.max_age_ns.load() / 1e6);
+}
@@ -0,0 +1,226 @@
+/*
+ * Fixed pool of pre-allocated frame slots that are handed from the capture
+ * thread to the tracker thread and back again through two lock-free
+ * single-producer/single-consumer rings.
+ *
+ *      Capture --[ready ring]--> Track
+ *      Capture <--[free ring]--- Track
+ *
+ * Every slot is allocated once at start up, so in steady state passing a
+ * frame costs no heap allocation and no system call. The release store on
+ * push and the acquire load on pop make the pixels written by one thread
+ * visible to the other.
+ *
+ * In HANDOFF_LATEST mode the ready ring is replaced by a one-frame mailbox:
+ * a new frame overwrites the one the tracker hasn't picked up yet and the
+ * overwritten frame is counted as dropped, so the tracker always works on
+ * the freshest frame no matter how far behind it is.
+ */
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <time.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "latency_stats.h"
+
+#define FRAME_WIDTH 1280
+#define FRAME_HEIGHT 720
+
+// 8 frames queued (the old mq_maxmsg) + 1 being filled + 1 being tracked
+#define FRAME_POOL_SIZE 10
+// Ring capacity, must be a power of two and >= FRAME_POOL_SIZE
+#define FRAME_RING_CAPACITY 16
+
+enum FrameHandoffMode
+{
+    HANDOFF_FIFO,  // Every frame is tracked, oldest first
+    HANDOFF_LATEST // Only the freshest frame is tracked, stale ones are dropped
+};
+
+// CLOCK_MONOTONIC in nanoseconds
+static inline int64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+enum FramePixelFormat
+{
+    FRAME_FORMAT_BGR,  // CV_8UC3, what the trackers want
+    FRAME_FORMAT_YUYV  // CV_8UC2 packed 4:2:2 straight from a V4L2 driver buffer
+};
+
+/*
+ * Implemented by frame sources that lend their own buffers out instead of
+ * copying into the pool (see V4L2Source). The buffer is given back when the
+ * tracker releases the slot.
+ */
+class FrameBufferOwner
+{
+public:
+    virtual ~FrameBufferOwner() {}
+    virtual void requeue(int buffer_index) = 0;
+};
+
+struct FrameSlot
+{
+    cv::Mat storage;    // Pre-allocated FRAME_WIDTH x FRAME_HEIGHT BGR buffer
+    cv::Mat image;      // The frame: normally storage, or a header over a borrowed buffer
+    FramePixelFormat format;
+    FrameBufferOwner *buffer_owner; // Non-null while image points into a borrowed buffer
+    int buffer_index;
+    uint64_t sequence;  // Capture order of the frame currently held
+    int64_t publish_ns; // monotonic_ns() when the frame was handed to the tracker
+    bool has_truth;     // Set when the frame source knows where the target is
+    cv::Rect2d truth;
+    FrameTimestamps times;
+};
+
+/*
+ * Counters for the Capture -> Track edge. Written by the two pipeline threads
+ * and safe to read from any thread.
+ */
+struct HandoffStats
+{
+    std::atomic<uint64_t> published{0};
+    std::atomic<uint64_t> consumed{0};
+    std::atomic<uint64_t> dropped{0};      // Overwritten before the tracker saw them
+    std::atomic<int64_t> last_age_ns{0};   // Frame age when the tracker picked it up
+    std::atomic<int64_t> max_age_ns{0};
+    std::atomic<int64_t> total_age_ns{0};
+};
+
+/*
+ * Called while a ring is empty (or full). Spins briefly first so a handoff
+ * that is only a few microseconds away never touches the kernel, then
+ * yields, then sleeps in short steps so an idle thread doesn't burn a core.
+ *
+ * @param spins 0 when the wait starts, updated on every call.
+ */
+void ring_backoff(unsigned int &spins);
+
+/*
+ * Bounded lock-free queue for exactly one producer thread and one consumer
+ * thread. head is only written by the consumer and tail only by the producer.
+ */
+template <typename T, size_t N>
+class SpscRing
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+    SpscRing() : head(0), tail(0) {}
+
+    /*
+     * Producer side.
+     *
+     * @return false if the ring is full.
+     */
+    bool push(const T &item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N)
+        {
+            return false;
+        }
+        items[t & (N - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*
+     * Consumer side.
+     *
+     * @return false if the ring is empty.
+     */
+    bool pop(T &item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (tail.load(std::memory_order_acquire) == h)
+        {
+            return false;
+        }
+        item = items[h & (N - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+private:
+    // Keep the two indices on separate cache lines so the threads don't fight over them
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    alignas(64) T items[N];
+};
+
+/*
+ * The Capture -> Track frame handoff.
+ *
+ * Capture calls acquire() to get an empty slot, fills slot->image in place and
+ * calls publish(). Track calls consume() to get the oldest published frame and
+ * release() once it no longer needs the pixels.
+ */
+class FrameChannel
+{
+public:
+    FrameChannel(int width = FRAME_WIDTH, int height = FRAME_HEIGHT);
+
+    // Must be called before either thread starts using the channel.
+    void set_mode(FrameHandoffMode mode);
+
+    // Writes every slot's pixels once, so no page of the pool faults in later.
+    void prefault();
+    FrameHandoffMode get_mode() const;
+
+    /*
+     * Capture side. Waits until a free slot is available.
+     *
+     * @return an empty slot, or nullptr once the channel has been closed.
+     */
+    FrameSlot *acquire();
+    void publish(FrameSlot *slot);
+
+    /*
+     * Tracker side. Waits until a frame has been published.
+     *
+     * @return the oldest (HANDOFF_FIFO) or newest (HANDOFF_LATEST) published
+     * frame, or nullptr once the channel has been closed and drained.
+     */
+    FrameSlot *consume();
+    void release(FrameSlot *slot);
+
+    // Wakes up both sides; no more frames will be published.
+    void close();
+    bool is_closed() const;
+
+    size_t queued() const;
+
+    const HandoffStats &stats() const;
+    void print_stats() const;
+
+private:
+    FrameSlot slots[FRAME_POOL_SIZE];
+    SpscRing<FrameSlot *, FRAME_RING_CAPACITY> free_ring;  // Track -> Capture
+    SpscRing<FrameSlot *, FRAME_RING_CAPACITY> ready_ring; // Capture -> Track
+    std::atomic<FrameSlot *> mailbox;                      // Capture -> Track in HANDOFF_LATEST
+    FrameSlot *spare;        // Displaced from the mailbox, refilled next by the capture thread
+    std::atomic<bool> closed;
+    uint64_t next_sequence;  // Only touched by the capture thread
+    FrameHandoffMode mode;
+    HandoffStats handoff_stats;
+
+    void record_consumed(FrameSlot *slot);
+    void return_buffer(FrameSlot *slot);
+};
+
+#endif
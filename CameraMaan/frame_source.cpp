@@ -0,0 +1,350 @@
+#include "frame_source.h"
+#include "v4l2_source.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace std;
+using namespace cv;
+
+// Copies src into the pre-allocated dst, resizing only when the sizes differ
+static void fit_frame(const Mat &src, Mat &dst)
+{
+    if (src.size() == dst.size() && src.type() == dst.type())
+    {
+        src.copyTo(dst);
+    }
+    else
+    {
+        resize(src, dst, dst.size());
+    }
+}
+
+FrameSource::FrameSource() : pacing(PACING_REALTIME), fps(DEFAULT_SOURCE_FPS), next_frame_ns(0)
+{
+}
+
+bool FrameSource::fill(FrameSlot &slot)
+{
+    return read(slot.image);
+}
+
+Size FrameSource::last_frame_size() const
+{
+    return Size();
+}
+
+bool FrameSource::ground_truth(Rect2d &box) const
+{
+    return false;
+}
+
+void FrameSource::set_pacing(FramePacing frame_pacing, double frames_per_second)
+{
+    pacing = frame_pacing;
+    if (frames_per_second > 0)
+    {
+        fps = frames_per_second;
+    }
+    next_frame_ns = 0;
+}
+
+void FrameSource::wait_for_next_frame()
+{
+    if (pacing != PACING_REALTIME)
+    {
+        return;
+    }
+
+    int64_t period_ns = int64_t(1e9 / fps);
+    int64_t now = monotonic_ns();
+
+    // Start over rather than bursting if the consumer fell more than a frame behind
+    if (next_frame_ns == 0 || now - next_frame_ns > period_ns)
+    {
+        next_frame_ns = now + period_ns;
+        return;
+    }
+
+    struct timespec deadline;
+    deadline.tv_sec = next_frame_ns / 1000000000;
+    deadline.tv_nsec = next_frame_ns % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+    {
+    }
+    next_frame_ns += period_ns;
+}
+
+//---------------------------------------------------------------------
+// Webcam
+//---------------------------------------------------------------------
+CameraSource::CameraSource(int device_number) : capture(device_number), device(to_string(device_number))
+{
+    capture.set(cv::CAP_PROP_EXPOSURE, 4);
+}
+
+CameraSource::CameraSource(const string &device_path) : capture(device_path), device(device_path)
+{
+    capture.set(cv::CAP_PROP_EXPOSURE, 4);
+}
+
+bool CameraSource::read(Mat &dst)
+{
+    // The camera paces itself
+    capture >> frame;
+    if (frame.empty())
+    {
+        return false;
+    }
+    fit_frame(frame, dst);
+    return true;
+}
+
+bool CameraSource::isOpened() const
+{
+    return capture.isOpened();
+}
+
+string CameraSource::describe() const
+{
+    return "camera:" + device;
+}
+
+Size CameraSource::last_frame_size() const
+{
+    return frame.size();
+}
+
+//---------------------------------------------------------------------
+// Recorded video
+//---------------------------------------------------------------------
+VideoFileSource::VideoFileSource(const string &file_path) : capture(file_path), path(file_path)
+{
+    if (file_fps() > 0)
+    {
+        fps = file_fps();
+    }
+}
+
+bool VideoFileSource::read(Mat &dst)
+{
+    wait_for_next_frame();
+    capture >> frame;
+    if (frame.empty())
+    {
+        return false;
+    }
+    fit_frame(frame, dst);
+    return true;
+}
+
+bool VideoFileSource::isOpened() const
+{
+    return capture.isOpened();
+}
+
+string VideoFileSource::describe() const
+{
+    return "file:" + path;
+}
+
+Size VideoFileSource::last_frame_size() const
+{
+    return frame.size();
+}
+
+double VideoFileSource::file_fps() const
+{
+    return capture.isOpened() ? capture.get(cv::CAP_PROP_FPS) : 0.0;
+}
+
+//---------------------------------------------------------------------
+// Directory of images
+//---------------------------------------------------------------------
+ImageSequenceSource::ImageSequenceSource(const string &image_directory) : next_file(0), directory(image_directory)
+{
+    // glob() returns the names sorted
+    glob(directory + "/*", files, false);
+}
+
+bool ImageSequenceSource::read(Mat &dst)
+{
+    wait_for_next_frame();
+
+    // Skip anything in the directory that isn't an image
+    while (next_file < files.size())
+    {
+        frame = imread(files[next_file++], IMREAD_COLOR);
+        if (!frame.empty())
+        {
+            fit_frame(frame, dst);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ImageSequenceSource::isOpened() const
+{
+    return !files.empty();
+}
+
+string ImageSequenceSource::describe() const
+{
+    return "images:" + directory + " (" + to_string(files.size()) + " files)";
+}
+
+Size ImageSequenceSource::last_frame_size() const
+{
+    return frame.size();
+}
+
+//---------------------------------------------------------------------
+// Generated moving target scene
+//---------------------------------------------------------------------
+SyntheticSource::SyntheticSource(Size size) : target_size(120, 120), frame_number(0)
+{
+    render_background(size);
+}
+
+void SyntheticSource::render_background(Size size)
+{
+    // A fixed pseudo-random pattern of coloured discs gives the trackers some
+    // texture to latch on to, like a real scene would.
+    background.create(size, CV_8UC3);
+    background.setTo(Scalar(90, 80, 70));
+
+    unsigned int seed = 12345;
+    int cell = 40;
+    for (int y = 0; y < size.height; y += cell)
+    {
+        for (int x = 0; x < size.width; x += cell)
+        {
+            seed = seed * 1103515245 + 12345;
+            Scalar colour((seed >> 8) & 0xff, (seed >> 16) & 0xff, (seed >> 24) & 0xff);
+            circle(background, Point(x + cell / 2, y + cell / 2), 6 + (seed & 0x0f), colour, FILLED);
+        }
+    }
+}
+
+void SyntheticSource::draw_target(Mat &dst, const Rect &box) const
+{
+    // 4x4 checkerboard with a dark border
+    int squares = 4;
+    for (int row = 0; row < squares; row++)
+    {
+        for (int col = 0; col < squares; col++)
+        {
+            Rect square(box.x + col * box.width / squares, box.y + row * box.height / squares,
+                        box.width / squares, box.height / squares);
+            Scalar colour = ((row + col) % 2) ? Scalar(0, 220, 255) : Scalar(0, 0, 200);
+            rectangle(dst, square, colour, FILLED);
+        }
+    }
+    rectangle(dst, box, Scalar(20, 20, 20), 3);
+}
+
+bool SyntheticSource::read(Mat &dst)
+{
+    wait_for_next_frame();
+
+    if (background.size() != dst.size())
+    {
+        render_background(dst.size());
+    }
+    background.copyTo(dst);
+
+    // Lissajous path over most of the frame; time is derived from the frame
+    // number so a PACING_FAST run renders exactly the same frames.
+    double t = frame_number / fps;
+    double w = target_size.width * dst.cols / 1280.0;
+    double h = target_size.height * dst.rows / 720.0;
+    double cx = dst.cols * (0.5 + 0.35 * sin(2 * M_PI * t / 7.3));
+    double cy = dst.rows * (0.5 + 0.30 * sin(2 * M_PI * t / 4.1 + 0.7));
+    target = Rect2d(cx - w / 2, cy - h / 2, w, h);
+
+    draw_target(dst, Rect(target));
+    frame_number++;
+    return true;
+}
+
+bool SyntheticSource::isOpened() const
+{
+    return !background.empty();
+}
+
+string SyntheticSource::describe() const
+{
+    return "synthetic";
+}
+
+Size SyntheticSource::last_frame_size() const
+{
+    return background.size();
+}
+
+bool SyntheticSource::ground_truth(Rect2d &box) const
+{
+    if (frame_number == 0)
+    {
+        return false;
+    }
+    box = target;
+    return true;
+}
+
+FrameSource *create_frame_source(const string &spec, FramePacing pacing, double fps)
+{
+    FrameSource *source = nullptr;
+
+    if (spec == "camera")
+    {
+        source = new CameraSource(0);
+    }
+    else if (spec.compare(0, 7, "camera:") == 0)
+    {
+        source = new CameraSource(atoi(spec.c_str() + 7));
+    }
+    else if (spec == "v4l2" || spec.compare(0, 5, "v4l2:") == 0)
+    {
+        string device = spec.size() > 5 ? spec.substr(5) : string(V4L2_DEFAULT_DEVICE);
+        V4L2Source *v4l2 = new V4L2Source(device, fps);
+        if (v4l2->isOpened())
+        {
+            source = v4l2;
+        }
+        else
+        {
+            // Drivers without mmap streaming still work through OpenCV
+            fprintf(stderr, "[V4L2]: Falling back to OpenCV capture for %s\n", device.c_str());
+            delete v4l2;
+            source = new CameraSource(device);
+        }
+    }
+    else if (spec.compare(0, 5, "file:") == 0)
+    {
+        source = new VideoFileSource(spec.substr(5));
+    }
+    else if (spec.compare(0, 7, "images:") == 0)
+    {
+        source = new ImageSequenceSource(spec.substr(7));
+    }
+    else if (spec == "synthetic")
+    {
+        source = new SyntheticSource();
+    }
+    else
+    {
+        fprintf(stderr, "Unknown frame source '%s'\n", spec.c_str());
+        return nullptr;
+    }
+
+    source->set_pacing(pacing, fps);
+    return source;
+}
@@ -0,0 +1,168 @@
+/*
+ * Frame sources for the capture thread. The webcam is just one backend; the
+ * others let the whole pipeline run and be measured on a machine without a
+ * camera:
+ *
+ *      camera[:N]      OpenCV VideoCapture device N (default 0)
+ *      v4l2[:DEVICE]   Zero-copy V4L2 capture from DEVICE (default /dev/video0),
+ *                      see v4l2_source.h
+ *      file:PATH       A recorded video file
+ *      images:DIR      Every image in DIR, in file name order
+ *      synthetic       A generated scene with a target moving over a textured
+ *                      background; the target box is known for every frame
+ *
+ * File, image and synthetic sources either replay at their frame rate
+ * (PACING_REALTIME) or as fast as the pipeline takes them (PACING_FAST).
+ */
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/videoio/videoio.hpp>
+
+#include "frame_ring.h"
+
+#define DEFAULT_SOURCE_FPS 30.0
+
+enum FramePacing
+{
+    PACING_REALTIME, // Deliver frames at the source's frame rate
+    PACING_FAST      // Deliver frames as fast as they are asked for
+};
+
+class FrameSource
+{
+public:
+    FrameSource();
+    virtual ~FrameSource() {}
+
+    /*
+     * Writes the next frame into dst. dst is already allocated and the frame
+     * is resized to fit it, so no memory is allocated in steady state.
+     *
+     * @return false at the end of the stream or on error.
+     */
+    virtual bool read(cv::Mat &dst) = 0;
+
+    /*
+     * Fills a pool slot with the next frame. By default this is read() into
+     * slot.image; zero-copy sources override it to point slot.image at their
+     * own buffer instead.
+     *
+     * @return false at the end of the stream or on error.
+     */
+    virtual bool fill(FrameSlot &slot);
+
+    virtual bool isOpened() const = 0;
+    virtual std::string describe() const = 0;
+
+    /*
+     * Size of the last frame before it was fitted to the destination, i.e.
+     * the coordinate system of ground truth boxes for the clip.
+     */
+    virtual cv::Size last_frame_size() const;
+
+    /*
+     * Where the target is in the last frame read, for sources that know it.
+     *
+     * @return false if the source has no ground truth.
+     */
+    virtual bool ground_truth(cv::Rect2d &box) const;
+
+    void set_pacing(FramePacing pacing, double fps);
+
+protected:
+    FramePacing pacing;
+    double fps;
+
+    // Sleeps until the next frame is due when pacing is PACING_REALTIME.
+    void wait_for_next_frame();
+
+private:
+    int64_t next_frame_ns;
+};
+
+class CameraSource : public FrameSource
+{
+public:
+    CameraSource(int device);
+    CameraSource(const std::string &device_path);
+    bool read(cv::Mat &dst);
+    bool isOpened() const;
+    std::string describe() const;
+    cv::Size last_frame_size() const;
+
+private:
+    cv::VideoCapture capture;
+    cv::Mat frame;
+    std::string device;
+};
+
+class VideoFileSource : public FrameSource
+{
+public:
+    VideoFileSource(const std::string &path);
+    bool read(cv::Mat &dst);
+    bool isOpened() const;
+    std::string describe() const;
+    cv::Size last_frame_size() const;
+
+    // The frame rate stored in the file, or 0 if it doesn't have one.
+    double file_fps() const;
+
+private:
+    cv::VideoCapture capture;
+    cv::Mat frame;
+    std::string path;
+};
+
+class ImageSequenceSource : public FrameSource
+{
+public:
+    ImageSequenceSource(const std::string &directory);
+    bool read(cv::Mat &dst);
+    bool isOpened() const;
+    std::string describe() const;
+    cv::Size last_frame_size() const;
+
+private:
+    std::vector<cv::String> files;
+    size_t next_file;
+    cv::Mat frame;
+    std::string directory;
+};
+
+class SyntheticSource : public FrameSource
+{
+public:
+    SyntheticSource(cv::Size size = cv::Size(1280, 720));
+    bool read(cv::Mat &dst);
+    bool isOpened() const;
+    std::string describe() const;
+    cv::Size last_frame_size() const;
+    bool ground_truth(cv::Rect2d &box) const;
+
+private:
+    cv::Mat background;
+    cv::Size target_size;
+    uint64_t frame_number;
+    cv::Rect2d target;
+
+    void render_background(cv::Size size);
+    void draw_target(cv::Mat &dst, const cv::Rect &box) const;
+};
+
+/*
+ * Builds a source from a spec string (see the top of this file).
+ *
+ * @param fps replay rate for PACING_REALTIME, 0 picks the source's own rate.
+ * @return a new source, or nullptr if the spec is not understood. The source
+ * may still fail to open; check isOpened().
+ */
+FrameSource *create_frame_source(const std::string &spec, FramePacing pacing, double fps);
+
+#endif
@@ -0,0 +1,198 @@
+#include "latency_stats.h"
+#include "frame_ring.h"
+
+#include <stdio.h>
+
+static const char *STAGE_NAMES[STAGE_COUNT] = {
+    "queue",
+    "preprocess",
+    "track",
+    "command",
+    "servo",
+    "vision",
+    "end-to-end",
+    "wakeup",
+};
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+size_t LatencyHistogram::bucket_of(int64_t value_ns)
+{
+    const int64_t largest = (int64_t(1) << LATENCY_MAX_EXPONENT) - 1;
+    uint64_t value = uint64_t(value_ns > largest ? largest : value_ns);
+
+    // Values below 2 * LATENCY_SUB_BUCKETS get a bucket each
+    if (value < 2 * LATENCY_SUB_BUCKETS)
+    {
+        return size_t(value);
+    }
+
+    // Otherwise keep the top LATENCY_SUB_BUCKET_BITS + 1 bits
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - LATENCY_SUB_BUCKET_BITS;
+    size_t mantissa = size_t(value >> shift) - LATENCY_SUB_BUCKETS;
+    return 2 * LATENCY_SUB_BUCKETS + size_t(exponent - LATENCY_SUB_BUCKET_BITS - 1) * LATENCY_SUB_BUCKETS + mantissa;
+}
+
+int64_t LatencyHistogram::bucket_value(size_t bucket)
+{
+    if (bucket < 2 * LATENCY_SUB_BUCKETS)
+    {
+        return int64_t(bucket);
+    }
+
+    // Middle of the bucket's range
+    size_t offset = bucket - 2 * LATENCY_SUB_BUCKETS;
+    int shift = int(offset / LATENCY_SUB_BUCKETS) + 1;
+    int64_t mantissa = LATENCY_SUB_BUCKETS + int64_t(offset % LATENCY_SUB_BUCKETS);
+    return (mantissa << shift) + ((int64_t(1) << shift) >> 1);
+}
+
+void LatencyHistogram::record(int64_t value_ns)
+{
+    if (value_ns < 0)
+    {
+        return;
+    }
+    buckets[bucket_of(value_ns)].fetch_add(1, std::memory_order_relaxed);
+    samples.fetch_add(1, std::memory_order_relaxed);
+    sum_ns.fetch_add(value_ns, std::memory_order_relaxed);
+
+    int64_t current = max_ns.load(std::memory_order_relaxed);
+    while (value_ns > current && !max_ns.compare_exchange_weak(current, value_ns, std::memory_order_relaxed))
+    {
+    }
+}
+
+uint64_t LatencyHistogram::count() const
+{
+    return samples.load(std::memory_order_relaxed);
+}
+
+int64_t LatencyHistogram::max() const
+{
+    return max_ns.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::mean() const
+{
+    uint64_t n = count();
+    return n ? double(sum_ns.load(std::memory_order_relaxed)) / n : 0.0;
+}
+
+int64_t LatencyHistogram::percentile(double percentile) const
+{
+    // Sum the buckets first; other threads may still be recording
+    uint64_t total = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        total += buckets[i].load(std::memory_order_relaxed);
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    uint64_t wanted = uint64_t(percentile / 100.0 * total + 0.5);
+    if (wanted < 1)
+    {
+        wanted = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= wanted)
+        {
+            int64_t value = bucket_value(i);
+            return value < max() ? value : max();
+        }
+    }
+    return max();
+}
+
+void LatencyHistogram::reset()
+{
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+    samples.store(0, std::memory_order_relaxed);
+    sum_ns.store(0, std::memory_order_relaxed);
+    max_ns.store(0, std::memory_order_relaxed);
+}
+
+LatencyReport::LatencyReport()
+    : frames_grabbed(0), frames_tracked(0), commands_sent(0), goals_written(0), dump_requested(false),
+      start_ns(monotonic_ns()), last_print_ns(start_ns), last_grabbed(0), last_tracked(0)
+{
+}
+
+void LatencyReport::record_frame(const FrameTimestamps &times)
+{
+    if (times.grab_ns == 0 || times.dequeue_ns == 0)
+    {
+        return;
+    }
+    stages[STAGE_QUEUE].record(times.dequeue_ns - times.grab_ns);
+    if (times.track_start_ns != 0 && times.track_end_ns != 0)
+    {
+        stages[STAGE_PREPROCESS].record(times.track_start_ns - times.dequeue_ns);
+        stages[STAGE_TRACK].record(times.track_end_ns - times.track_start_ns);
+        stages[STAGE_VISION].record(times.track_end_ns - times.grab_ns);
+    }
+    frames_tracked.fetch_add(1, std::memory_order_relaxed);
+}
+
+void LatencyReport::record_command(const FrameTimestamps &times)
+{
+    if (times.goal_written_ns == 0)
+    {
+        return;
+    }
+    stages[STAGE_COMMAND].record(times.command_ns - times.track_end_ns);
+    stages[STAGE_SERVO].record(times.goal_written_ns - times.command_ns);
+    stages[STAGE_END_TO_END].record(times.goal_written_ns - times.grab_ns);
+    goals_written.fetch_add(1, std::memory_order_relaxed);
+}
+
+void LatencyReport::record_wakeup(int64_t late_ns)
+{
+    stages[STAGE_WAKEUP].record(late_ns);
+}
+
+const LatencyHistogram &LatencyReport::stage(LatencyStage stage) const
+{
+    return stages[stage];
+}
+
+void LatencyReport::print(uint64_t frames_dropped)
+{
+    int64_t now = monotonic_ns();
+    uint64_t grabbed = frames_grabbed.load();
+    uint64_t tracked = frames_tracked.load();
+    double interval_s = (now - last_print_ns) / 1e9;
+    double total_s = (now - start_ns) / 1e9;
+
+    printf("[LATENCY]: %10s %8s %9s %9s %9s %9s %9s\n", "stage", "count", "mean ms", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        const LatencyHistogram &stage = stages[i];
+        printf("[LATENCY]: %10s %8llu %9.2f %9.2f %9.2f %9.2f %9.2f\n", STAGE_NAMES[i], (unsigned long long)stage.count(),
+               stage.mean() / 1e6, stage.percentile(50) / 1e6, stage.percentile(90) / 1e6, stage.percentile(99) / 1e6,
+               stage.max() / 1e6);
+    }
+    if (interval_s > 0 && total_s > 0)
+    {
+        printf("[LATENCY]: capture %.1f fps, tracker %.1f fps (%.1f / %.1f overall), %llu dropped, %llu commands, %llu goals written\n",
+               (grabbed - last_grabbed) / interval_s, (tracked - last_tracked) / interval_s, grabbed / total_s, tracked / total_s,
+               (unsigned long long)frames_dropped, (unsigned long long)commands_sent.load(), (unsigned long long)goals_written.load());
+    }
+
+    last_print_ns = now;
+    last_grabbed = grabbed;
+    last_tracked = tracked;
+}
@@ -0,0 +1,115 @@
+/*
+ * Latency measurement for the capture -> track -> servo pipeline.
+ *
+ * Every frame carries a FrameTimestamps record that each stage stamps with
+ * CLOCK_MONOTONIC as it passes through. The differences go into
+ * LatencyHistograms, which use HDR-style log-linear buckets (16 linear
+ * buckets per power of two, so any value is reported within ~6%) over
+ * 1ns .. ~18 minutes. Recording is a few relaxed atomic increments, so the
+ * hot loops can record while another thread dumps.
+ */
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Monotonic time, in ns, at which a frame reached each point of the pipeline.
+// 0 means the frame never got there.
+struct FrameTimestamps
+{
+    int64_t grab_ns;         // Frame source returned the frame
+    int64_t dequeue_ns;      // Tracker took it off the frame channel
+    int64_t track_start_ns;  // tracker->update() called
+    int64_t track_end_ns;    // tracker->update() returned
+    int64_t command_ns;      // Servo command queued for the controller
+    int64_t goal_written_ns; // Goal position packet written to the bus
+};
+
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_MAX_EXPONENT 40 // 2^40 ns, about 18 minutes
+#define LATENCY_BUCKETS (2 * LATENCY_SUB_BUCKETS + (LATENCY_MAX_EXPONENT - LATENCY_SUB_BUCKET_BITS) * LATENCY_SUB_BUCKETS)
+
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    // Thread safe and lock-free. Negative values are ignored.
+    void record(int64_t value_ns);
+
+    uint64_t count() const;
+    int64_t max() const;
+    double mean() const;
+
+    /*
+     * @param percentile 0 to 100
+     * @return the value below which that share of the samples fall, in ns.
+     */
+    int64_t percentile(double percentile) const;
+
+    void reset();
+
+private:
+    std::atomic<uint64_t> buckets[LATENCY_BUCKETS];
+    std::atomic<uint64_t> samples;
+    std::atomic<int64_t> sum_ns;
+    std::atomic<int64_t> max_ns;
+
+    static size_t bucket_of(int64_t value_ns);
+    static int64_t bucket_value(size_t bucket);
+};
+
+enum LatencyStage
+{
+    STAGE_QUEUE,        // grab -> dequeue: time waiting in the frame channel
+    STAGE_PREPROCESS,   // dequeue -> track start: colour conversion etc.
+    STAGE_TRACK,        // tracker->update()
+    STAGE_COMMAND,      // track end -> servo command queued
+    STAGE_SERVO,        // command queued -> goal packet written
+    STAGE_VISION,       // grab -> track end
+    STAGE_END_TO_END,   // grab -> goal packet written
+    STAGE_WAKEUP,       // How late the servo control loop woke up for each tick (scheduling jitter)
+    STAGE_COUNT
+};
+
+/*
+ * The histograms for every stage plus frame counters, shared by all threads.
+ */
+class LatencyReport
+{
+public:
+    LatencyReport();
+
+    // Records every stage the timestamps cover.
+    void record_frame(const FrameTimestamps &times);
+    void record_command(const FrameTimestamps &times);
+    void record_wakeup(int64_t late_ns);
+
+    std::atomic<uint64_t> frames_grabbed;
+    std::atomic<uint64_t> frames_tracked;
+    std::atomic<uint64_t> commands_sent;
+    std::atomic<uint64_t> goals_written;
+
+    /*
+     * Prints p50/p90/p99/max per stage, frame rates and the number of
+     * frames the handoff dropped.
+     */
+    void print(uint64_t frames_dropped);
+
+    const LatencyHistogram &stage(LatencyStage stage) const;
+
+    // Set from a signal handler to ask the tracker thread for a dump.
+    std::atomic<bool> dump_requested;
+
+private:
+    LatencyHistogram stages[STAGE_COUNT];
+    int64_t start_ns;
+    int64_t last_print_ns;
+    uint64_t last_grabbed;
+    uint64_t last_tracked;
+};
+
+#endif
@@ -0,0 +1,136 @@
+#include "motion_acquirer.h"
+
+#include <stdio.h>
+
+#include <vector>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace std;
+using namespace cv;
+
+MotionAcquirer::MotionAcquirer(int downscale, int stable_frames)
+    : downscale(downscale > 0 ? downscale : DEFAULT_ACQUIRE_DOWNSCALE),
+      stable_frames(stable_frames > 0 ? stable_frames : DEFAULT_ACQUIRE_FRAMES), learnt_frames(0), stable_count(0),
+      frames(0), total_ns(0)
+{
+    kernel = getStructuringElement(MORPH_ELLIPSE, Size(3, 3));
+}
+
+void MotionAcquirer::reset()
+{
+    background.release();
+    learnt_frames = 0;
+    stable_count = 0;
+}
+
+/*
+ * The largest moving blob in mask, if there is one that stands out.
+ *
+ * @return false if nothing is moving, the blob is too small, or another one
+ * is nearly as big.
+ */
+bool MotionAcquirer::find_blob(Rect &blob)
+{
+    vector<vector<Point>> contours;
+    findContours(mask, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+
+    double largest = 0;
+    double second = 0;
+    for (const vector<Point> &contour : contours)
+    {
+        double area = contourArea(contour);
+        if (area > largest)
+        {
+            second = largest;
+            largest = area;
+            blob = boundingRect(contour);
+        }
+        else if (area > second)
+        {
+            second = area;
+        }
+    }
+    return largest >= MOTION_MIN_AREA_FRACTION * mask.total() && largest >= MOTION_DOMINANCE * second;
+}
+
+bool MotionAcquirer::update(const Mat &frame, FramePixelFormat format, Rect2d &box)
+{
+    if (frame.empty())
+    {
+        return false;
+    }
+    int64_t start_ns = monotonic_ns();
+
+    // Luma is all it needs, and YUYV already has it; shrink before anything else
+    cvtColor(frame, grey, format == FRAME_FORMAT_YUYV ? COLOR_YUV2GRAY_YUYV : COLOR_BGR2GRAY);
+    resize(grey, small, Size(grey.cols / downscale, grey.rows / downscale), 0, 0, INTER_AREA);
+    GaussianBlur(small, small, Size(3, 3), 0);
+
+    bool found = false;
+    if (background.empty() || background.size() != small.size())
+    {
+        small.convertTo(background, CV_32F);
+        learnt_frames = 1;
+        stable_count = 0;
+    }
+    else
+    {
+        background.convertTo(difference, CV_8U);
+        absdiff(small, difference, difference);
+        accumulateWeighted(small, background, MOTION_BACKGROUND_RATE);
+
+        if (learnt_frames < MOTION_WARMUP_FRAMES)
+        {
+            learnt_frames++;
+        }
+        else
+        {
+            threshold(difference, mask, MOTION_THRESHOLD, 255, THRESH_BINARY);
+            // Drop speckle, then join the parts of one body that moved separately
+            morphologyEx(mask, mask, MORPH_OPEN, kernel);
+            dilate(mask, mask, kernel, Point(-1, -1), 2);
+
+            Rect blob;
+            if (countNonZero(mask) > MOTION_MAX_AREA_FRACTION * mask.total())
+            {
+                // Lighting or the camera moved; start again on the new scene
+                small.convertTo(background, CV_32F);
+                learnt_frames = 1;
+                stable_count = 0;
+            }
+            else if (!find_blob(blob))
+            {
+                stable_count = 0;
+            }
+            else
+            {
+                double overlap = (blob & candidate).area();
+                double iou = overlap / (blob.area() + candidate.area() - overlap);
+                stable_count = (stable_count > 0 && iou >= MOTION_STABLE_IOU) ? stable_count + 1 : 1;
+                candidate = blob;
+                if (stable_count >= stable_frames)
+                {
+                    box = Rect2d(blob.x * downscale, blob.y * downscale, blob.width * downscale,
+                                 blob.height * downscale);
+                    found = true;
+                    stable_count = 0;
+                }
+            }
+        }
+    }
+
+    frames++;
+    total_ns += monotonic_ns() - start_ns;
+    return found;
+}
+
+void MotionAcquirer::print_stats() const
+{
+    if (frames == 0)
+    {
+        return;
+    }
+    printf("[ACQUIRE]: searched %lu frames at 1/%d resolution for motion, mean %.2f ms per frame\n", frames,
+           downscale, total_ns / 1e6 / frames);
+}
@@ -0,0 +1,91 @@
+/*
+ * Picks the target by itself when nobody is there to draw a box
+ * (--acquire=motion), so CameraMaan can start headless.
+ *
+ * Every frame the tracker thread gets while it has no target is shrunk to
+ * 1/--acquire-scale and compared against a running average of the scene.
+ * The pixels that differ by more than MOTION_THRESHOLD grey levels are
+ * cleaned up and grouped into blobs, and the largest one is the candidate if
+ * it is big enough and clearly bigger than the next. Once the candidate has
+ * stayed in roughly the same place (IoU >= MOTION_STABLE_IOU frame to frame)
+ * for --acquire-frames frames its box, in frame coordinates, seeds the
+ * tracker.
+ *
+ * At 1/4 scale a 1280x720 frame is 320x180 grey pixels, so a frame costs a
+ * fraction of a millisecond, a small part of one tracker update, and it can
+ * run on every frame until something moves. The camera has to be still for
+ * it: while the servos are going home the whole picture changes, which is
+ * treated as the scene changing rather than as a target.
+ */
+#ifndef MOTION_ACQUIRER_H
+#define MOTION_ACQUIRER_H
+
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "frame_ring.h"
+
+#define DEFAULT_ACQUIRE_DOWNSCALE 4     // Frames are searched at 320x180
+#define DEFAULT_ACQUIRE_FRAMES 5        // How long a blob has to hold still to be the target
+#define MOTION_WARMUP_FRAMES 10         // Background learnt before anything counts as moving
+#define MOTION_BACKGROUND_RATE 0.05     // Running average weight of each new frame
+#define MOTION_THRESHOLD 25             // Grey levels from the background that count as moving
+#define MOTION_MIN_AREA_FRACTION 0.002  // Smallest blob, of the searched frame's area
+#define MOTION_MAX_AREA_FRACTION 0.5    // More than this moving is the scene changing, not a target
+#define MOTION_DOMINANCE 2.0            // The largest blob has to be this much bigger than the next
+#define MOTION_STABLE_IOU 0.3           // Overlap with the last frame's blob to count as the same one
+
+enum TargetAcquisition
+{
+    ACQUIRE_MANUAL, // selectROI on the preview window
+    ACQUIRE_MOTION  // The dominant moving blob, see above
+};
+
+class MotionAcquirer
+{
+public:
+    /*
+     * @param downscale 4 or 8, how much frames are shrunk before searching.
+     * @param stable_frames how many frames in a row the blob has to be found.
+     */
+    MotionAcquirer(int downscale, int stable_frames);
+
+    /*
+     * Looks for the target on one frame. Called by the tracker thread with
+     * every frame until it returns true.
+     *
+     * @param frame the whole frame, BGR or YUYV as format says.
+     * @param box set, in frame coordinates, when the target has been found.
+     * @return true once a moving blob has been stable for long enough.
+     */
+    bool update(const cv::Mat &frame, FramePixelFormat format, cv::Rect2d &box);
+
+    // Forgets the background, e.g. after the camera moved.
+    void reset();
+
+    void print_stats() const;
+
+private:
+    int downscale;
+    int stable_frames;
+
+    // Scratch, reused every frame
+    cv::Mat grey;
+    cv::Mat small;
+    cv::Mat difference;
+    cv::Mat mask;
+    cv::Mat kernel;
+
+    cv::Mat background; // CV_32F running average at the searched size
+    int learnt_frames;
+    cv::Rect candidate; // Last frame's blob, in searched coordinates
+    int stable_count;
+
+    unsigned long frames;
+    int64_t total_ns;
+
+    bool find_blob(cv::Rect &blob);
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "multi_target_tracker.h"
+#include "frame_ring.h"
+
+using namespace std;
+using namespace cv;
+
+MultiTargetTracker::MultiTargetTracker(const vector<string> &ladder, int64_t budget_ns, int max_downscale,
+                                       double search_padding, TargetSelectMode mode)
+    : ladder(ladder), budget_ns(budget_ns), max_downscale(max_downscale), search_padding(search_padding), mode(mode),
+      selected_index(-1)
+{
+    // The first target always exists, so there's a tracker to preload and name
+    trackers.emplace_back(new TargetTracker(ladder, budget_ns, max_downscale, search_padding));
+    targets.push_back(TrackedTarget());
+}
+
+bool MultiTargetTracker::preload()
+{
+    return trackers[0]->preload();
+}
+
+bool MultiTargetTracker::init(const Mat &frame, const vector<Rect2d> &boxes)
+{
+    if (boxes.empty())
+    {
+        return false;
+    }
+    // Keep the first one, it may hold the preloaded tracker
+    trackers.resize(1);
+    while (trackers.size() < boxes.size())
+    {
+        trackers.emplace_back(new TargetTracker(ladder, budget_ns, max_downscale, search_padding));
+    }
+    targets.assign(boxes.size(), TrackedTarget());
+    if (boxes.size() > 1 && !pool)
+    {
+        pool.reset(new WorkerPool());
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < boxes.size(); i++)
+    {
+        ok = reinit(i, frame, boxes[i]) && ok;
+    }
+    selected_index = 0;
+    return ok;
+}
+
+bool MultiTargetTracker::reinit(size_t index, const Mat &frame, const Rect2d &box)
+{
+    if (index >= trackers.size() || !trackers[index]->init(frame, box))
+    {
+        return false;
+    }
+    TrackedTarget &target = targets[index];
+    target.box = box;
+    target.tracking = true;
+    target.fresh = true;
+    return true;
+}
+
+void MultiTargetTracker::update_target(size_t index, const Mat &frame)
+{
+    TrackedTarget &target = targets[index];
+    if (target.fresh)
+    {
+        // Initialised on this very frame, there's nothing to find yet
+        target.fresh = false;
+        target.update_ns = 0;
+        return;
+    }
+    int64_t start_ns = monotonic_ns();
+    target.tracking = trackers[index]->update(frame, target.box);
+    target.update_ns = monotonic_ns() - start_ns;
+    if (!target.tracking)
+    {
+        target.lost++;
+    }
+}
+
+bool MultiTargetTracker::update(const Mat &frame, Rect2d &box)
+{
+    // Each task only touches its own tracker and target; the frame is shared read-only
+    if (pool && targets.size() > 1)
+    {
+        pool->run(targets.size(), [&](size_t index) { update_target(index, frame); });
+    }
+    else
+    {
+        for (size_t i = 0; i < targets.size(); i++)
+        {
+            update_target(i, frame);
+        }
+    }
+    return select(box);
+}
+
+bool MultiTargetTracker::select(Rect2d &box)
+{
+    selected_index = -1;
+    if (mode == SELECT_PRIORITY)
+    {
+        for (size_t i = 0; i < targets.size(); i++)
+        {
+            if (targets[i].tracking)
+            {
+                selected_index = int(i);
+                box = targets[i].box;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool any = false;
+    Rect2d group;
+    for (const TrackedTarget &target : targets)
+    {
+        if (target.tracking)
+        {
+            group = any ? (group | target.box) : target.box;
+            any = true;
+        }
+    }
+    if (any)
+    {
+        box = group;
+    }
+    return any;
+}
+
+size_t MultiTargetTracker::count() const
+{
+    return targets.size();
+}
+
+const TrackedTarget &MultiTargetTracker::target(size_t index) const
+{
+    return targets[index];
+}
+
+int MultiTargetTracker::selected() const
+{
+    return selected_index;
+}
+
+Rect MultiTargetTracker::search_window() const
+{
+    Rect window;
+    for (size_t i = 0; i < trackers.size(); i++)
+    {
+        Rect part = trackers[i]->search_window();
+        if (part.area() == 0)
+        {
+            return Rect();
+        }
+        window = i == 0 ? part : (window | part);
+    }
+    return window;
+}
+
+bool MultiTargetTracker::adaptive() const
+{
+    return trackers[0]->adaptive();
+}
+
+const string &MultiTargetTracker::name() const
+{
+    return trackers[0]->name();
+}
+
+uint64_t MultiTargetTracker::switches() const
+{
+    return trackers[0]->switches();
+}
+
+int MultiTargetTracker::downscale() const
+{
+    return trackers[0]->downscale();
+}
+
+int MultiTargetTracker::parallelism() const
+{
+    return pool && targets.size() > 1 ? pool->parallelism() : 1;
+}
@@ -0,0 +1,115 @@
+/*
+ * Follows several targets at once, each with its own TargetTracker (ladder,
+ * level and search window as in tracker_engine.h), and boils them down to
+ * the one box the servos aim at.
+ *
+ * Every frame the targets are updated as tasks on a WorkerPool sized to the
+ * CPUs the tracker thread may run on, all reading the same frame, which
+ * nothing writes to until update() returns. CSRT at 1280x720 takes most of
+ * a frame period on its own, so N of them in a row would cut the frame rate
+ * by N; in parallel a frame costs about the slowest target's update until
+ * there are more targets than CPUs. With one target no pool is created and
+ * the update runs on the tracker thread as before.
+ *
+ * The selection step turns the per-target results into one box:
+ *
+ *      priority   the first target, in the order they were given, that the
+ *                 tracker still has; the next one takes over while it's lost
+ *      group      the box around every target still being tracked, so the
+ *                 camera frames them all
+ */
+#ifndef MULTI_TARGET_TRACKER_H
+#define MULTI_TARGET_TRACKER_H
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "tracker_engine.h"
+#include "worker_pool.h"
+
+enum TargetSelectMode
+{
+    SELECT_PRIORITY, // Aim at the first target still tracked
+    SELECT_GROUP     // Aim at the box around all of them
+};
+
+struct TrackedTarget
+{
+    cv::Rect2d box;   // Frame coordinates, the last place it was found
+    bool tracking;    // Found on the last frame
+    bool fresh;       // Initialised on this frame; the next update() leaves it alone
+    uint64_t lost;    // Updates that lost it
+    int64_t update_ns; // Its update on the last frame
+};
+
+class MultiTargetTracker
+{
+public:
+    // The tracker settings are the same for every target; see TargetTracker.
+    MultiTargetTracker(const std::vector<std::string> &ladder, int64_t budget_ns, int max_downscale,
+                       double search_padding, TargetSelectMode mode);
+
+    // Creates the first target's tracker ahead of init(); see TargetTracker::preload().
+    bool preload();
+
+    /*
+     * Starts tracking boxes in frame, replacing any targets from before. The
+     * first box is the priority target.
+     *
+     * @return false if any of the trackers can't be started.
+     */
+    bool init(const cv::Mat &frame, const std::vector<cv::Rect2d> &boxes);
+
+    // Starts one target again from box, e.g. after re-acquiring it.
+    bool reinit(size_t index, const cv::Mat &frame, const cv::Rect2d &box);
+
+    /*
+     * Updates every target on frame, then runs the selection.
+     *
+     * Only the search_window() part of frame has to be valid.
+     *
+     * @param box the selected box, unchanged if no target was found.
+     * @return false if no target was found.
+     */
+    bool update(const cv::Mat &frame, cv::Rect2d &box);
+
+    size_t count() const;
+    const TrackedTarget &target(size_t index) const;
+
+    // The target the last selection picked; -1 for a group or none.
+    int selected() const;
+
+    // The part of the next frame the targets will read, all of them
+    // together; empty for the whole frame.
+    cv::Rect search_window() const;
+
+    // Of the priority target's tracker
+    bool adaptive() const;
+    const std::string &name() const;
+    uint64_t switches() const;
+    int downscale() const;
+
+    // Tasks that can run at once, 1 until there is more than one target.
+    int parallelism() const;
+
+private:
+    std::vector<std::string> ladder;
+    int64_t budget_ns;
+    int max_downscale;
+    double search_padding;
+    TargetSelectMode mode;
+
+    std::vector<std::unique_ptr<TargetTracker>> trackers;
+    std::vector<TrackedTarget> targets;
+    std::unique_ptr<WorkerPool> pool; // Made when the second target is
+    int selected_index;
+
+    void update_target(size_t index, const cv::Mat &frame);
+    bool select(cv::Rect2d &box);
+};
+
+#endif
@@ -0,0 +1,505 @@
+#include "options.h"
+#include "frame_preview.h"
+#include "tracker_engine.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+CameraMaanOptions options = {
+    HANDOFF_FIFO,     // handoff_mode
+    false,            // pipelined
+    false,            // headless
+    DEFAULT_PREVIEW_FPS, // preview_fps
+    "camera",         // source
+    PACING_REALTIME,  // pacing
+    0.0,              // source_fps
+    false,            // has_roi
+    {},               // rois
+    false,            // multi_target
+    SELECT_PRIORITY,  // target_select
+    ACQUIRE_MANUAL,   // acquisition
+    DEFAULT_ACQUIRE_DOWNSCALE, // acquire_downscale
+    DEFAULT_ACQUIRE_FRAMES, // acquire_frames
+    0.0,              // stats_interval
+    {DEFAULT_TRACKER}, // tracker_ladder
+    0.0,              // frame_budget_ms
+    DEFAULT_MAX_DOWNSCALE, // max_downscale
+    0.0,              // search_padding
+    PREDICT_CONSTANT_VELOCITY, // prediction
+    0.0,              // lead_ms
+    {REACQUIRE_OFF, "", "", DEFAULT_REACQUIRE_HZ}, // reacquire
+    DEFAULT_SERVO_POLL_HZ, // servo_poll_hz
+    false,            // servo_poll_load
+    false,            // lean_transport
+    false,            // async_io
+    CONTROL_PID,      // control_mode
+    DEFAULT_CONTROL_HZ, // control_hz
+    {DEFAULT_PID_KP, DEFAULT_PID_KI, DEFAULT_PID_KD, DEFAULT_MAX_SPEED_DPS, DEFAULT_PID_INTEGRAL_LIMIT}, // pid
+    {},               // rt, filled in by parse_options()
+};
+
+void print_usage(const char *program)
+{
+    printf("Usage: %s [options]\n", program);
+    printf("  --handoff=fifo|latest   Capture -> Track handoff. 'fifo' tracks every frame,\n");
+    printf("                          'latest' only tracks the freshest one (default fifo)\n");
+    printf("  --pipeline              Run preprocess, track, command and annotate on a thread\n");
+    printf("                          each, so they work on consecutive frames at once\n");
+    printf("  --headless              No preview window and no HighGUI at all; the target\n");
+    printf("                          comes from --roi, the source or --acquire=motion\n");
+    printf("  --preview-fps=N         How often the preview window is updated (default %.0f)\n",
+           DEFAULT_PREVIEW_FPS);
+    printf("  --source=SPEC           Where frames come from (default camera):\n");
+    printf("                            camera[:N]   webcam N\n");
+    printf("                            v4l2[:DEV]   zero-copy V4L2 capture from DEV\n");
+    printf("                                         (default /dev/video0)\n");
+    printf("                            file:PATH    recorded video\n");
+    printf("                            images:DIR   every image in DIR, sorted by name\n");
+    printf("                            synthetic    generated moving target\n");
+    printf("  --pace=realtime|fast    Replay file/images/synthetic at their frame rate or as\n");
+    printf("                          fast as the tracker keeps up (default realtime)\n");
+    printf("  --fps=N                 Replay rate for --pace=realtime\n");
+    printf("  --roi=x,y,w,h           Start tracking this box instead of asking with selectROI.\n");
+    printf("                          Give it more than once to track several targets\n");
+    printf("  --multi-target          Select several targets on the preview window, one box\n");
+    printf("                          after the other; Esc when done\n");
+    printf("  --target-select=priority|group\n");
+    printf("                          With several targets, aim at the first one still\n");
+    printf("                          tracked ('priority') or frame all of them ('group')\n");
+    printf("                          (default priority)\n");
+    printf("  --acquire=manual|motion 'motion' picks the target without anyone at the screen:\n");
+    printf("                          the dominant moving blob, once it has been found for\n");
+    printf("                          --acquire-frames frames in a row. Needs the camera to\n");
+    printf("                          be still until then (default manual)\n");
+    printf("  --acquire-scale=4|8     How much frames are shrunk for motion acquisition\n");
+    printf("                          (default %d)\n", DEFAULT_ACQUIRE_DOWNSCALE);
+    printf("  --acquire-frames=N      Frames the moving blob has to be stable for (default %d)\n",
+           DEFAULT_ACQUIRE_FRAMES);
+    printf("  --stats-interval=S      Print the latency histograms every S seconds. They are\n");
+    printf("                          also printed on SIGUSR1 and at exit\n");
+    printf("  --tracker=NAME          Tracker to use (default %s), one of:\n", DEFAULT_TRACKER);
+    printf("                            CSRT KCF MOSSE MIL BOOSTING MEDIANFLOW TLD GOTURN\n");
+    printf("  --tracker=adaptive[:A,B,...]\n");
+    printf("                          Start on A and fall back to cheaper trackers when the\n");
+    printf("                          updates don't fit the frame budget (default %s)\n", DEFAULT_ADAPTIVE_LADDER);
+    printf("  --frame-budget=MS       Update time the adaptive tracker aims for (default one\n");
+    printf("                          frame period of --fps, or of 30 fps)\n");
+    printf("  --max-downscale=N       Let the tracker run on frames scaled down by up to N\n");
+    printf("                          (1, 2, 4 or 8), picked from the target size. 1 always\n");
+    printf("                          tracks at full resolution (default %d)\n", DEFAULT_MAX_DOWNSCALE);
+    printf("  --search-window=N       Only give the tracker a window N times the target's\n");
+    printf("                          size around it (N >= 1.5, e.g. 3). The window follows\n");
+    printf("                          the target; once it is lost, only --reacquire looks\n");
+    printf("                          outside. 0 gives the tracker the whole frame (default 0)\n");
+    printf("  --predict=off|cv|ca     Kalman filter the target with a constant velocity or\n");
+    printf("                          constant acceleration model and aim where it will be\n");
+    printf("                          when the servos get there (default cv)\n");
+    printf("  --lead-ms=MS            Extra lead for the servos' own travel time, on top of\n");
+    printf("                          the measured pipeline latency (default 0)\n");
+    printf("  --reacquire=off|template|cascade:FILE|dnn:MODEL[,CONFIG]\n");
+    printf("                          Find the target again on a worker thread when the\n");
+    printf("                          tracker loses it, by its last appearance ('template')\n");
+    printf("                          or with a detector (default off)\n");
+    printf("  --reacquire-hz=N        How often the target's appearance is refreshed while\n");
+    printf("                          tracking (default %.0f)\n", DEFAULT_REACQUIRE_HZ);
+    printf("  --servo-poll-hz=N       How often a background thread reads the servos'\n");
+    printf("                          positions, so moves don't have to (default %d)\n", DEFAULT_SERVO_POLL_HZ);
+    printf("  --servo-poll-load       Read present speed and load with the position\n");
+    printf("  --dxl-transport=sdk|lean\n");
+    printf("                          'lean' talks to the servos with precomputed packets on\n");
+    printf("                          a low-latency port instead of the DXL SDK (default sdk)\n");
+    printf("  --dxl-async             With the lean transport, queue servo bus requests to an\n");
+    printf("                          epoll I/O thread so reads and writes can be issued\n");
+    printf("                          back-to-back without waiting on each other\n");
+    printf("  --control=step|pid      'pid' runs a fixed-rate PID velocity loop on the latest\n");
+    printf("                          target; 'step' makes one relative move per tracker\n");
+    printf("                          update (default pid)\n");
+    printf("  --control-hz=N          PID loop rate (default %d)\n", DEFAULT_CONTROL_HZ);
+    printf("  --pid=KP,KI,KD          PID gains, deg/s per degree of error (default %g,%g,%g)\n",
+           DEFAULT_PID_KP, DEFAULT_PID_KI, DEFAULT_PID_KD);
+    printf("  --max-speed=DEG_PER_S   PID output limit (default %g)\n", DEFAULT_MAX_SPEED_DPS);
+    printf("  --rt                    Real-time mode: SCHED_FIFO per thread (controller 80,\n");
+    printf("                          poller 75, capture 70, tracker 60), CPU pinning with\n");
+    printf("                          4+ CPUs, and memory locked with mlockall()\n");
+    printf("  --rt-thread=NAME:POLICY:PRIORITY[@CPUS]\n");
+    printf("                          Override one thread (controller, poller, capture or\n");
+    printf("                          tracker) with fifo, rr or other, e.g. tracker:rr:50@0-2.\n");
+    printf("                          Implies --rt\n");
+    printf("  --no-mlock              Don't lock memory in --rt mode\n");
+    printf("  --help                  Show this message\n");
+}
+
+bool parse_options(int argc, char *argv[], CameraMaanOptions &opts)
+{
+    enum
+    {
+        OPT_HANDOFF = 256,
+        OPT_PIPELINE,
+        OPT_HEADLESS,
+        OPT_PREVIEW_FPS,
+        OPT_SOURCE,
+        OPT_PACE,
+        OPT_FPS,
+        OPT_ROI,
+        OPT_MULTI_TARGET,
+        OPT_TARGET_SELECT,
+        OPT_ACQUIRE,
+        OPT_ACQUIRE_SCALE,
+        OPT_ACQUIRE_FRAMES,
+        OPT_STATS_INTERVAL,
+        OPT_TRACKER,
+        OPT_FRAME_BUDGET,
+        OPT_MAX_DOWNSCALE,
+        OPT_SEARCH_WINDOW,
+        OPT_PREDICT,
+        OPT_LEAD,
+        OPT_REACQUIRE,
+        OPT_REACQUIRE_HZ,
+        OPT_SERVO_POLL_HZ,
+        OPT_SERVO_POLL_LOAD,
+        OPT_DXL_TRANSPORT,
+        OPT_DXL_ASYNC,
+        OPT_CONTROL,
+        OPT_CONTROL_HZ,
+        OPT_PID,
+        OPT_MAX_SPEED,
+        OPT_RT,
+        OPT_RT_THREAD,
+        OPT_NO_MLOCK,
+        OPT_HELP
+    };
+    static const struct option long_options[] = {
+        {"handoff", required_argument, NULL, OPT_HANDOFF},
+        {"pipeline", no_argument, NULL, OPT_PIPELINE},
+        {"headless", no_argument, NULL, OPT_HEADLESS},
+        {"preview-fps", required_argument, NULL, OPT_PREVIEW_FPS},
+        {"source", required_argument, NULL, OPT_SOURCE},
+        {"pace", required_argument, NULL, OPT_PACE},
+        {"fps", required_argument, NULL, OPT_FPS},
+        {"roi", required_argument, NULL, OPT_ROI},
+        {"multi-target", no_argument, NULL, OPT_MULTI_TARGET},
+        {"target-select", required_argument, NULL, OPT_TARGET_SELECT},
+        {"acquire", required_argument, NULL, OPT_ACQUIRE},
+        {"acquire-scale", required_argument, NULL, OPT_ACQUIRE_SCALE},
+        {"acquire-frames", required_argument, NULL, OPT_ACQUIRE_FRAMES},
+        {"stats-interval", required_argument, NULL, OPT_STATS_INTERVAL},
+        {"tracker", required_argument, NULL, OPT_TRACKER},
+        {"frame-budget", required_argument, NULL, OPT_FRAME_BUDGET},
+        {"max-downscale", required_argument, NULL, OPT_MAX_DOWNSCALE},
+        {"search-window", required_argument, NULL, OPT_SEARCH_WINDOW},
+        {"predict", required_argument, NULL, OPT_PREDICT},
+        {"lead-ms", required_argument, NULL, OPT_LEAD},
+        {"reacquire", required_argument, NULL, OPT_REACQUIRE},
+        {"reacquire-hz", required_argument, NULL, OPT_REACQUIRE_HZ},
+        {"servo-poll-hz", required_argument, NULL, OPT_SERVO_POLL_HZ},
+        {"servo-poll-load", no_argument, NULL, OPT_SERVO_POLL_LOAD},
+        {"dxl-transport", required_argument, NULL, OPT_DXL_TRANSPORT},
+        {"dxl-async", no_argument, NULL, OPT_DXL_ASYNC},
+        {"control", required_argument, NULL, OPT_CONTROL},
+        {"control-hz", required_argument, NULL, OPT_CONTROL_HZ},
+        {"pid", required_argument, NULL, OPT_PID},
+        {"max-speed", required_argument, NULL, OPT_MAX_SPEED},
+        {"rt", no_argument, NULL, OPT_RT},
+        {"rt-thread", required_argument, NULL, OPT_RT_THREAD},
+        {"no-mlock", no_argument, NULL, OPT_NO_MLOCK},
+        {"help", no_argument, NULL, OPT_HELP},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    default_rt_config(opts.rt);
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case OPT_HANDOFF:
+            if (strcmp(optarg, "fifo") == 0)
+            {
+                opts.handoff_mode = HANDOFF_FIFO;
+            }
+            else if (strcmp(optarg, "latest") == 0)
+            {
+                opts.handoff_mode = HANDOFF_LATEST;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown handoff mode '%s'\n", optarg);
+                print_usage(argv[0]);
+                return false;
+            }
+            break;
+        case OPT_PIPELINE:
+            opts.pipelined = true;
+            break;
+        case OPT_HEADLESS:
+            opts.headless = true;
+            break;
+        case OPT_PREVIEW_FPS:
+            opts.preview_fps = atof(optarg);
+            if (opts.preview_fps <= 0)
+            {
+                fprintf(stderr, "--preview-fps must be greater than 0\n");
+                return false;
+            }
+            break;
+        case OPT_SOURCE:
+            opts.source = optarg;
+            break;
+        case OPT_PACE:
+            if (strcmp(optarg, "realtime") == 0)
+            {
+                opts.pacing = PACING_REALTIME;
+            }
+            else if (strcmp(optarg, "fast") == 0)
+            {
+                opts.pacing = PACING_FAST;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown pacing '%s'\n", optarg);
+                print_usage(argv[0]);
+                return false;
+            }
+            break;
+        case OPT_FPS:
+            opts.source_fps = atof(optarg);
+            if (opts.source_fps <= 0)
+            {
+                fprintf(stderr, "--fps must be greater than 0\n");
+                return false;
+            }
+            break;
+        case OPT_ROI:
+        {
+            double x, y, w, h;
+            if (sscanf(optarg, "%lf,%lf,%lf,%lf", &x, &y, &w, &h) != 4 || w <= 0 || h <= 0)
+            {
+                fprintf(stderr, "--roi expects x,y,width,height\n");
+                return false;
+            }
+            opts.rois.push_back(cv::Rect2d(x, y, w, h));
+            opts.has_roi = true;
+            break;
+        }
+        case OPT_MULTI_TARGET:
+            opts.multi_target = true;
+            break;
+        case OPT_TARGET_SELECT:
+            if (strcmp(optarg, "priority") == 0)
+            {
+                opts.target_select = SELECT_PRIORITY;
+            }
+            else if (strcmp(optarg, "group") == 0)
+            {
+                opts.target_select = SELECT_GROUP;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown target selection '%s'\n", optarg);
+                print_usage(argv[0]);
+                return false;
+            }
+            break;
+        case OPT_ACQUIRE:
+            if (strcmp(optarg, "manual") == 0)
+            {
+                opts.acquisition = ACQUIRE_MANUAL;
+            }
+            else if (strcmp(optarg, "motion") == 0)
+            {
+                opts.acquisition = ACQUIRE_MOTION;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown acquisition mode '%s'\n", optarg);
+                print_usage(argv[0]);
+                return false;
+            }
+            break;
+        case OPT_ACQUIRE_SCALE:
+            opts.acquire_downscale = atoi(optarg);
+            if (opts.acquire_downscale != 4 && opts.acquire_downscale != 8)
+            {
+                fprintf(stderr, "--acquire-scale must be 4 or 8\n");
+                return false;
+            }
+            break;
+        case OPT_ACQUIRE_FRAMES:
+            opts.acquire_frames = atoi(optarg);
+            if (opts.acquire_frames < 1)
+            {
+                fprintf(stderr, "--acquire-frames must be at least 1\n");
+                return false;
+            }
+            break;
+        case OPT_STATS_INTERVAL:
+            opts.stats_interval = atof(optarg);
+            break;
+        case OPT_TRACKER:
+            if (!parse_tracker_spec(optarg, opts.tracker_ladder))
+            {
+                print_usage(argv[0]);
+                return false;
+            }
+            break;
+        case OPT_FRAME_BUDGET:
+            opts.frame_budget_ms = atof(optarg);
+            if (opts.frame_budget_ms <= 0)
+            {
+                fprintf(stderr, "--frame-budget must be greater than 0\n");
+                return false;
+            }
+            break;
+        case OPT_MAX_DOWNSCALE:
+            opts.max_downscale = atoi(optarg);
+            if (opts.max_downscale != 1 && opts.max_downscale != 2 && opts.max_downscale != 4 && opts.max_downscale != 8)
+            {
+                fprintf(stderr, "--max-downscale must be 1, 2, 4 or 8\n");
+                return false;
+            }
+            break;
+        case OPT_SEARCH_WINDOW:
+            opts.search_padding = atof(optarg);
+            if (opts.search_padding != 0 && opts.search_padding < 1.5)
+            {
+                fprintf(stderr, "--search-window must be 0 or at least 1.5\n");
+                return false;
+            }
+            break;
+        case OPT_PREDICT:
+            if (strcmp(optarg, "off") == 0)
+            {
+                opts.prediction = PREDICT_OFF;
+            }
+            else if (strcmp(optarg, "cv") == 0)
+            {
+                opts.prediction = PREDICT_CONSTANT_VELOCITY;
+            }
+            else if (strcmp(optarg, "ca") == 0)
+            {
+                opts.prediction = PREDICT_CONSTANT_ACCELERATION;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown prediction model '%s'\n", optarg);
+                print_usage(argv[0]);
+                return false;
+            }
+            break;
+        case OPT_LEAD:
+            opts.lead_ms = atof(optarg);
+            if (opts.lead_ms < 0)
+            {
+                fprintf(stderr, "--lead-ms can't be negative\n");
+                return false;
+            }
+            break;
+        case OPT_REACQUIRE:
+            if (!parse_reacquire_spec(optarg, opts.reacquire))
+            {
+                print_usage(argv[0]);
+                return false;
+            }
+            break;
+        case OPT_REACQUIRE_HZ:
+            opts.reacquire.refresh_hz = atof(optarg);
+            if (opts.reacquire.refresh_hz <= 0)
+            {
+                fprintf(stderr, "--reacquire-hz must be greater than 0\n");
+                return false;
+            }
+            break;
+        case OPT_SERVO_POLL_HZ:
+            opts.servo_poll_hz = atof(optarg);
+            if (opts.servo_poll_hz <= 0)
+            {
+                fprintf(stderr, "--servo-poll-hz must be greater than 0\n");
+                return false;
+            }
+            break;
+        case OPT_SERVO_POLL_LOAD:
+            opts.servo_poll_load = true;
+            break;
+        case OPT_DXL_TRANSPORT:
+            if (strcmp(optarg, "sdk") == 0)
+            {
+                opts.lean_transport = false;
+            }
+            else if (strcmp(optarg, "lean") == 0)
+            {
+                opts.lean_transport = true;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown transport '%s'\n", optarg);
+                print_usage(argv[0]);
+                return false;
+            }
+            break;
+        case OPT_DXL_ASYNC:
+            opts.async_io = true;
+            break;
+        case OPT_CONTROL:
+            if (strcmp(optarg, "step") == 0)
+            {
+                opts.control_mode = CONTROL_STEP;
+            }
+            else if (strcmp(optarg, "pid") == 0)
+            {
+                opts.control_mode = CONTROL_PID;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown control mode '%s'\n", optarg);
+                print_usage(argv[0]);
+                return false;
+            }
+            break;
+        case OPT_CONTROL_HZ:
+            opts.control_hz = atof(optarg);
+            if (opts.control_hz <= 0 || opts.control_hz > 1000)
+            {
+                fprintf(stderr, "--control-hz must be between 0 and 1000\n");
+                return false;
+            }
+            break;
+        case OPT_PID:
+            if (sscanf(optarg, "%lf,%lf,%lf", &opts.pid.kp, &opts.pid.ki, &opts.pid.kd) != 3 ||
+                opts.pid.kp < 0 || opts.pid.ki < 0 || opts.pid.kd < 0)
+            {
+                fprintf(stderr, "--pid expects three gains KP,KI,KD, none negative\n");
+                return false;
+            }
+            break;
+        case OPT_MAX_SPEED:
+            opts.pid.output_limit = atof(optarg);
+            if (opts.pid.output_limit <= 0)
+            {
+                fprintf(stderr, "--max-speed must be greater than 0\n");
+                return false;
+            }
+            break;
+        case OPT_RT:
+            opts.rt.enabled = true;
+            break;
+        case OPT_RT_THREAD:
+            if (!parse_rt_thread(optarg, opts.rt))
+            {
+                return false;
+            }
+            opts.rt.enabled = true;
+            break;
+        case OPT_NO_MLOCK:
+            opts.rt.lock_memory = false;
+            break;
+        case OPT_HELP:
+            print_usage(argv[0]);
+            return false;
+        default:
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,72 @@
+/*
+ * Run time options for CameraMaan, filled in from the command line by main()
+ * before any of the threads are created. The threads only ever read them.
+ */
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <string>
+#include <vector>
+
+#include "frame_ring.h"
+#include "frame_source.h"
+#include "motion_acquirer.h"
+#include "multi_target_tracker.h"
+#include "rt_config.h"
+#include "servo_pid.h"
+#include "servo_state.h"
+#include "target_predictor.h"
+#include "target_reacquirer.h"
+
+enum ServoControlMode
+{
+    CONTROL_STEP, // A relative move per servo command
+    CONTROL_PID   // Fixed-rate PID velocity loop on the latest target
+};
+
+struct CameraMaanOptions
+{
+    FrameHandoffMode handoff_mode; // --handoff=fifo|latest
+    bool pipelined;                // --pipeline gives each of the tracker thread's stages a thread
+    bool headless;                 // --headless opens no window at all
+    double preview_fps;            // --preview-fps=N the preview window is updated at
+    std::string source;            // --source=SPEC, see frame_source.h
+    FramePacing pacing;            // --pace=realtime|fast
+    double source_fps;             // --fps=N, 0 uses the source's own rate
+    bool has_roi;                  // --roi=x,y,w,h skips the interactive selectROI
+    std::vector<cv::Rect2d> rois;  // One per --roi, the first is the priority target
+    bool multi_target;             // --multi-target selects several boxes with selectROIs
+    TargetSelectMode target_select; // --target-select=priority|group
+    TargetAcquisition acquisition; // --acquire=manual|motion picks the target when there's no --roi
+    int acquire_downscale;         // --acquire-scale=4|8 for motion acquisition
+    int acquire_frames;            // --acquire-frames=N the moving blob has to be stable for
+    double stats_interval;         // --stats-interval=SECONDS between latency dumps, 0 = exit/SIGUSR1 only
+    std::vector<std::string> tracker_ladder; // --tracker=NAME|adaptive[:A,B,...], see tracker_engine.h
+    double frame_budget_ms;        // --frame-budget=MS for the adaptive tracker, 0 = one frame period
+    int max_downscale;             // --max-downscale=1|2|4|8 for the tracker's input, 1 = full resolution
+    double search_padding;         // --search-window=N times the target size, 0 = whole frame
+    PredictionModel prediction;    // --predict=off|cv|ca
+    double lead_ms;                // --lead-ms=MS the servos take to move, on top of the measured latency
+    ReacquireConfig reacquire;     // --reacquire=off|template|cascade:FILE|dnn:MODEL[,CONFIG] and --reacquire-hz=N
+    double servo_poll_hz;          // --servo-poll-hz=N for the servo state cache
+    bool servo_poll_load;          // --servo-poll-load also caches present speed and load
+    bool lean_transport;           // --dxl-transport=sdk|lean
+    bool async_io;                 // --dxl-async queues bus I/O on its own thread (lean only)
+    ServoControlMode control_mode; // --control=step|pid
+    double control_hz;             // --control-hz=N for the PID loop
+    PidGains pid;                  // --pid=KP,KI,KD and --max-speed=DEG_PER_S, same for both axes
+    RtConfig rt;                   // --rt, --rt-thread=NAME:POLICY:PRIORITY[@CPUS] and --no-mlock
+};
+
+extern CameraMaanOptions options;
+
+/*
+ * Parses argv into opts. Unknown options and bad values print the usage.
+ *
+ * @return false if the program should exit.
+ */
+bool parse_options(int argc, char *argv[], CameraMaanOptions &opts);
+
+void print_usage(const char *program);
+
+#endif
@@ -0,0 +1,332 @@
+#include "rt_config.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include <atomic>
+
+static const char *RT_THREAD_NAMES[RT_THREAD_COUNT] = {"controller", "poller", "capture", "tracker"};
+
+const char *rt_thread_name(RtThread which)
+{
+    return RT_THREAD_NAMES[which];
+}
+
+static const char *policy_name(int policy)
+{
+    switch (policy)
+    {
+    case SCHED_FIFO:
+        return "fifo";
+    case SCHED_RR:
+        return "rr";
+    default:
+        return "other";
+    }
+}
+
+// "0-1,3" -> {0, 1, 3}
+static bool parse_cpu_list(const char *list, cpu_set_t &cpus)
+{
+    CPU_ZERO(&cpus);
+    const char *p = list;
+    while (*p != '\0')
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+        {
+            return false;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first || last >= CPU_SETSIZE)
+            {
+                return false;
+            }
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++)
+        {
+            CPU_SET(cpu, &cpus);
+        }
+        if (*p == ',')
+        {
+            p++;
+        }
+        else if (*p != '\0')
+        {
+            return false;
+        }
+    }
+    return CPU_COUNT(&cpus) > 0;
+}
+
+static void format_cpu_list(const RtThreadConfig &thread, char *out, size_t size)
+{
+    if (!thread.pinned)
+    {
+        snprintf(out, size, "any");
+        return;
+    }
+    size_t used = 0;
+    out[0] = '\0';
+    for (int cpu = 0; cpu < CPU_SETSIZE && used < size; cpu++)
+    {
+        if (CPU_ISSET(cpu, &thread.cpus))
+        {
+            used += snprintf(out + used, size - used, used == 0 ? "%d" : ",%d", cpu);
+        }
+    }
+}
+
+void default_rt_config(RtConfig &config)
+{
+    static const int priorities[RT_THREAD_COUNT] = {80, 75, 70, 60};
+
+    config.enabled = false;
+    config.lock_memory = true;
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < RT_THREAD_COUNT; i++)
+    {
+        RtThreadConfig &thread = config.threads[i];
+        thread.policy = SCHED_FIFO;
+        thread.priority = priorities[i];
+        thread.pinned = cpu_count >= 4;
+        CPU_ZERO(&thread.cpus);
+    }
+    if (cpu_count >= 4)
+    {
+        CPU_SET(cpu_count - 1, &config.threads[RT_CONTROLLER].cpus);
+        CPU_SET(cpu_count - 1, &config.threads[RT_SERVO_POLLER].cpus);
+        CPU_SET(cpu_count - 2, &config.threads[RT_CAPTURE].cpus);
+        for (long cpu = 0; cpu < cpu_count - 2; cpu++)
+        {
+            CPU_SET(cpu, &config.threads[RT_TRACKER].cpus);
+        }
+    }
+}
+
+bool parse_rt_thread(const char *spec, RtConfig &config)
+{
+    char name[32];
+    char policy[16];
+    int priority;
+    int consumed = 0;
+    if (sscanf(spec, "%31[^:]:%15[^:]:%d%n", name, policy, &priority, &consumed) != 3)
+    {
+        fprintf(stderr, "--rt-thread expects NAME:POLICY:PRIORITY[@CPUS], got '%s'\n", spec);
+        return false;
+    }
+
+    int which = -1;
+    for (int i = 0; i < RT_THREAD_COUNT; i++)
+    {
+        if (strcmp(name, RT_THREAD_NAMES[i]) == 0)
+        {
+            which = i;
+        }
+    }
+    if (which < 0)
+    {
+        fprintf(stderr, "Unknown thread '%s', expected controller, poller, capture or tracker\n", name);
+        return false;
+    }
+
+    RtThreadConfig thread = config.threads[which];
+    if (strcmp(policy, "fifo") == 0)
+    {
+        thread.policy = SCHED_FIFO;
+    }
+    else if (strcmp(policy, "rr") == 0)
+    {
+        thread.policy = SCHED_RR;
+    }
+    else if (strcmp(policy, "other") == 0)
+    {
+        thread.policy = SCHED_OTHER;
+    }
+    else
+    {
+        fprintf(stderr, "Unknown scheduling policy '%s', expected fifo, rr or other\n", policy);
+        return false;
+    }
+
+    int minimum = sched_get_priority_min(thread.policy);
+    int maximum = sched_get_priority_max(thread.policy);
+    if (thread.policy != SCHED_OTHER && (priority < minimum || priority > maximum))
+    {
+        fprintf(stderr, "Priority %d for %s is outside %d..%d\n", priority, name, minimum, maximum);
+        return false;
+    }
+    thread.priority = thread.policy == SCHED_OTHER ? 0 : priority;
+
+    const char *cpus = spec + consumed;
+    thread.pinned = false;
+    if (*cpus == '@')
+    {
+        if (!parse_cpu_list(cpus + 1, thread.cpus))
+        {
+            fprintf(stderr, "Bad CPU list '%s' for %s\n", cpus + 1, name);
+            return false;
+        }
+        thread.pinned = true;
+    }
+    else if (*cpus != '\0')
+    {
+        fprintf(stderr, "--rt-thread expects NAME:POLICY:PRIORITY[@CPUS], got '%s'\n", spec);
+        return false;
+    }
+
+    config.threads[which] = thread;
+    return true;
+}
+
+void print_rt_config(const RtConfig &config)
+{
+    for (int i = 0; i < RT_THREAD_COUNT; i++)
+    {
+        const RtThreadConfig &thread = config.threads[i];
+        char cpus[128];
+        format_cpu_list(thread, cpus, sizeof(cpus));
+        printf("[RT]: %-10s %-5s priority %2d, cpus %s\n", RT_THREAD_NAMES[i], policy_name(thread.policy),
+               thread.priority, cpus);
+    }
+
+    // Without CAP_SYS_NICE the rtprio limit is the highest priority we may ask for
+    int highest = 0;
+    for (int i = 0; i < RT_THREAD_COUNT; i++)
+    {
+        if (config.threads[i].policy != SCHED_OTHER && config.threads[i].priority > highest)
+        {
+            highest = config.threads[i].priority;
+        }
+    }
+    struct rlimit limit;
+    if (highest > 0 && geteuid() != 0 && getrlimit(RLIMIT_RTPRIO, &limit) == 0 &&
+        limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < rlim_t(highest))
+    {
+        printf("[RT]: Warning, RLIMIT_RTPRIO is %lu but priority %d is wanted; run as root, give the binary "
+               "CAP_SYS_NICE or raise rtprio in /etc/security/limits.conf\n",
+               (unsigned long)limit.rlim_cur, highest);
+    }
+    if (config.lock_memory && geteuid() != 0 && getrlimit(RLIMIT_MEMLOCK, &limit) == 0 &&
+        limit.rlim_cur != RLIM_INFINITY)
+    {
+        printf("[RT]: Warning, RLIMIT_MEMLOCK is %lu KiB; mlockall() needs CAP_IPC_LOCK or memlock unlimited\n",
+               (unsigned long)(limit.rlim_cur / 1024));
+    }
+}
+
+bool lock_rt_memory(const RtConfig &config)
+{
+    if (!config.lock_memory)
+    {
+        return true;
+    }
+
+    // Keep freed memory in the heap (and so locked) instead of giving it back
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        fprintf(stderr, "[RT]: Error, mlockall() failed: %s. Memory stays pageable.\n", strerror(errno));
+        return false;
+    }
+    printf("[RT]: Memory locked\n");
+    return true;
+}
+
+// Set once apply_rt_thread() has run with --rt on, for prefault_rt_stack()
+static std::atomic<bool> rt_stacks(false);
+
+// Touches the next RT_STACK_PREFAULT_BYTES of stack below the caller
+static void __attribute__((noinline)) prefault_stack()
+{
+    volatile unsigned char stack[RT_STACK_PREFAULT_BYTES];
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < sizeof(stack); i += page)
+    {
+        stack[i] = 0;
+    }
+}
+
+bool apply_rt_thread(pthread_t thread, RtThread which, const RtConfig &config)
+{
+    if (!config.enabled)
+    {
+        return true;
+    }
+
+    rt_stacks = true;
+    const RtThreadConfig &settings = config.threads[which];
+    bool ok = true;
+
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = settings.policy == SCHED_OTHER ? 0 : settings.priority;
+    int result = pthread_setschedparam(thread, settings.policy, &param);
+    if (result != 0)
+    {
+        fprintf(stderr, "[RT]: Error, can't make the %s thread %s priority %d: %s%s\n", RT_THREAD_NAMES[which],
+                policy_name(settings.policy), settings.priority, strerror(result),
+                result == EPERM ? " (needs CAP_SYS_NICE or a high enough rtprio limit)" : "");
+        ok = false;
+    }
+
+    if (settings.pinned)
+    {
+        result = pthread_setaffinity_np(thread, sizeof(settings.cpus), &settings.cpus);
+        if (result != 0)
+        {
+            fprintf(stderr, "[RT]: Error, can't pin the %s thread: %s\n", RT_THREAD_NAMES[which], strerror(result));
+            ok = false;
+        }
+    }
+
+    if (pthread_equal(thread, pthread_self()))
+    {
+        prefault_stack();
+    }
+    return ok;
+}
+
+void prefault_rt_stack()
+{
+    if (rt_stacks.load())
+    {
+        prefault_stack();
+    }
+}
+
+int create_background_thread(pthread_t *thread, void *(*start)(void *), void *arg)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    struct sched_param param = {};
+    pthread_attr_setschedparam(&attr, &param);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    for (long cpu = 0; cpu < cpu_count && cpu < CPU_SETSIZE; cpu++)
+    {
+        CPU_SET(cpu, &cpus);
+    }
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+
+    int result = pthread_create(thread, &attr, start, arg);
+    pthread_attr_destroy(&attr);
+    return result;
+}
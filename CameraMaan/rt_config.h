@@ -0,0 +1,111 @@
+/*
+ * Real-time execution mode (--rt).
+ *
+ * Each pipeline thread gets its own scheduling policy and priority and can
+ * be pinned to a set of CPUs. The controller is the highest priority, since a
+ * late goal packet moves the camera late whatever the tracker does. Next come
+ * the servo poller and capture, and the tracker is lowest because it is the
+ * one thread that can use all of its CPU. Every thread applies its own
+ * settings as soon as it starts (apply_rt_thread()), so a missing privilege
+ * is reported and the thread carries on with the default scheduler instead
+ * of failing to start.
+ *
+ * lock_rt_memory() locks the whole process into RAM with mlockall() and
+ * stops malloc from handing memory back to the kernel, and each thread
+ * prefaults the top of its stack (the servo poller, whose settings the
+ * controller applies, with prefault_rt_stack()), so the hot loops don't take
+ * page faults once they are running. The frame pool is prefaulted by
+ * FrameChannel::prefault().
+ *
+ * SCHED_FIFO/SCHED_RR need CAP_SYS_NICE or an RLIMIT_RTPRIO (ulimit -r) at
+ * least as high as the priority asked for, and mlockall() needs
+ * CAP_IPC_LOCK or an RLIMIT_MEMLOCK (ulimit -l) as big as the process.
+ */
+#ifndef RT_CONFIG_H
+#define RT_CONFIG_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+
+#define RT_STACK_PREFAULT_BYTES (256 * 1024)
+
+enum RtThread
+{
+    RT_CONTROLLER,
+    RT_SERVO_POLLER,
+    RT_CAPTURE,
+    RT_TRACKER,
+    RT_THREAD_COUNT
+};
+
+struct RtThreadConfig
+{
+    int policy;    // SCHED_FIFO, SCHED_RR or SCHED_OTHER
+    int priority;  // 1 to 99 for FIFO/RR, ignored for OTHER
+    bool pinned;   // Whether cpus applies
+    cpu_set_t cpus;
+};
+
+struct RtConfig
+{
+    bool enabled;
+    bool lock_memory;
+    RtThreadConfig threads[RT_THREAD_COUNT];
+};
+
+/*
+ * Fills config with the defaults: SCHED_FIFO at 80 for the controller, 75 for
+ * the servo poller, 70 for capture and 60 for the tracker. With four or more
+ * CPUs the controller and poller share the last CPU, capture gets the one
+ * before it and the tracker the rest. Not enabled until --rt is given.
+ */
+void default_rt_config(RtConfig &config);
+
+/*
+ * Parses a --rt-thread=NAME:POLICY:PRIORITY[@CPUS] override into config.
+ * NAME is controller, poller, capture or tracker, POLICY is fifo, rr or
+ * other, and CPUS is a list like 2 or 0-1,3. Without @CPUS the thread isn't
+ * pinned.
+ *
+ * @return false, after printing why, if spec is malformed.
+ */
+bool parse_rt_thread(const char *spec, RtConfig &config);
+
+// Prints the per-thread settings and warns about missing privileges.
+void print_rt_config(const RtConfig &config);
+
+/*
+ * Locks current and future memory and turns off malloc trimming and mmap'd
+ * allocations, so freed memory stays locked and mapped for reuse.
+ *
+ * @return false if mlockall() failed; the reason has been printed.
+ */
+bool lock_rt_memory(const RtConfig &config);
+
+/*
+ * Applies which's policy, priority and CPU set to thread. When thread is the
+ * calling thread its stack is prefaulted as well.
+ *
+ * @return false if anything couldn't be applied; the reason has been printed.
+ */
+bool apply_rt_thread(pthread_t thread, RtThread which, const RtConfig &config);
+
+/*
+ * Prefaults the calling thread's stack if real-time mode is on, for a thread
+ * whose settings another thread applies with apply_rt_thread().
+ */
+void prefault_rt_stack();
+
+const char *rt_thread_name(RtThread which);
+
+/*
+ * Starts a helper thread that only gets the time the pipeline threads leave:
+ * SCHED_OTHER and allowed on every CPU, whatever --rt gave the thread that
+ * creates it.
+ *
+ * @return pthread_create()'s result.
+ */
+int create_background_thread(pthread_t *thread, void *(*start)(void *), void *arg);
+
+#endif
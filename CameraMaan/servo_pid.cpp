@@ -0,0 +1,58 @@
+#include "servo_pid.h"
+
+static double clamp(double value, double limit)
+{
+    return value > limit ? limit : (value < -limit ? -limit : value);
+}
+
+PidController::PidController() : gains(), integral_sum(0), previous_angle(0), has_previous(false)
+{
+}
+
+PidController::PidController(const PidGains &gains) : gains(gains), integral_sum(0), previous_angle(0), has_previous(false)
+{
+}
+
+void PidController::set_gains(const PidGains &new_gains)
+{
+    gains = new_gains;
+    reset();
+}
+
+void PidController::reset()
+{
+    integral_sum = 0;
+    previous_angle = 0;
+    has_previous = false;
+}
+
+double PidController::update(double error, double angle, double dt)
+{
+    if (dt <= 0)
+    {
+        return 0;
+    }
+
+    // With the target standing still the error changes as minus the angle does
+    double derivative = has_previous ? -(angle - previous_angle) / dt : 0.0;
+    previous_angle = angle;
+    has_previous = true;
+
+    double proportional = gains.kp * error;
+    double unclamped = proportional + gains.ki * integral_sum + gains.kd * derivative;
+
+    // Conditional integration: don't push further into a saturated output
+    bool saturated_high = unclamped >= gains.output_limit && error > 0;
+    bool saturated_low = unclamped <= -gains.output_limit && error < 0;
+    if (!saturated_high && !saturated_low)
+    {
+        integral_sum = clamp(integral_sum + error * dt, gains.integral_limit);
+    }
+
+    return clamp(proportional + gains.ki * integral_sum + gains.kd * derivative, gains.output_limit);
+}
+
+double PidController::integral() const
+{
+    return integral_sum;
+}
@@ -0,0 +1,60 @@
+/*
+ * PID controller for one servo axis.
+ *
+ * The error is the target's angle off the camera axis, in degrees, and the
+ * output is the angular velocity to turn at, in degrees per second, clamped
+ * to the output limit. The integral only accumulates while the output isn't
+ * saturated in the same direction (conditional integration) and is clamped
+ * on its own as well, so a long stretch against a limit doesn't wind it up.
+ * The derivative acts on the measured camera angle rather than the error,
+ * so a target that jumps (a new frame, a re-initialised tracker) doesn't
+ * kick the output.
+ */
+#ifndef SERVO_PID_H
+#define SERVO_PID_H
+
+#define DEFAULT_CONTROL_HZ 100
+#define DEFAULT_PID_KP 4.0          // Closes an error with a ~0.25 s time constant
+#define DEFAULT_PID_KI 0.5
+#define DEFAULT_PID_KD 0.05
+#define DEFAULT_MAX_SPEED_DPS 120.0 // About 180 moving speed units
+#define DEFAULT_PID_INTEGRAL_LIMIT 20.0
+
+struct PidGains
+{
+    double kp;             // deg/s per degree of error
+    double ki;             // deg/s per degree-second
+    double kd;             // deg/s per deg/s
+    double output_limit;   // Largest |output|, deg/s
+    double integral_limit; // Largest |integral|, degree-seconds
+};
+
+class PidController
+{
+public:
+    PidController();
+    PidController(const PidGains &gains);
+
+    void set_gains(const PidGains &gains);
+
+    // Forgets the integral and the previous angle, e.g. when the target is lost.
+    void reset();
+
+    /*
+     * @param error target angle minus camera angle, degrees.
+     * @param angle camera angle, degrees, in the same direction as error.
+     * @param dt seconds since the last update.
+     * @return the velocity to turn at, deg/s.
+     */
+    double update(double error, double angle, double dt);
+
+    double integral() const;
+
+private:
+    PidGains gains;
+    double integral_sum;
+    double previous_angle;
+    bool has_previous;
+};
+
+#endif
@@ -0,0 +1,22 @@
+/*
+ * What the servo poller thread caches, kept free of the Dynamixel SDK so
+ * code that only needs the defaults (options.h) doesn't pull it in.
+ */
+#ifndef SERVO_STATE_H
+#define SERVO_STATE_H
+
+#include <stdint.h>
+
+#define DEFAULT_SERVO_POLL_HZ 50 // How often the poller thread reads every servo
+#define SERVO_STATE_MAX_AGE_MS 100 // Older cached positions are read from the bus again
+
+// A servo as the poller thread last read it
+struct ServoState
+{
+    int position;    // 0 to 1023
+    int speed;       // Present speed, signed (counter-clockwise positive); 0 unless speed/load is polled
+    int load;        // Present load, signed the same way; 0 unless speed/load is polled
+    int64_t read_ns; // CLOCK_MONOTONIC time of the read
+};
+
+#endif
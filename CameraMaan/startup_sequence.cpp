@@ -0,0 +1,91 @@
+#include "startup_sequence.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include <string>
+
+using namespace std;
+
+static int64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+static const char *MILESTONE_NAMES[STARTUP_MILESTONE_COUNT] = {
+    "camera open", "servos home", "tracker loaded", "first frame", "target selected", "first tracked frame"};
+
+StartupSequence::StartupSequence() : start_ns(0)
+{
+    for (int i = 0; i < STARTUP_MILESTONE_COUNT; i++)
+    {
+        marked[i] = false;
+        succeeded[i] = false;
+        marked_ns[i] = 0;
+    }
+}
+
+void StartupSequence::start()
+{
+    lock_guard<std::mutex> lock(mutex);
+    start_ns = monotonic_ns();
+}
+
+void StartupSequence::mark(StartupMilestone milestone, bool ok)
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        if (marked[milestone])
+        {
+            return;
+        }
+        marked[milestone] = true;
+        succeeded[milestone] = ok;
+        marked_ns[milestone] = monotonic_ns();
+    }
+
+    if (milestone == STARTUP_FIRST_TRACKED_FRAME)
+    {
+        print();
+    }
+}
+
+bool StartupSequence::reached(StartupMilestone milestone)
+{
+    lock_guard<std::mutex> lock(mutex);
+    return marked[milestone] && succeeded[milestone];
+}
+
+void StartupSequence::print()
+{
+    lock_guard<std::mutex> lock(mutex);
+    string line;
+    for (int i = 0; i < STARTUP_MILESTONE_COUNT; i++)
+    {
+        char entry[64];
+        if (!marked[i])
+        {
+            snprintf(entry, sizeof(entry), "%s -", MILESTONE_NAMES[i]);
+        }
+        else if (!succeeded[i])
+        {
+            snprintf(entry, sizeof(entry), "%s FAILED", MILESTONE_NAMES[i]);
+        }
+        else
+        {
+            snprintf(entry, sizeof(entry), "%s %.0f ms", MILESTONE_NAMES[i], (marked_ns[i] - start_ns) / 1e6);
+        }
+        line += (i > 0 ? ", " : "") + string(entry);
+    }
+    printf("[STARTUP]: %s\n", line.c_str());
+
+    // Waiting for someone to pick a box isn't start up time
+    if (marked[STARTUP_FIRST_TRACKED_FRAME] && marked[STARTUP_TARGET_SELECTED])
+    {
+        printf("[STARTUP]: time to first tracked frame %.0f ms, %.0f ms after the target was selected\n",
+               (marked_ns[STARTUP_FIRST_TRACKED_FRAME] - start_ns) / 1e6,
+               (marked_ns[STARTUP_FIRST_TRACKED_FRAME] - marked_ns[STARTUP_TARGET_SELECTED]) / 1e6);
+    }
+}
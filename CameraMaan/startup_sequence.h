@@ -0,0 +1,61 @@
+/*
+ * Start up milestones, shared by the capture, tracker and controller threads.
+ *
+ * Each thread brings its own device up as soon as it starts (the camera
+ * opens, the servos connect and go home, the tracker and any model it needs
+ * load) and marks the milestone when it's done, or when it failed. A thread
+ * that depends on another's milestone doesn't wait for it: it checks
+ * reached() as it goes and carries on without meanwhile, e.g. the tracker
+ * tracks from the first frame and drops its servo commands until the servos
+ * are home.
+ *
+ * The time of each milestone from start() is printed when the first frame
+ * has been tracked, so the time to first tracked frame, and what it went on,
+ * is in every run's output.
+ */
+#ifndef STARTUP_SEQUENCE_H
+#define STARTUP_SEQUENCE_H
+
+#include <mutex>
+#include <stdint.h>
+
+enum StartupMilestone
+{
+    STARTUP_CAMERA_OPEN,         // Capture thread opened the frame source
+    STARTUP_SERVOS_READY,        // Controller connected and homed the servos
+    STARTUP_TRACKER_LOADED,      // Tracker (and its model) created
+    STARTUP_FIRST_FRAME,         // First frame reached the tracker
+    STARTUP_TARGET_SELECTED,     // Box chosen and the tracker initialised on it
+    STARTUP_FIRST_TRACKED_FRAME, // First update() that found the target
+    STARTUP_MILESTONE_COUNT
+};
+
+class StartupSequence
+{
+public:
+    StartupSequence();
+
+    // Times are measured from here; call before starting the threads.
+    void start();
+
+    /*
+     * Records a milestone. Only the first call for a milestone counts.
+     *
+     * @param ok false if the step failed.
+     */
+    void mark(StartupMilestone milestone, bool ok = true);
+
+    // Whether it has been marked and succeeded. Never blocks on the milestone.
+    bool reached(StartupMilestone milestone);
+
+    void print();
+
+private:
+    std::mutex mutex;
+    int64_t start_ns;
+    bool marked[STARTUP_MILESTONE_COUNT];
+    bool succeeded[STARTUP_MILESTONE_COUNT];
+    int64_t marked_ns[STARTUP_MILESTONE_COUNT];
+};
+
+#endif
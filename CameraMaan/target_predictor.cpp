@@ -0,0 +1,142 @@
+#include "target_predictor.h"
+
+using namespace cv;
+
+TargetPredictor::TargetPredictor(PredictionModel model)
+    : model(model), order(model == PREDICT_CONSTANT_ACCELERATION ? 3 : 2), tracking(false), last_ns(0)
+{
+    // State is [x, vx(, ax), y, vy(, ay)], measurement [x, y]
+    filter.init(2 * order, 2, 0, CV_64F);
+    filter.measurementMatrix = Mat::zeros(2, 2 * order, CV_64F);
+    filter.measurementMatrix.at<double>(0, 0) = 1.0;
+    filter.measurementMatrix.at<double>(1, order) = 1.0;
+    setIdentity(filter.measurementNoiseCov, Scalar::all(PREDICTOR_MEASUREMENT_NOISE));
+}
+
+void TargetPredictor::reset()
+{
+    tracking = false;
+}
+
+void TargetPredictor::set_step(double dt)
+{
+    // Per axis transition of a polynomial motion model
+    filter.transitionMatrix = Mat::eye(2 * order, 2 * order, CV_64F);
+    filter.processNoiseCov = Mat::zeros(2 * order, 2 * order, CV_64F);
+    double dt2 = dt * dt;
+    double dt3 = dt2 * dt;
+    for (int axis = 0; axis < 2; axis++)
+    {
+        int p = axis * order;
+        Mat &F = filter.transitionMatrix;
+        Mat &Q = filter.processNoiseCov;
+        F.at<double>(p, p + 1) = dt;
+        if (order == 2)
+        {
+            // Continuous white noise acceleration
+            double q = PREDICTOR_CV_PROCESS_NOISE;
+            Q.at<double>(p, p) = q * dt3 / 3;
+            Q.at<double>(p, p + 1) = Q.at<double>(p + 1, p) = q * dt2 / 2;
+            Q.at<double>(p + 1, p + 1) = q * dt;
+        }
+        else
+        {
+            // Continuous white noise jerk
+            double q = PREDICTOR_CA_PROCESS_NOISE;
+            F.at<double>(p, p + 2) = dt2 / 2;
+            F.at<double>(p + 1, p + 2) = dt;
+            Q.at<double>(p, p) = q * dt3 * dt2 / 20;
+            Q.at<double>(p, p + 1) = Q.at<double>(p + 1, p) = q * dt2 * dt2 / 8;
+            Q.at<double>(p, p + 2) = Q.at<double>(p + 2, p) = q * dt3 / 6;
+            Q.at<double>(p + 1, p + 1) = q * dt3 / 3;
+            Q.at<double>(p + 1, p + 2) = Q.at<double>(p + 2, p + 1) = q * dt2 / 2;
+            Q.at<double>(p + 2, p + 2) = q * dt;
+        }
+    }
+}
+
+void TargetPredictor::correct(const Point2d &measured, int64_t time_ns)
+{
+    if (tracking && (time_ns <= last_ns || time_ns - last_ns > PREDICTOR_MAX_COAST_NS))
+    {
+        tracking = false;
+    }
+
+    if (!tracking)
+    {
+        // Start at the measurement, standing still but with a wide velocity spread
+        filter.statePost = Mat::zeros(2 * order, 1, CV_64F);
+        filter.statePost.at<double>(0, 0) = measured.x;
+        filter.statePost.at<double>(order, 0) = measured.y;
+        filter.errorCovPost = Mat::zeros(2 * order, 2 * order, CV_64F);
+        for (int axis = 0; axis < 2; axis++)
+        {
+            int p = axis * order;
+            filter.errorCovPost.at<double>(p, p) = PREDICTOR_MEASUREMENT_NOISE;
+            filter.errorCovPost.at<double>(p + 1, p + 1) = PREDICTOR_INITIAL_VELOCITY_VAR;
+            if (order == 3)
+            {
+                filter.errorCovPost.at<double>(p + 2, p + 2) = PREDICTOR_INITIAL_VELOCITY_VAR * 10;
+            }
+        }
+        tracking = true;
+        last_ns = time_ns;
+        return;
+    }
+
+    set_step((time_ns - last_ns) / 1e9);
+    filter.predict();
+    Mat measurement(2, 1, CV_64F);
+    measurement.at<double>(0, 0) = measured.x;
+    measurement.at<double>(1, 0) = measured.y;
+    filter.correct(measurement);
+    last_ns = time_ns;
+}
+
+bool TargetPredictor::predict(int64_t time_ns, Point2d &predicted) const
+{
+    if (!tracking)
+    {
+        return false;
+    }
+    int64_t ahead_ns = time_ns - last_ns;
+    if (ahead_ns > PREDICTOR_MAX_COAST_NS + PREDICTOR_MAX_LEAD_NS)
+    {
+        return false;
+    }
+    if (ahead_ns > PREDICTOR_MAX_LEAD_NS)
+    {
+        ahead_ns = PREDICTOR_MAX_LEAD_NS;
+    }
+
+    // Extrapolate the filtered state by hand rather than disturb the filter
+    double dt = ahead_ns > 0 ? ahead_ns / 1e9 : 0.0;
+    const Mat &state = filter.statePost;
+    double position[2];
+    for (int axis = 0; axis < 2; axis++)
+    {
+        int p = axis * order;
+        position[axis] = state.at<double>(p, 0) + state.at<double>(p + 1, 0) * dt;
+        if (order == 3)
+        {
+            position[axis] += state.at<double>(p + 2, 0) * dt * dt / 2;
+        }
+    }
+    predicted = Point2d(position[0], position[1]);
+    return true;
+}
+
+Point2d TargetPredictor::position() const
+{
+    return Point2d(filter.statePost.at<double>(0, 0), filter.statePost.at<double>(order, 0));
+}
+
+Point2d TargetPredictor::velocity() const
+{
+    return Point2d(filter.statePost.at<double>(1, 0), filter.statePost.at<double>(order + 1, 0));
+}
+
+int64_t TargetPredictor::last_measurement_ns() const
+{
+    return last_ns;
+}
@@ -0,0 +1,86 @@
+/*
+ * Kalman filter between the tracker and the servo controller.
+ *
+ * The tracker reports where the target was when the frame was grabbed, but
+ * the servos only get there after the rest of the pipeline and the bus
+ * transfer, so aiming at the measured position always trails a moving
+ * target. TargetPredictor filters the box centres with a constant velocity
+ * or constant acceleration model (in 1280x720 pixels, time in seconds from
+ * the frames' grab timestamps) and extrapolates to the expected actuation
+ * time. The filter also smooths tracker jitter, and keeps predicting for a
+ * while when the tracker loses the target.
+ *
+ * cv::KalmanFilter (from the video module) is used rather than the
+ * contrib UKF in kalman_filters.hpp: both models are linear, so the plain
+ * filter is exact and a lot cheaper.
+ *
+ * The pixel positions also move with the camera, so the velocity estimate
+ * includes the pan/tilt motion; the lead keeps that short.
+ */
+#ifndef TARGET_PREDICTOR_H
+#define TARGET_PREDICTOR_H
+
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/video/tracking.hpp>
+
+enum PredictionModel
+{
+    PREDICT_OFF,
+    PREDICT_CONSTANT_VELOCITY,
+    PREDICT_CONSTANT_ACCELERATION
+};
+
+// Spectral density of the unmodelled acceleration (CV) or jerk (CA)
+#define PREDICTOR_CV_PROCESS_NOISE 2.0e5  // px^2/s^3
+#define PREDICTOR_CA_PROCESS_NOISE 2.0e6  // px^2/s^5
+#define PREDICTOR_MEASUREMENT_NOISE 4.0   // px^2, the trackers' frame to frame jitter
+#define PREDICTOR_INITIAL_VELOCITY_VAR 1.0e6 // px^2/s^2, we don't know how fast it starts
+#define PREDICTOR_MAX_COAST_NS 500000000  // Keep predicting for this long without a measurement
+#define PREDICTOR_MAX_LEAD_NS 300000000   // Never extrapolate further than this
+
+class TargetPredictor
+{
+public:
+    TargetPredictor(PredictionModel model = PREDICT_CONSTANT_VELOCITY);
+
+    // Forgets the target; the next correct() starts a new track.
+    void reset();
+
+    /*
+     * Feeds in a measured target centre.
+     *
+     * @param time_ns grab time of the frame it was measured in. A gap longer
+     * than PREDICTOR_MAX_COAST_NS since the last one starts a new track.
+     */
+    void correct(const cv::Point2d &measured, int64_t time_ns);
+
+    /*
+     * Where the target will be at time_ns. Doesn't change the filter.
+     *
+     * @return false if there is no track, or the last measurement is more
+     * than PREDICTOR_MAX_COAST_NS older than time_ns less the lead.
+     */
+    bool predict(int64_t time_ns, cv::Point2d &predicted) const;
+
+    // Filtered position at the last measurement.
+    cv::Point2d position() const;
+
+    // Filtered velocity, in px/s.
+    cv::Point2d velocity() const;
+
+    int64_t last_measurement_ns() const;
+
+private:
+    PredictionModel model;
+    int order; // State entries per axis: position, velocity[, acceleration]
+    cv::KalmanFilter filter;
+    bool tracking;
+    int64_t last_ns;
+
+    // Fills in the transition and process noise matrices for a step of dt seconds.
+    void set_step(double dt);
+};
+
+#endif
@@ -0,0 +1,361 @@
+#include "target_reacquirer.h"
+#include "rt_config.h"
+
+#include <stdio.h>
+
+#include <vector>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace std;
+using namespace cv;
+
+bool parse_reacquire_spec(const string &spec, ReacquireConfig &config)
+{
+    config.model.clear();
+    config.config.clear();
+    if (spec == "off")
+    {
+        config.detector = REACQUIRE_OFF;
+    }
+    else if (spec == "template")
+    {
+        config.detector = REACQUIRE_TEMPLATE;
+    }
+    else if (spec.compare(0, 8, "cascade:") == 0 && spec.size() > 8)
+    {
+        config.detector = REACQUIRE_CASCADE;
+        config.model = spec.substr(8);
+    }
+    else if (spec.compare(0, 4, "dnn:") == 0 && spec.size() > 4)
+    {
+        config.detector = REACQUIRE_DNN;
+        string files = spec.substr(4);
+        size_t comma = files.find(',');
+        config.model = files.substr(0, comma);
+        if (comma != string::npos)
+        {
+            config.config = files.substr(comma + 1);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Unknown re-acquisition detector '%s'\n", spec.c_str());
+        return false;
+    }
+    return true;
+}
+
+TargetReacquirer::TargetReacquirer(const ReacquireConfig &config)
+    : config(config), worker_running(false), busy(false), job_ready(false), job_tracking(false), next_refresh_ns(0),
+      lost_ns(0), have_appearance(false), found(false), scans(0), scan_total_ns(0), recoveries(0),
+      recovery_total_ns(0)
+{
+    if (this->config.refresh_hz <= 0)
+    {
+        this->config.refresh_hz = DEFAULT_REACQUIRE_HZ;
+    }
+}
+
+TargetReacquirer::~TargetReacquirer()
+{
+    stop();
+}
+
+bool TargetReacquirer::running() const
+{
+    return worker_running.load();
+}
+
+bool TargetReacquirer::start()
+{
+    if (config.detector == REACQUIRE_OFF || worker_running.load())
+    {
+        return worker_running.load();
+    }
+    if (config.detector == REACQUIRE_CASCADE && !cascade.load(config.model))
+    {
+        fprintf(stderr, "[REACQUIRE]: Can't load the cascade %s\n", config.model.c_str());
+        return false;
+    }
+    if (config.detector == REACQUIRE_DNN)
+    {
+        try
+        {
+            net = dnn::readNet(config.model, config.config);
+        }
+        catch (const cv::Exception &e)
+        {
+            fprintf(stderr, "[REACQUIRE]: Can't load %s: %s\n", config.model.c_str(), e.what());
+            return false;
+        }
+    }
+
+    // Created from the tracker thread, but mustn't inherit its real-time
+    // priority or CPUs: the worker only gets what the pipeline leaves
+    worker_running = true;
+    if (create_background_thread(&worker_thread, run, this) != 0)
+    {
+        worker_running = false;
+        fprintf(stderr, "[REACQUIRE]: Can't start the worker thread\n");
+        return false;
+    }
+    return true;
+}
+
+void TargetReacquirer::stop()
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        if (!worker_running.exchange(false))
+        {
+            return;
+        }
+    }
+    wake.notify_all();
+    pthread_join(worker_thread, NULL);
+}
+
+void TargetReacquirer::observe(const Mat &frame, FramePixelFormat format, const Rect2d &box, bool tracking)
+{
+    int64_t now = monotonic_ns();
+    if (tracking)
+    {
+        // Anything found for an earlier loss is stale now
+        lost_ns = 0;
+        found.store(false, memory_order_relaxed);
+    }
+    else if (lost_ns == 0)
+    {
+        lost_ns = now;
+    }
+
+    if (!worker_running.load(memory_order_relaxed) || busy.load(memory_order_acquire) ||
+        (tracking && now < next_refresh_ns) || frame.empty())
+    {
+        return;
+    }
+
+    const Mat *bgr = &frame;
+    if (format == FRAME_FORMAT_YUYV)
+    {
+        cvtColor(frame, converted, COLOR_YUV2BGR_YUYV);
+        bgr = &converted;
+    }
+    resize(*bgr, job, Size(bgr->cols / REACQUIRE_DOWNSCALE, bgr->rows / REACQUIRE_DOWNSCALE), 0, 0, INTER_AREA);
+    job_box = Rect2d(box.x / REACQUIRE_DOWNSCALE, box.y / REACQUIRE_DOWNSCALE, box.width / REACQUIRE_DOWNSCALE,
+                     box.height / REACQUIRE_DOWNSCALE);
+    job_tracking = tracking;
+    if (tracking)
+    {
+        next_refresh_ns = now + int64_t(1e9 / config.refresh_hz);
+    }
+
+    {
+        lock_guard<std::mutex> lock(mutex);
+        job_ready = true;
+        busy.store(true, memory_order_release);
+    }
+    wake.notify_one();
+}
+
+bool TargetReacquirer::take(Rect2d &box)
+{
+    if (!found.load(memory_order_acquire))
+    {
+        return false;
+    }
+    lock_guard<std::mutex> lock(mutex);
+    box = found_box;
+    found.store(false, memory_order_relaxed);
+    recoveries++;
+    if (lost_ns != 0)
+    {
+        recovery_total_ns += monotonic_ns() - lost_ns;
+    }
+    return true;
+}
+
+void TargetReacquirer::print_stats()
+{
+    lock_guard<std::mutex> lock(mutex);
+    if (scans == 0)
+    {
+        return;
+    }
+    printf("[REACQUIRE]: %lu scans, mean %.1f ms; recovered the target %lu times", scans, scan_total_ns / 1e6 / scans,
+           recoveries);
+    if (recoveries > 0)
+    {
+        printf(", %.0f ms after losing it on average", recovery_total_ns / 1e6 / recoveries);
+    }
+    printf("\n");
+}
+
+// Hue and saturation only, so a change in lighting moves it less
+static void colour_histogram(const Mat &bgr, Mat &histogram)
+{
+    Mat hsv;
+    cvtColor(bgr, hsv, COLOR_BGR2HSV);
+    static const int channels[] = {0, 1};
+    static const int bins[] = {30, 32};
+    static const float hue_range[] = {0, 180};
+    static const float saturation_range[] = {0, 256};
+    static const float *ranges[] = {hue_range, saturation_range};
+    calcHist(&hsv, 1, channels, Mat(), histogram, 2, bins, ranges);
+    normalize(histogram, histogram, 1, 0, NORM_L1);
+}
+
+void TargetReacquirer::remember(const Mat &small, const Rect &box)
+{
+    Rect inside = box & Rect(0, 0, small.cols, small.rows);
+    if (inside.width < 4 || inside.height < 4)
+    {
+        return;
+    }
+    cvtColor(small(inside), appearance_template, COLOR_BGR2GRAY);
+
+    Mat histogram;
+    colour_histogram(small(inside), histogram);
+    if (have_appearance)
+    {
+        // Moves with the target, slowly enough that a bad frame doesn't take over
+        addWeighted(appearance_histogram, 0.7, histogram, 0.3, 0, appearance_histogram);
+    }
+    else
+    {
+        appearance_histogram = histogram;
+    }
+    have_appearance = true;
+}
+
+double TargetReacquirer::similarity(const Mat &small, const Rect &candidate) const
+{
+    Rect inside = candidate & Rect(0, 0, small.cols, small.rows);
+    if (inside.width < 4 || inside.height < 4)
+    {
+        return 0.0;
+    }
+
+    Mat histogram;
+    colour_histogram(small(inside), histogram);
+    double colour = 1.0 - compareHist(appearance_histogram, histogram, HISTCMP_BHATTACHARYYA);
+
+    // Shape: the candidate squeezed to the template's size
+    Mat grey;
+    Mat scaled;
+    cvtColor(small(inside), grey, COLOR_BGR2GRAY);
+    resize(grey, scaled, appearance_template.size(), 0, 0, INTER_AREA);
+    Mat match;
+    matchTemplate(scaled, appearance_template, match, TM_CCOEFF_NORMED);
+    double shape = match.at<float>(0, 0);
+
+    return (colour + (shape > 0 ? shape : 0.0)) / 2;
+}
+
+bool TargetReacquirer::search(const Mat &small, Rect &best)
+{
+    vector<Rect> candidates;
+    if (config.detector == REACQUIRE_TEMPLATE)
+    {
+        // The stored template at the size it was and a little either side
+        Mat grey;
+        cvtColor(small, grey, COLOR_BGR2GRAY);
+        for (double scale : {0.8, 1.0, 1.25})
+        {
+            Mat resized;
+            resize(appearance_template, resized, Size(), scale, scale, INTER_LINEAR);
+            if (resized.cols < 4 || resized.rows < 4 || resized.cols > grey.cols || resized.rows > grey.rows)
+            {
+                continue;
+            }
+            Mat match;
+            matchTemplate(grey, resized, match, TM_CCOEFF_NORMED);
+            Point location;
+            minMaxLoc(match, NULL, NULL, NULL, &location);
+            candidates.push_back(Rect(location, resized.size()));
+        }
+    }
+    else if (config.detector == REACQUIRE_CASCADE)
+    {
+        Mat grey;
+        cvtColor(small, grey, COLOR_BGR2GRAY);
+        equalizeHist(grey, grey);
+        cascade.detectMultiScale(grey, candidates, 1.1, 3, 0, Size(8, 8));
+    }
+    else if (config.detector == REACQUIRE_DNN)
+    {
+        Mat blob = dnn::blobFromImage(small, 1.0 / 127.5, Size(REACQUIRE_DNN_INPUT, REACQUIRE_DNN_INPUT),
+                                      Scalar(127.5, 127.5, 127.5), true, false);
+        net.setInput(blob);
+        Mat output = net.forward();
+        // One row of (image, class, confidence, x1, y1, x2, y2) per detection
+        Mat detections = output.reshape(1, output.total() / 7);
+        for (int i = 0; i < detections.rows; i++)
+        {
+            if (detections.at<float>(i, 2) < REACQUIRE_DNN_CONFIDENCE)
+            {
+                continue;
+            }
+            Point top_left(detections.at<float>(i, 3) * small.cols, detections.at<float>(i, 4) * small.rows);
+            Point bottom_right(detections.at<float>(i, 5) * small.cols, detections.at<float>(i, 6) * small.rows);
+            candidates.push_back(Rect(top_left, bottom_right));
+        }
+    }
+
+    double best_score = REACQUIRE_MIN_SCORE;
+    bool any = false;
+    for (const Rect &candidate : candidates)
+    {
+        double score = similarity(small, candidate);
+        if (score >= best_score)
+        {
+            best_score = score;
+            best = candidate;
+            any = true;
+        }
+    }
+    return any;
+}
+
+void *TargetReacquirer::run(void *arg)
+{
+    TargetReacquirer *reacquirer = (TargetReacquirer *)arg;
+    while (true)
+    {
+        {
+            unique_lock<std::mutex> lock(reacquirer->mutex);
+            reacquirer->wake.wait(lock, [&] { return reacquirer->job_ready || !reacquirer->worker_running.load(); });
+            if (!reacquirer->worker_running.load())
+            {
+                break;
+            }
+        }
+
+        int64_t start_ns = monotonic_ns();
+        Rect box = reacquirer->job_box;
+        Rect best;
+        bool hit = false;
+        if (reacquirer->job_tracking)
+        {
+            reacquirer->remember(reacquirer->job, box);
+        }
+        else if (reacquirer->have_appearance)
+        {
+            hit = reacquirer->search(reacquirer->job, best);
+        }
+
+        lock_guard<std::mutex> lock(reacquirer->mutex);
+        reacquirer->scans++;
+        reacquirer->scan_total_ns += monotonic_ns() - start_ns;
+        if (hit)
+        {
+            reacquirer->found_box = Rect2d(best.x * REACQUIRE_DOWNSCALE, best.y * REACQUIRE_DOWNSCALE,
+                                           best.width * REACQUIRE_DOWNSCALE, best.height * REACQUIRE_DOWNSCALE);
+            reacquirer->found.store(true, memory_order_release);
+        }
+        reacquirer->job_ready = false;
+        reacquirer->busy.store(false, memory_order_release);
+    }
+    return NULL;
+}
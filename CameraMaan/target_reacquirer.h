@@ -0,0 +1,140 @@
+/*
+ * Finds the target again after the tracker has lost it (--reacquire).
+ *
+ * A worker thread, at normal priority and off the capture -> track -> servo
+ * path, scans downscaled copies of frames the tracker thread hands it:
+ *
+ *   - While the target is lost, every frame the worker is free for. The
+ *     candidates the detector finds are scored against the target's last
+ *     known appearance, and the best one, if it scores at least
+ *     REACQUIRE_MIN_SCORE, is offered back to the tracker thread, which
+ *     re-initialises the tracker on its current frame.
+ *   - While tracking, at --reacquire-hz, to keep that appearance current:
+ *     a grey template of the box and a hue/saturation histogram of it.
+ *
+ * The detector is one of:
+ *
+ *      template          the stored template, matched over the frame at
+ *                        three scales; needs no model
+ *      cascade:FILE      an objdetect Haar or LBP cascade
+ *      dnn:MODEL[,CONFIG] an SSD-style dnn detector (output 1x1xNx7, e.g.
+ *                        MobileNet-SSD), any class
+ *
+ * Handing a frame over costs the tracker thread one INTER_AREA resize (and a
+ * colour conversion for YUYV frames), and only happens when the worker is
+ * idle; it never waits for the worker. The box found is where the target was
+ * in the scanned frame, a scan's time behind the frame it is used on, which
+ * the tracker absorbs for anything slower than a sprint across the frame.
+ */
+#ifndef TARGET_REACQUIRER_H
+#define TARGET_REACQUIRER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/dnn.hpp>
+#include <opencv2/objdetect/objdetect.hpp>
+
+#include "frame_ring.h"
+
+#define REACQUIRE_DOWNSCALE 4        // Frames are scanned at 320x180
+#define DEFAULT_REACQUIRE_HZ 2.0     // Appearance refreshes while tracking
+#define REACQUIRE_MIN_SCORE 0.6      // 0 to 1, how much like the target a candidate has to look
+#define REACQUIRE_DNN_CONFIDENCE 0.3 // Detections below this aren't candidates
+#define REACQUIRE_DNN_INPUT 300      // Square input of the SSD models
+
+enum ReacquireDetector
+{
+    REACQUIRE_OFF,
+    REACQUIRE_TEMPLATE,
+    REACQUIRE_CASCADE,
+    REACQUIRE_DNN
+};
+
+struct ReacquireConfig
+{
+    ReacquireDetector detector;
+    std::string model;  // Cascade or dnn model file
+    std::string config; // dnn config file, if the model needs one
+    double refresh_hz;  // Appearance refreshes while tracking
+};
+
+// @return false if spec isn't off, template, cascade:FILE or dnn:MODEL[,CONFIG].
+bool parse_reacquire_spec(const std::string &spec, ReacquireConfig &config);
+
+class TargetReacquirer
+{
+public:
+    explicit TargetReacquirer(const ReacquireConfig &config);
+    ~TargetReacquirer();
+
+    // Loads the detector and starts the worker. @return false, after printing why, if it can't.
+    bool start();
+    void stop();
+    bool running() const;
+
+    /*
+     * Called by the tracker thread with every frame it has tracked, or tried
+     * to. Hands the frame to the worker if it is idle and the target is
+     * lost, or an appearance refresh is due; otherwise returns at once.
+     *
+     * @param frame the whole frame, BGR or YUYV as format says.
+     * @param box where the tracker has the target, in frame coordinates.
+     * @param tracking false if the tracker lost the target on this frame.
+     */
+    void observe(const cv::Mat &frame, FramePixelFormat format, const cv::Rect2d &box, bool tracking);
+
+    /*
+     * @return true, with box in frame coordinates, if the worker found the
+     * target since the last call. Lock-free when it hasn't.
+     */
+    bool take(cv::Rect2d &box);
+
+    void print_stats();
+
+private:
+    ReacquireConfig config;
+    cv::CascadeClassifier cascade;
+    cv::dnn::Net net;
+
+    pthread_t worker_thread;
+    std::atomic<bool> worker_running;
+    std::atomic<bool> busy; // The worker owns job
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool job_ready;
+
+    // The frame handed over; written by the tracker thread only while !busy
+    cv::Mat job;
+    cv::Mat converted; // YUYV -> BGR scratch, tracker thread
+    cv::Rect2d job_box; // In job coordinates
+    bool job_tracking;
+    int64_t next_refresh_ns;
+    int64_t lost_ns; // When the target was lost, 0 while tracking
+
+    // Appearance, worker only
+    cv::Mat appearance_template; // Grey, at REACQUIRE_DOWNSCALE
+    cv::Mat appearance_histogram;
+    bool have_appearance;
+
+    std::atomic<bool> found;
+    cv::Rect2d found_box; // Frame coordinates, guarded by mutex
+
+    // Guarded by mutex
+    unsigned long scans;
+    int64_t scan_total_ns;
+    unsigned long recoveries;
+    int64_t recovery_total_ns;
+
+    static void *run(void *reacquirer);
+    void remember(const cv::Mat &small, const cv::Rect &box);
+    bool search(const cv::Mat &small, cv::Rect &best);
+    double similarity(const cv::Mat &small, const cv::Rect &candidate) const;
+};
+
+#endif
@@ -0,0 +1,314 @@
+#include "tracker_engine.h"
+#include "frame_ring.h"
+#include "tracker_factory.h"
+
+#include <stdio.h>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace std;
+using namespace cv;
+
+bool parse_tracker_spec(const string &spec, vector<string> &ladder)
+{
+    ladder.clear();
+    string names = spec;
+    if (spec == "adaptive")
+    {
+        names = DEFAULT_ADAPTIVE_LADDER;
+    }
+    else if (spec.compare(0, 9, "adaptive:") == 0)
+    {
+        names = spec.substr(9);
+    }
+
+    size_t start = 0;
+    while (start <= names.size())
+    {
+        size_t end = names.find(',', start);
+        if (end == string::npos)
+        {
+            end = names.size();
+        }
+        string name = canonical_tracker_name(names.substr(start, end - start));
+        if (name.empty())
+        {
+            fprintf(stderr, "Unknown tracker '%s'\n", names.substr(start, end - start).c_str());
+            return false;
+        }
+        ladder.push_back(name);
+        start = end + 1;
+    }
+    return !ladder.empty();
+}
+
+TargetTracker::TargetTracker(const vector<string> &ladder, int64_t budget_ns, int max_downscale, double search_padding)
+    : ladder(ladder), rung(0), budget_ns(budget_ns), load_count(0), load_next(0), load_sum(0),
+      updates_on_rung(0), upgrade_holdoff(TRACKER_UPGRADE_HOLDOFF), upgraded(false), switch_count(0),
+      max_downscale(max_downscale > 1 ? max_downscale : 1), level_downscale(1), level_area(0),
+      search_padding(search_padding), reinit_pending(false), to_tracker_x(1.0), to_tracker_y(1.0)
+{
+}
+
+bool TargetTracker::preload()
+{
+    preloaded = create_tracker(ladder[0]);
+    return bool(preloaded);
+}
+
+bool TargetTracker::init(const Mat &frame, const Rect2d &box)
+{
+    upgrade_holdoff = TRACKER_UPGRADE_HOLDOFF;
+    upgraded = false;
+    frame_size = frame.size();
+    last_box = box;
+    window = window_around(box);
+    reinit_pending = false;
+    level_downscale = choose_downscale(box);
+    level_area = box.area();
+    return switch_to(0, frame, box);
+}
+
+int TargetTracker::choose_downscale(const Rect2d &box) const
+{
+    double side = box.width < box.height ? box.width : box.height;
+    int factor = 1;
+    while (factor * 2 <= max_downscale && side / (factor * 2) >= TRACKER_MIN_TARGET_PX)
+    {
+        factor *= 2;
+    }
+    return factor;
+}
+
+Rect TargetTracker::window_around(const Rect2d &box) const
+{
+    if (search_padding <= 0)
+    {
+        return Rect();
+    }
+    double width = box.width * search_padding;
+    double height = box.height * search_padding;
+    width = width > TRACKER_MIN_WINDOW_PX ? width : TRACKER_MIN_WINDOW_PX;
+    height = height > TRACKER_MIN_WINDOW_PX ? height : TRACKER_MIN_WINDOW_PX;
+    Rect around(Rect2d(box.x + box.width / 2 - width / 2, box.y + box.height / 2 - height / 2, width, height));
+    Rect whole(Point(0, 0), frame_size);
+    around &= whole;
+    return around == whole ? Rect() : around;
+}
+
+bool TargetTracker::needs_recentre(const Rect2d &box) const
+{
+    if (search_padding <= 0 || window.area() == 0)
+    {
+        return false;
+    }
+
+    // Out of the middle half, except towards a side the window can't move past
+    Point2d centre(box.x + box.width / 2, box.y + box.height / 2);
+    return (centre.x < window.x + window.width / 4 && window.x > 0) ||
+           (centre.x > window.x + window.width * 3 / 4 && window.x + window.width < frame_size.width) ||
+           (centre.y < window.y + window.height / 4 && window.y > 0) ||
+           (centre.y > window.y + window.height * 3 / 4 && window.y + window.height < frame_size.height);
+}
+
+const Mat &TargetTracker::prepare(const Mat &frame)
+{
+    frame_size = frame.size();
+    view = window.area() > 0 ? frame(window) : frame;
+    if (level_downscale == 1)
+    {
+        to_tracker_x = 1.0;
+        to_tracker_y = 1.0;
+        return view;
+    }
+
+    // INTER_AREA averages the pixels away instead of aliasing them
+    Size size(view.cols / level_downscale, view.rows / level_downscale);
+    resize(view, scaled, size, 0, 0, INTER_AREA);
+    to_tracker_x = double(size.width) / view.cols;
+    to_tracker_y = double(size.height) / view.rows;
+    return scaled;
+}
+
+Rect2d TargetTracker::to_tracker(const Rect2d &box) const
+{
+    return Rect2d((box.x - window.x) * to_tracker_x, (box.y - window.y) * to_tracker_y,
+                  box.width * to_tracker_x, box.height * to_tracker_y);
+}
+
+Rect2d TargetTracker::to_frame(const Rect2d &box) const
+{
+    return Rect2d(box.x / to_tracker_x + window.x, box.y / to_tracker_y + window.y,
+                  box.width / to_tracker_x, box.height / to_tracker_y);
+}
+
+bool TargetTracker::switch_to(size_t new_rung, const Mat &frame, const Rect2d &box)
+{
+    Ptr<Tracker> next;
+    if (new_rung == 0 && preloaded)
+    {
+        next = preloaded;
+        preloaded = Ptr<Tracker>();
+    }
+    else
+    {
+        next = create_tracker(ladder[new_rung]);
+    }
+    if (!next)
+    {
+        return false;
+    }
+    const Mat &input = prepare(frame);
+    next->init(input, to_tracker(box));
+    tracker = next;
+    rung = new_rung;
+
+    load_count = 0;
+    load_next = 0;
+    load_sum = 0;
+    updates_on_rung = 0;
+    return true;
+}
+
+bool TargetTracker::update(const Mat &frame, Rect2d &box)
+{
+    if (!tracker)
+    {
+        return false;
+    }
+
+    // A new window or level asked for on the last frame
+    if (reinit_pending)
+    {
+        reinit_pending = false;
+        window = next_window;
+        switch_to(rung, frame, last_box);
+    }
+
+    // The downscale is part of the cost the budget has to cover
+    int64_t start_ns = monotonic_ns();
+    const Mat &input = prepare(frame);
+    Rect2d found;
+    bool tracking = tracker->update(input, found);
+    int64_t elapsed_ns = monotonic_ns() - start_ns;
+
+    if (load_count == TRACKER_LOAD_WINDOW)
+    {
+        load_sum -= load_window[load_next];
+    }
+    else
+    {
+        load_count++;
+    }
+    load_window[load_next] = elapsed_ns;
+    load_sum += elapsed_ns;
+    load_next = (load_next + 1) % TRACKER_LOAD_WINDOW;
+    updates_on_rung++;
+
+    if (!tracking)
+    {
+        // Re-initialising would lock onto whatever is where the target was;
+        // the window only moves for a box the tracker or init() came up with
+        return false;
+    }
+    box = to_frame(found);
+    last_box = box;
+
+    // Only switch on a box we trust
+    double area_ratio = level_area > 0 ? box.area() / level_area : 1.0;
+    if (area_ratio > TRACKER_LEVEL_HYSTERESIS || area_ratio < 1.0 / TRACKER_LEVEL_HYSTERESIS)
+    {
+        int factor = choose_downscale(box);
+        level_area = box.area();
+        if (factor != level_downscale)
+        {
+            printf("[TRACKER]: target is %.0fx%.0f, tracking at 1/%d resolution\n", box.width, box.height, factor);
+            level_downscale = factor;
+            next_window = window;
+            reinit_pending = true;
+        }
+    }
+    if (needs_recentre(box))
+    {
+        next_window = window_around(box);
+        reinit_pending = true;
+    }
+    if (adaptive() && !reinit_pending)
+    {
+        adapt(frame, box);
+    }
+    return true;
+}
+
+void TargetTracker::adapt(const Mat &frame, const Rect2d &box)
+{
+    if (load_count < TRACKER_LOAD_WINDOW)
+    {
+        return;
+    }
+    int64_t mean = mean_update_ns();
+
+    if (mean > budget_ns * TRACKER_DOWNGRADE_LOAD && rung + 1 < ladder.size())
+    {
+        // Dropping straight back down means the upgrade didn't fit; wait longer next time
+        if (upgraded)
+        {
+            upgrade_holdoff = upgrade_holdoff * 2 < TRACKER_MAX_HOLDOFF ? upgrade_holdoff * 2 : TRACKER_MAX_HOLDOFF;
+        }
+        string from = ladder[rung];
+        if (switch_to(rung + 1, frame, box))
+        {
+            upgraded = false;
+            switch_count++;
+            printf("[TRACKER]: %s mean update %.1f ms is over the %.1f ms budget, switching to %s\n",
+                   from.c_str(), mean / 1e6, budget_ns / 1e6, ladder[rung].c_str());
+        }
+    }
+    else if (mean < budget_ns * TRACKER_UPGRADE_LOAD && rung > 0 && updates_on_rung >= upgrade_holdoff)
+    {
+        string from = ladder[rung];
+        if (switch_to(rung - 1, frame, box))
+        {
+            upgraded = true;
+            switch_count++;
+            printf("[TRACKER]: %s mean update %.1f ms leaves headroom in the %.1f ms budget, trying %s\n",
+                   from.c_str(), mean / 1e6, budget_ns / 1e6, ladder[rung].c_str());
+        }
+    }
+    else if (upgraded && updates_on_rung >= upgrade_holdoff)
+    {
+        // The upgrade held, so the next one doesn't need to wait as long
+        upgraded = false;
+        upgrade_holdoff = TRACKER_UPGRADE_HOLDOFF;
+    }
+}
+
+bool TargetTracker::adaptive() const
+{
+    return ladder.size() > 1;
+}
+
+const string &TargetTracker::name() const
+{
+    return ladder[rung];
+}
+
+int64_t TargetTracker::mean_update_ns() const
+{
+    return load_count ? load_sum / int64_t(load_count) : 0;
+}
+
+uint64_t TargetTracker::switches() const
+{
+    return switch_count;
+}
+
+int TargetTracker::downscale() const
+{
+    return level_downscale;
+}
+
+Rect TargetTracker::search_window() const
+{
+    return reinit_pending ? next_window : window;
+}
@@ -0,0 +1,160 @@
+/*
+ * The tracker used by the Track() thread.
+ *
+ * Either a fixed OpenCV tracker picked by name, or an adaptive ladder of them
+ * ordered from most accurate to cheapest (CSRT, KCF, MOSSE by default). In
+ * adaptive mode the rolling mean update time is compared against the frame
+ * budget: when it goes over, the next cheaper tracker is initialised from the
+ * current box; when there is plenty of headroom the dearer one is tried
+ * again. A tracker that gets downgraded straight after an upgrade waits twice
+ * as long before the next attempt, so the ladder doesn't oscillate.
+ *
+ * The tracker also doesn't have to see the full frame. The frame is scaled
+ * down by the largest power of two (up to max_downscale) that still leaves
+ * the target's smaller side at least TRACKER_MIN_TARGET_PX pixels, and boxes
+ * are mapped back to frame coordinates before they leave update(). OpenCV
+ * trackers keep their model in image coordinates, so changing the level
+ * re-initialises the tracker; the level is only re-chosen when the target's
+ * area has changed by TRACKER_LEVEL_HYSTERESIS since the last choice.
+ *
+ * With a search padding set, the tracker is only given a window of padding
+ * times the target's size around it, as a Mat header into the frame (no
+ * copy; the downscale then only touches the window too). For the same reason
+ * as the levels, the window can't slide with the target every frame: it
+ * stays put while the target is in its middle half and is re-centred, with
+ * the tracker re-initialised, once the target drifts out of it. While the
+ * target is lost the tracker and window are left as they are; only init()
+ * (a new selection or the re-acquirer) moves them elsewhere.
+ * Window and level changes take effect on the next frame, so the caller can
+ * ask search_window() which part of that frame the tracker is going to read.
+ */
+#ifndef TRACKER_ENGINE_H
+#define TRACKER_ENGINE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/tracking/tracking.hpp>
+
+#define DEFAULT_TRACKER "CSRT"
+#define DEFAULT_ADAPTIVE_LADDER "CSRT,KCF,MOSSE"
+
+#define TRACKER_LOAD_WINDOW 30       // Updates in the rolling mean
+#define TRACKER_DOWNGRADE_LOAD 0.9   // Downgrade above this share of the budget
+#define TRACKER_UPGRADE_LOAD 0.4     // Try upgrading below this share of the budget
+#define TRACKER_UPGRADE_HOLDOFF 150  // Updates on a rung before upgrading, doubled per bounce
+#define TRACKER_MAX_HOLDOFF 4800
+
+#define DEFAULT_MAX_DOWNSCALE 4      // 1/16 of the pixels at most
+#define TRACKER_MIN_TARGET_PX 48     // Smallest target side worth tracking at
+#define TRACKER_LEVEL_HYSTERESIS 2.0 // Area ratio that makes the level be re-chosen
+
+#define TRACKER_MIN_WINDOW_PX 160    // Smallest search window side
+
+/*
+ * Parses a --tracker spec: a tracker name from tracker_factory.h, "adaptive"
+ * for the default ladder or "adaptive:A,B,..." for a custom one.
+ *
+ * @param ladder the trackers, most accurate first; one entry for a fixed tracker.
+ * @return false if a name is unknown.
+ */
+bool parse_tracker_spec(const std::string &spec, std::vector<std::string> &ladder);
+
+class TargetTracker
+{
+public:
+    /*
+     * @param ladder from parse_tracker_spec().
+     * @param budget_ns time per frame the update has to fit in; only used
+     * when the ladder has more than one tracker.
+     * @param max_downscale largest factor the frame is scaled down by, a
+     * power of two; 1 always tracks at full resolution.
+     * @param search_padding search window size as a multiple of the target
+     * size, 0 to give the tracker the whole frame.
+     */
+    TargetTracker(const std::vector<std::string> &ladder, int64_t budget_ns, int max_downscale = 1,
+                  double search_padding = 0);
+
+    /*
+     * Creates the most accurate tracker ahead of init(), so anything it
+     * loads (GOTURN's network) is loaded while the camera and servos start
+     * up rather than after the target has been chosen.
+     *
+     * @return false if it can't be created.
+     */
+    bool preload();
+
+    // Starts tracking box in frame, on the most accurate tracker, at the
+    // level that suits the box.
+    bool init(const cv::Mat &frame, const cv::Rect2d &box);
+
+    /*
+     * Updates the tracker; box is in frame coordinates. In adaptive mode it
+     * also moves along the ladder when the rolling mean says so. A switch
+     * initialises the new tracker on this frame at the box just found.
+     *
+     * Only the search_window() part of frame has to be valid.
+     *
+     * @return false if the tracker lost the target; box is then unchanged.
+     */
+    bool update(const cv::Mat &frame, cv::Rect2d &box);
+
+    bool adaptive() const;
+    const std::string &name() const;
+    int64_t mean_update_ns() const;
+    uint64_t switches() const;
+    int downscale() const;
+
+    // The part of the next frame update() will read; empty for the whole frame.
+    cv::Rect search_window() const;
+
+private:
+    std::vector<std::string> ladder;
+    size_t rung;
+    cv::Ptr<cv::Tracker> tracker;
+    cv::Ptr<cv::Tracker> preloaded; // Rung 0, made by preload() and used by the first init()
+    int64_t budget_ns;
+
+    int64_t load_window[TRACKER_LOAD_WINDOW];
+    size_t load_count;
+    size_t load_next;
+    int64_t load_sum;
+
+    uint64_t updates_on_rung;
+    uint64_t upgrade_holdoff;
+    bool upgraded; // The last switch was an upgrade
+    uint64_t switch_count;
+
+    int max_downscale;
+    int level_downscale;
+    double level_area; // Target area when the level was chosen
+
+    double search_padding;
+    cv::Size frame_size;
+    cv::Rect window;      // Empty for the whole frame
+    cv::Rect next_window; // Takes over at the next update() when reinit_pending
+    bool reinit_pending;
+    cv::Rect2d last_box;  // Last box found, in frame coordinates
+
+    cv::Mat view;   // Header over the window
+    cv::Mat scaled;
+    double to_tracker_x;
+    double to_tracker_y;
+
+    int choose_downscale(const cv::Rect2d &box) const;
+    cv::Rect window_around(const cv::Rect2d &box) const;
+    bool needs_recentre(const cv::Rect2d &box) const;
+
+    // The window of frame at the current level; points into frame or scaled.
+    const cv::Mat &prepare(const cv::Mat &frame);
+
+    cv::Rect2d to_tracker(const cv::Rect2d &box) const;
+    cv::Rect2d to_frame(const cv::Rect2d &box) const;
+
+    bool switch_to(size_t new_rung, const cv::Mat &frame, const cv::Rect2d &box);
+    void adapt(const cv::Mat &frame, const cv::Rect2d &box);
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include "tracker_factory.h"
+
+#include <ctype.h>
+#include <stdio.h>
+
+using namespace std;
+using namespace cv;
+
+const vector<string> &tracker_names()
+{
+    static const vector<string> names = {"CSRT", "KCF", "MOSSE", "MIL", "BOOSTING", "MEDIANFLOW", "TLD", "GOTURN"};
+    return names;
+}
+
+string canonical_tracker_name(const string &name)
+{
+    string upper;
+    for (size_t i = 0; i < name.size(); i++)
+    {
+        upper += (char)toupper((unsigned char)name[i]);
+    }
+    for (size_t i = 0; i < tracker_names().size(); i++)
+    {
+        if (tracker_names()[i] == upper)
+        {
+            return upper;
+        }
+    }
+    return "";
+}
+
+Ptr<Tracker> create_tracker(const string &name)
+{
+    string tracker = canonical_tracker_name(name);
+    try
+    {
+        if (tracker == "CSRT")
+        {
+            return TrackerCSRT::create();
+        }
+        if (tracker == "KCF")
+        {
+            return TrackerKCF::create();
+        }
+        if (tracker == "MOSSE")
+        {
+            return TrackerMOSSE::create();
+        }
+        if (tracker == "MIL")
+        {
+            return TrackerMIL::create();
+        }
+        if (tracker == "BOOSTING")
+        {
+            return TrackerBoosting::create();
+        }
+        if (tracker == "MEDIANFLOW")
+        {
+            return TrackerMedianFlow::create();
+        }
+        if (tracker == "TLD")
+        {
+            return TrackerTLD::create();
+        }
+        if (tracker == "GOTURN")
+        {
+            return TrackerGOTURN::create();
+        }
+    }
+    catch (const cv::Exception &e)
+    {
+        fprintf(stderr, "Can't create the %s tracker: %s\n", tracker.c_str(), e.what());
+        return Ptr<Tracker>();
+    }
+
+    fprintf(stderr, "Unknown tracker '%s'\n", name.c_str());
+    return Ptr<Tracker>();
+}
+
+double box_iou(const Rect2d &a, const Rect2d &b)
+{
+    double overlap = (a & b).area();
+    double total = a.area() + b.area() - overlap;
+    return total > 0 ? overlap / total : 0.0;
+}
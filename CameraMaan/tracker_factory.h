@@ -0,0 +1,31 @@
+/*
+ * Creates the OpenCV (4.4 contrib) trackers by name so the tracker can be
+ * picked at run time and the benchmark can loop over all of them.
+ */
+#ifndef TRACKER_FACTORY_H
+#define TRACKER_FACTORY_H
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/tracking/tracking.hpp>
+
+// Every tracker create_tracker() knows, roughly from most to least accurate
+const std::vector<std::string> &tracker_names();
+
+/*
+ * @param name one of tracker_names(), case insensitive.
+ * @return the new tracker, or an empty Ptr if the name is unknown or the
+ * tracker can't be created here (GOTURN needs its model files in the
+ * working directory).
+ */
+cv::Ptr<cv::Tracker> create_tracker(const std::string &name);
+
+// Upper case version of name, or "" if it isn't one of tracker_names().
+std::string canonical_tracker_name(const std::string &name);
+
+// Intersection over union of two boxes, 0 when they don't overlap
+double box_iou(const cv::Rect2d &a, const cv::Rect2d &b);
+
+#endif
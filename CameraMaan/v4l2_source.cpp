@@ -0,0 +1,380 @@
+#include "v4l2_source.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace std;
+using namespace cv;
+
+// ioctl() that retries when interrupted by a signal
+static int xioctl(int fd, unsigned long request, void *arg)
+{
+    int result;
+    do
+    {
+        result = ioctl(fd, request, arg);
+    } while (result == -1 && errno == EINTR);
+    return result;
+}
+
+static string fourcc_name(uint32_t fourcc)
+{
+    char name[5] = {char(fourcc & 0xff), char((fourcc >> 8) & 0xff), char((fourcc >> 16) & 0xff), char((fourcc >> 24) & 0xff), 0};
+    return name;
+}
+
+V4L2Source::V4L2Source(const string &device_path, double requested_fps, Size preferred)
+    : device(device_path), fd(-1), streaming(false), pixel_format(0), bytes_per_line(0)
+{
+    fd = open(device.c_str(), O_RDWR | O_NONBLOCK);
+    if (fd < 0)
+    {
+        fprintf(stderr, "[V4L2]: Cannot open %s: %s\n", device.c_str(), strerror(errno));
+        return;
+    }
+
+    struct v4l2_capability caps;
+    memset(&caps, 0, sizeof(caps));
+    if (xioctl(fd, VIDIOC_QUERYCAP, &caps) < 0)
+    {
+        fprintf(stderr, "[V4L2]: %s is not a V4L2 device\n", device.c_str());
+        close_device();
+        return;
+    }
+    uint32_t device_caps = (caps.capabilities & V4L2_CAP_DEVICE_CAPS) ? caps.device_caps : caps.capabilities;
+    if (!(device_caps & V4L2_CAP_VIDEO_CAPTURE) || !(device_caps & V4L2_CAP_STREAMING))
+    {
+        fprintf(stderr, "[V4L2]: %s can't stream video captures\n", device.c_str());
+        close_device();
+        return;
+    }
+
+    if (!negotiate_format(preferred, requested_fps) || !map_buffers())
+    {
+        close_device();
+        return;
+    }
+
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(fd, VIDIOC_STREAMON, &type) < 0)
+    {
+        fprintf(stderr, "[V4L2]: VIDIOC_STREAMON failed: %s\n", strerror(errno));
+        close_device();
+        return;
+    }
+    streaming = true;
+
+    printf("[V4L2]: %s streaming %s %dx%d with %zu mmap buffers\n", device.c_str(), fourcc_name(pixel_format).c_str(),
+           frame_size.width, frame_size.height, buffers.size());
+}
+
+V4L2Source::~V4L2Source()
+{
+    close_device();
+}
+
+bool V4L2Source::negotiate_format(Size preferred, double requested_fps)
+{
+    // Which of the formats we can use does the camera offer?
+    bool has_yuyv = false;
+    bool has_mjpeg = false;
+    struct v4l2_fmtdesc description;
+    memset(&description, 0, sizeof(description));
+    description.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    while (xioctl(fd, VIDIOC_ENUM_FMT, &description) == 0)
+    {
+        has_yuyv |= description.pixelformat == V4L2_PIX_FMT_YUYV;
+        has_mjpeg |= description.pixelformat == V4L2_PIX_FMT_MJPEG;
+        description.index++;
+    }
+
+    // YUYV can go to the tracker without touching the pixels, MJPEG can't
+    if (has_yuyv)
+    {
+        pixel_format = V4L2_PIX_FMT_YUYV;
+    }
+    else if (has_mjpeg)
+    {
+        pixel_format = V4L2_PIX_FMT_MJPEG;
+    }
+    else
+    {
+        fprintf(stderr, "[V4L2]: %s offers neither YUYV nor MJPEG\n", device.c_str());
+        return false;
+    }
+
+    // Pick the native size nearest to the preferred one, favouring sizes that
+    // don't exceed it so the tracker doesn't get more pixels than it asked for
+    Size best = preferred;
+    long best_score = -1;
+    struct v4l2_frmsizeenum frame_sizes;
+    memset(&frame_sizes, 0, sizeof(frame_sizes));
+    frame_sizes.pixel_format = pixel_format;
+    while (xioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frame_sizes) == 0)
+    {
+        if (frame_sizes.type == V4L2_FRMSIZE_TYPE_DISCRETE)
+        {
+            Size candidate(frame_sizes.discrete.width, frame_sizes.discrete.height);
+            long difference = labs(long(candidate.area()) - long(preferred.area()));
+            bool too_big = candidate.width > preferred.width || candidate.height > preferred.height;
+            long score = difference + (too_big ? (1L << 40) : 0);
+            if (best_score < 0 || score < best_score)
+            {
+                best = candidate;
+                best_score = score;
+            }
+            frame_sizes.index++;
+        }
+        else
+        {
+            // Stepwise or continuous; the driver rounds whatever we ask for
+            best.width = max<int>(frame_sizes.stepwise.min_width, min<int>(preferred.width, frame_sizes.stepwise.max_width));
+            best.height = max<int>(frame_sizes.stepwise.min_height, min<int>(preferred.height, frame_sizes.stepwise.max_height));
+            break;
+        }
+    }
+
+    struct v4l2_format format;
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format.fmt.pix.width = best.width;
+    format.fmt.pix.height = best.height;
+    format.fmt.pix.pixelformat = pixel_format;
+    format.fmt.pix.field = V4L2_FIELD_NONE;
+    if (xioctl(fd, VIDIOC_S_FMT, &format) < 0)
+    {
+        fprintf(stderr, "[V4L2]: VIDIOC_S_FMT failed: %s\n", strerror(errno));
+        return false;
+    }
+
+    // The driver may have adjusted any of it
+    pixel_format = format.fmt.pix.pixelformat;
+    frame_size = Size(format.fmt.pix.width, format.fmt.pix.height);
+    bytes_per_line = format.fmt.pix.bytesperline;
+    if (pixel_format != V4L2_PIX_FMT_YUYV && pixel_format != V4L2_PIX_FMT_MJPEG)
+    {
+        fprintf(stderr, "[V4L2]: Driver switched to unsupported format %s\n", fourcc_name(pixel_format).c_str());
+        return false;
+    }
+    if (bytes_per_line == 0)
+    {
+        bytes_per_line = frame_size.width * 2;
+    }
+
+    if (requested_fps > 0)
+    {
+        struct v4l2_streamparm parameters;
+        memset(&parameters, 0, sizeof(parameters));
+        parameters.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        parameters.parm.capture.timeperframe.numerator = 1000;
+        parameters.parm.capture.timeperframe.denominator = (uint32_t)(requested_fps * 1000);
+        if (xioctl(fd, VIDIOC_S_PARM, &parameters) < 0)
+        {
+            fprintf(stderr, "[V4L2]: Couldn't set the frame rate, using the driver default\n");
+        }
+    }
+    return true;
+}
+
+bool V4L2Source::map_buffers()
+{
+    struct v4l2_requestbuffers request;
+    memset(&request, 0, sizeof(request));
+    request.count = V4L2_BUFFER_COUNT;
+    request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    request.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(fd, VIDIOC_REQBUFS, &request) < 0 || request.count < 2)
+    {
+        fprintf(stderr, "[V4L2]: %s doesn't support mmap streaming\n", device.c_str());
+        return false;
+    }
+
+    for (uint32_t i = 0; i < request.count; i++)
+    {
+        struct v4l2_buffer buffer;
+        memset(&buffer, 0, sizeof(buffer));
+        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buffer.memory = V4L2_MEMORY_MMAP;
+        buffer.index = i;
+        if (xioctl(fd, VIDIOC_QUERYBUF, &buffer) < 0)
+        {
+            fprintf(stderr, "[V4L2]: VIDIOC_QUERYBUF failed: %s\n", strerror(errno));
+            return false;
+        }
+
+        MappedBuffer mapped;
+        mapped.length = buffer.length;
+        mapped.start = mmap(NULL, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buffer.m.offset);
+        if (mapped.start == MAP_FAILED)
+        {
+            fprintf(stderr, "[V4L2]: mmap failed: %s\n", strerror(errno));
+            return false;
+        }
+        buffers.push_back(mapped);
+
+        if (xioctl(fd, VIDIOC_QBUF, &buffer) < 0)
+        {
+            fprintf(stderr, "[V4L2]: VIDIOC_QBUF failed: %s\n", strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+int V4L2Source::dequeue(uint32_t &bytes_used)
+{
+    struct pollfd waiter;
+    waiter.fd = fd;
+    waiter.events = POLLIN;
+
+    // Also returns once the tracker hands a buffer back and the driver refills it
+    int ready = poll(&waiter, 1, V4L2_FRAME_TIMEOUT_MS);
+    if (ready <= 0)
+    {
+        fprintf(stderr, "[V4L2]: No frame from %s: %s\n", device.c_str(), ready == 0 ? "timed out" : strerror(errno));
+        return -1;
+    }
+
+    struct v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(fd, VIDIOC_DQBUF, &buffer) < 0)
+    {
+        fprintf(stderr, "[V4L2]: VIDIOC_DQBUF failed: %s\n", strerror(errno));
+        return -1;
+    }
+    bytes_used = buffer.bytesused;
+    return buffer.index;
+}
+
+Mat V4L2Source::wrap(int buffer_index, uint32_t bytes_used) const
+{
+    if (pixel_format == V4L2_PIX_FMT_YUYV)
+    {
+        return Mat(frame_size.height, frame_size.width, CV_8UC2, buffers[buffer_index].start, bytes_per_line);
+    }
+    // Compressed: a single row of bytes for imdecode()
+    return Mat(1, bytes_used, CV_8UC1, buffers[buffer_index].start);
+}
+
+void V4L2Source::requeue(int buffer_index)
+{
+    struct v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.index = buffer_index;
+    if (streaming && xioctl(fd, VIDIOC_QBUF, &buffer) < 0)
+    {
+        fprintf(stderr, "[V4L2]: VIDIOC_QBUF failed: %s\n", strerror(errno));
+    }
+}
+
+bool V4L2Source::fill(FrameSlot &slot)
+{
+    uint32_t bytes_used = 0;
+    int index = dequeue(bytes_used);
+    if (index < 0)
+    {
+        return false;
+    }
+
+    if (pixel_format == V4L2_PIX_FMT_YUYV)
+    {
+        // Lend the driver buffer out; the channel requeues it on release
+        slot.image = wrap(index, bytes_used);
+        slot.format = FRAME_FORMAT_YUYV;
+        slot.buffer_owner = this;
+        slot.buffer_index = index;
+        return true;
+    }
+
+    // MJPEG has to be decoded anyway, so decode into the slot's own storage
+    imdecode(wrap(index, bytes_used), IMREAD_COLOR, &slot.storage);
+    requeue(index);
+    slot.image = slot.storage;
+    slot.format = FRAME_FORMAT_BGR;
+    return !slot.image.empty();
+}
+
+bool V4L2Source::read(Mat &dst)
+{
+    uint32_t bytes_used = 0;
+    int index = dequeue(bytes_used);
+    if (index < 0)
+    {
+        return false;
+    }
+
+    if (pixel_format == V4L2_PIX_FMT_YUYV)
+    {
+        cvtColor(wrap(index, bytes_used), converted, COLOR_YUV2BGR_YUYV);
+    }
+    else
+    {
+        imdecode(wrap(index, bytes_used), IMREAD_COLOR, &converted);
+    }
+    requeue(index);
+
+    if (converted.empty())
+    {
+        return false;
+    }
+    if (converted.size() == dst.size())
+    {
+        converted.copyTo(dst);
+    }
+    else
+    {
+        resize(converted, dst, dst.size());
+    }
+    return true;
+}
+
+bool V4L2Source::isOpened() const
+{
+    return streaming;
+}
+
+string V4L2Source::describe() const
+{
+    return "v4l2:" + device + " " + fourcc_name(pixel_format) + " " + to_string(frame_size.width) + "x" + to_string(frame_size.height);
+}
+
+Size V4L2Source::last_frame_size() const
+{
+    return frame_size;
+}
+
+void V4L2Source::close_device()
+{
+    if (fd < 0)
+    {
+        return;
+    }
+    if (streaming)
+    {
+        enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl(fd, VIDIOC_STREAMOFF, &type);
+        streaming = false;
+    }
+    for (size_t i = 0; i < buffers.size(); i++)
+    {
+        munmap(buffers[i].start, buffers[i].length);
+    }
+    buffers.clear();
+    close(fd);
+    fd = -1;
+}
@@ -0,0 +1,94 @@
+/*
+ * Zero-copy Video4Linux2 capture.
+ *
+ * Instead of letting VideoCapture convert every frame to BGR and then
+ * resizing it into the pool, this source negotiates the camera's own pixel
+ * format (YUYV preferred, MJPEG otherwise) at the native resolution closest
+ * to 1280x720, streams into mmap'd driver buffers and lends those buffers to
+ * the tracker as cv::Mat headers. A buffer is queued back to the driver when
+ * the tracker releases its slot.
+ *
+ * YUYV frames reach the tracker untouched (FRAME_FORMAT_YUYV); MJPEG frames
+ * have to be decoded, so they are decoded straight into the slot's storage
+ * and the driver buffer is requeued right away.
+ *
+ * Can be tried without a camera on the kernel's vivid test driver:
+ *      sudo modprobe vivid && ./CameraMaan --source=v4l2:/dev/video0
+ */
+#ifndef V4L2_SOURCE_H
+#define V4L2_SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "frame_ring.h"
+#include "frame_source.h"
+
+#define V4L2_DEFAULT_DEVICE "/dev/video0"
+// Enough for every pool slot to hold a buffer with two left for the driver to fill
+#define V4L2_BUFFER_COUNT (FRAME_POOL_SIZE + 2)
+// Give up if the driver hasn't produced a frame for this long
+#define V4L2_FRAME_TIMEOUT_MS 5000
+
+class V4L2Source : public FrameSource, public FrameBufferOwner
+{
+public:
+    /*
+     * Opens and starts streaming from device. Check isOpened() afterwards.
+     *
+     * @param fps frame rate to ask the driver for, 0 leaves it alone.
+     * @param preferred the resolution to get as close to as the camera allows.
+     */
+    V4L2Source(const std::string &device, double fps = 0, cv::Size preferred = cv::Size(FRAME_WIDTH, FRAME_HEIGHT));
+    ~V4L2Source();
+
+    // Copying path: converts to BGR and resizes into dst.
+    bool read(cv::Mat &dst);
+
+    // Zero-copy path: slot.image becomes a header over the driver buffer.
+    bool fill(FrameSlot &slot);
+
+    bool isOpened() const;
+    std::string describe() const;
+    cv::Size last_frame_size() const;
+
+    // Called from the tracker thread when it releases a borrowed buffer.
+    void requeue(int buffer_index);
+
+private:
+    struct MappedBuffer
+    {
+        void *start;
+        size_t length;
+    };
+
+    std::string device;
+    int fd;
+    bool streaming;
+    uint32_t pixel_format; // V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_MJPEG
+    cv::Size frame_size;
+    uint32_t bytes_per_line;
+    std::vector<MappedBuffer> buffers;
+    cv::Mat converted; // Only used by the copying read()
+
+    bool negotiate_format(cv::Size preferred, double fps);
+    bool map_buffers();
+
+    /*
+     * Waits for the driver to fill a buffer and takes it off the queue.
+     *
+     * @return the buffer index, or -1 on error or timeout.
+     */
+    int dequeue(uint32_t &bytes_used);
+
+    // A Mat header over a dequeued buffer, without copying.
+    cv::Mat wrap(int buffer_index, uint32_t bytes_used) const;
+
+    void close_device();
+};
+
+#endif
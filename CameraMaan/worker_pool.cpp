@@ -0,0 +1,122 @@
+#include "worker_pool.h"
+
+#include <sched.h>
+#include <stdio.h>
+
+using namespace std;
+
+WorkerPool::WorkerPool(int parallelism)
+    : stopping(false), job(NULL), job_count(0), next(0), pending(0), busy_workers(0), generation(0)
+{
+    if (parallelism <= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        parallelism = sched_getaffinity(0, sizeof(cpus), &cpus) == 0 ? CPU_COUNT(&cpus) : 1;
+    }
+
+    for (int i = 1; i < parallelism; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, run_worker, this) != 0)
+        {
+            fprintf(stderr, "[POOL]: Can't start worker %d, carrying on with %d\n", i, i);
+            break;
+        }
+        threads.push_back(thread);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (pthread_t thread : threads)
+    {
+        pthread_join(thread, NULL);
+    }
+}
+
+int WorkerPool::parallelism() const
+{
+    return int(threads.size()) + 1;
+}
+
+void WorkerPool::work(const function<void(size_t)> &task, size_t count)
+{
+    size_t index;
+    while ((index = next.fetch_add(1)) < count)
+    {
+        task(index);
+        lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0)
+        {
+            done.notify_all();
+        }
+    }
+}
+
+void WorkerPool::run(size_t count, const function<void(size_t)> &task)
+{
+    // Not worth waking anyone for
+    if (threads.empty() || count <= 1)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            task(i);
+        }
+        return;
+    }
+
+    {
+        lock_guard<std::mutex> lock(mutex);
+        job = &task;
+        job_count = count;
+        next = 0;
+        pending = count;
+        generation++;
+    }
+    wake.notify_all();
+    work(task, count);
+
+    // A worker that picked up the batch may still be reading it, even with
+    // every task done
+    unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return pending == 0 && busy_workers == 0; });
+    job = NULL;
+}
+
+void *WorkerPool::run_worker(void *arg)
+{
+    WorkerPool *pool = (WorkerPool *)arg;
+    unsigned long seen = 0;
+    while (true)
+    {
+        const function<void(size_t)> *task;
+        size_t count;
+        {
+            unique_lock<std::mutex> lock(pool->mutex);
+            pool->wake.wait(lock, [&] { return pool->stopping || (pool->generation != seen && pool->job != NULL); });
+            if (pool->stopping)
+            {
+                break;
+            }
+            seen = pool->generation;
+            task = pool->job;
+            count = pool->job_count;
+            pool->busy_workers++;
+        }
+
+        pool->work(*task, count);
+
+        lock_guard<std::mutex> lock(pool->mutex);
+        if (--pool->busy_workers == 0 && pool->pending == 0)
+        {
+            pool->done.notify_all();
+        }
+    }
+    return NULL;
+}
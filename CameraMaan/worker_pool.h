@@ -0,0 +1,63 @@
+/*
+ * A fixed set of worker threads that run a batch of independent tasks in
+ * parallel, for work that has to be finished within the frame it was
+ * started on (one tracker update per target).
+ *
+ * run() hands out task indices from a shared counter, takes tasks itself
+ * as well, and returns once all of them are done, so the caller needs one
+ * thread fewer than the parallelism it wants. The workers are created by
+ * the thread that owns the pool and inherit its scheduling policy,
+ * priority and CPU affinity, so under --rt they run where the tracker
+ * thread was put.
+ */
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+class WorkerPool
+{
+public:
+    /*
+     * @param parallelism how many tasks run at once, the caller included;
+     * 0 for as many as the calling thread's CPU affinity allows.
+     */
+    explicit WorkerPool(int parallelism = 0);
+    ~WorkerPool();
+
+    /*
+     * Calls task(0) ... task(count - 1), spread across the workers and the
+     * calling thread, and returns when they have all returned. Only one
+     * thread may call run() at a time.
+     */
+    void run(size_t count, const std::function<void(size_t)> &task);
+
+    // Tasks that can run at once, the caller included.
+    int parallelism() const;
+
+private:
+    std::vector<pthread_t> threads;
+    std::mutex mutex;
+    std::condition_variable wake; // A new batch, or stopping
+    std::condition_variable done; // The batch has finished
+    bool stopping;
+
+    // The current batch, guarded by mutex except for next
+    const std::function<void(size_t)> *job;
+    size_t job_count;
+    std::atomic<size_t> next;
+    size_t pending;      // Tasks not finished yet
+    int busy_workers;    // Workers that have picked up the batch
+    unsigned long generation;
+
+    static void *run_worker(void *pool);
+    void work(const std::function<void(size_t)> &task, size_t count);
+};
+
+#endif
@@ -0,0 +1,333 @@
+/* AUTHOR: Ethan Robinson
+ *
+ * Finds the pan and tilt servos and sets the bus up for low latency.
+ *
+ * Scans the usual AX-12 baud rates for servos answering PING, then, for the
+ * pan and tilt servos:
+ *
+ *   - Return Delay Time goes from the factory 500us to 0, so a reply starts
+ *     as soon as the request has been parsed.
+ *   - Status Return Level goes from 2 (answer everything) to 1 (answer READ
+ *     and PING only), so writes no longer wait for a status packet.
+ *   - The baud rate goes to --baud (1 Mbps by default).
+ *
+ * All three live in the servos' EEPROM and survive a power cycle. The result
+ * is saved where DxlController looks for it at start up (see bus_config.h),
+ * and the mean time of a position read and of a write is printed before and
+ * after. --factory puts everything back to 57600 bps, level 2 and 500us.
+ * start_up doesn't read the saved config, so run --factory before using it
+ * on a reconfigured bus.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "dynamixel_sdk.h" // Uses Dynamixel SDK library
+#include "bus_config.h"
+#include "dxl_servo_controller.h"
+
+#define ADDR_MX_LED 25
+#define DEFAULT_TARGET_BAUD 1000000
+#define FACTORY_BAUD 57600
+#define BENCH_TRANSACTIONS 100
+#define EEPROM_SETTLE_US 20000 // Let the servo write EEPROM and switch before talking to it again
+
+// Most likely first; the scan stops as soon as both servos have been seen
+static const int SCAN_BAUDS[] = {57600, 1000000, 500000, 400000, 250000, 200000, 117647, 115200, 19200, 9600};
+
+struct FoundServo
+{
+    int id;
+    int baud_rate;
+    uint16_t model;
+};
+
+static dynamixel::PortHandler *port_handler;
+static dynamixel::PacketHandler *packet_handler;
+
+static int64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+static void print_usage(const char *program)
+{
+    printf("Usage: %s [options]\n", program);
+    printf("  --port=PATH       Serial port (default $%s or %s)\n", PORT_PATH_ENV, PORT_PATH);
+    printf("  --baud=N          Baud rate to switch the bus to (default %d)\n", DEFAULT_TARGET_BAUD);
+    printf("  --pan-id=N        ID of the pan servo (default %d)\n", DXL_ID_PAN);
+    printf("  --tilt-id=N       ID of the tilt servo (default %d)\n", DXL_ID_TILT);
+    printf("  --scan            Only list the servos found\n");
+    printf("  --factory         Restore %d bps, status return level 2 and %dus return delay\n", FACTORY_BAUD,
+           FACTORY_RETURN_DELAY_US);
+    printf("  --config=PATH     Where to save the result (default %s)\n", bus_config_path().c_str());
+    printf("  --help            Show this message\n");
+}
+
+static bool find_servo(const std::vector<FoundServo> &found, int id, FoundServo &servo)
+{
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        if (found[i].id == id)
+        {
+            servo = found[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Pings every ID at every baud rate in SCAN_BAUDS.
+ *
+ * @param wanted stop once all of these have been found.
+ */
+static std::vector<FoundServo> scan_bus(const std::vector<int> &wanted)
+{
+    std::vector<FoundServo> found;
+    for (int baud_rate : SCAN_BAUDS)
+    {
+        if (!port_handler->setBaudRate(baud_rate))
+        {
+            continue;
+        }
+        printf("Scanning at %d bps...\n", baud_rate);
+        for (int id = 0; id < BROADCAST_ID; id++)
+        {
+            uint16_t model = 0;
+            uint8_t dxl_error = 0;
+            if (packet_handler->ping(port_handler, id, &model, &dxl_error) == COMM_SUCCESS)
+            {
+                printf("  ID %3d, model %d\n", id, model);
+                found.push_back({id, baud_rate, model});
+            }
+        }
+
+        bool all = !wanted.empty();
+        for (int id : wanted)
+        {
+            FoundServo servo;
+            all = all && find_servo(found, id, servo);
+        }
+        if (all)
+        {
+            break;
+        }
+    }
+    return found;
+}
+
+/*
+ * Mean time of a present position read and of an LED write, which is as
+ * cheap as a write gets and doesn't move anything. Writes wait for a status
+ * packet only if the first servo is set to send one.
+ */
+static void bench_bus(const char *label, const std::vector<int> &ids)
+{
+    uint8_t status_return_level = STATUS_RETURN_ALL;
+    uint8_t level_error = 0;
+    packet_handler->read1ByteTxRx(port_handler, ids[0], ADDR_MX_STATUS_RETURN_LEVEL, &status_return_level, &level_error);
+
+    int64_t read_ns = 0;
+    int64_t write_ns = 0;
+    int failures = 0;
+    for (int i = 0; i < BENCH_TRANSACTIONS; i++)
+    {
+        int id = ids[i % ids.size()];
+        uint16_t position;
+        uint8_t dxl_error = 0;
+
+        int64_t start = monotonic_ns();
+        failures += packet_handler->read2ByteTxRx(port_handler, id, ADDR_MX_PRESENT_POSITION, &position, &dxl_error) != COMM_SUCCESS;
+        read_ns += monotonic_ns() - start;
+
+        start = monotonic_ns();
+        if (status_return_level >= STATUS_RETURN_ALL)
+        {
+            failures += packet_handler->write1ByteTxRx(port_handler, id, ADDR_MX_LED, 0, &dxl_error) != COMM_SUCCESS;
+        }
+        else
+        {
+            failures += packet_handler->write1ByteTxOnly(port_handler, id, ADDR_MX_LED, 0) != COMM_SUCCESS;
+        }
+        write_ns += monotonic_ns() - start;
+    }
+    printf("%s: read %.3f ms, write %.3f ms per transaction, %d failed\n", label,
+           read_ns / 1e6 / BENCH_TRANSACTIONS, write_ns / 1e6 / BENCH_TRANSACTIONS, failures);
+}
+
+/*
+ * Writes return delay, status return level and baud rate, in that order, to
+ * a servo at its current baud rate.
+ *
+ * @return false if the servo can't be read back at the new baud rate with
+ * the new settings.
+ */
+static bool configure_servo(const FoundServo &servo, int baud_rate, int status_return_level, int return_delay_us)
+{
+    port_handler->setBaudRate(servo.baud_rate);
+
+    uint8_t current_level = STATUS_RETURN_ALL;
+    uint8_t dxl_error = 0;
+    if (packet_handler->read1ByteTxRx(port_handler, servo.id, ADDR_MX_STATUS_RETURN_LEVEL, &current_level, &dxl_error) != COMM_SUCCESS)
+    {
+        printf("ID %d: can't read the status return level\n", servo.id);
+        return false;
+    }
+
+    // Sent without waiting for a status packet: whether one comes back depends
+    // on the level being changed, so it is flushed instead
+    packet_handler->write1ByteTxOnly(port_handler, servo.id, ADDR_MX_RETURN_DELAY_TIME, return_delay_us / 2);
+    usleep(EEPROM_SETTLE_US);
+    port_handler->clearPort();
+    packet_handler->write1ByteTxOnly(port_handler, servo.id, ADDR_MX_STATUS_RETURN_LEVEL, status_return_level);
+    usleep(EEPROM_SETTLE_US);
+    port_handler->clearPort();
+    packet_handler->write1ByteTxOnly(port_handler, servo.id, ADDR_MX_BAUD_RATE, baud_register_value(baud_rate));
+    usleep(EEPROM_SETTLE_US);
+    port_handler->clearPort();
+
+    port_handler->setBaudRate(baud_rate);
+    uint8_t delay_units = 0;
+    uint8_t level = 0;
+    if (packet_handler->read1ByteTxRx(port_handler, servo.id, ADDR_MX_RETURN_DELAY_TIME, &delay_units, &dxl_error) != COMM_SUCCESS ||
+        packet_handler->read1ByteTxRx(port_handler, servo.id, ADDR_MX_STATUS_RETURN_LEVEL, &level, &dxl_error) != COMM_SUCCESS)
+    {
+        printf("ID %d: no answer at %d bps after the change\n", servo.id, baud_rate);
+        return false;
+    }
+    printf("ID %d: %d bps, status return level %d (was %d), return delay %dus\n", servo.id, baud_rate, level,
+           current_level, delay_units * 2);
+    return level == status_return_level && delay_units * 2 == return_delay_us;
+}
+
+int main(int argc, char *argv[])
+{
+    BusConfig config = default_bus_config();
+    load_bus_config(bus_config_path(), config);
+    std::string config_path = bus_config_path();
+    int target_baud = DEFAULT_TARGET_BAUD;
+    bool scan_only = false;
+    bool factory = false;
+
+    static const struct option long_options[] = {
+        {"port", required_argument, NULL, 'p'},
+        {"baud", required_argument, NULL, 'b'},
+        {"pan-id", required_argument, NULL, 'P'},
+        {"tilt-id", required_argument, NULL, 'T'},
+        {"scan", no_argument, NULL, 's'},
+        {"factory", no_argument, NULL, 'f'},
+        {"config", required_argument, NULL, 'c'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            config.port = optarg;
+            break;
+        case 'b':
+            target_baud = atoi(optarg);
+            break;
+        case 'P':
+            config.pan_id = atoi(optarg);
+            break;
+        case 'T':
+            config.tilt_id = atoi(optarg);
+            break;
+        case 's':
+            scan_only = true;
+            break;
+        case 'f':
+            factory = true;
+            break;
+        case 'c':
+            config_path = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (factory)
+    {
+        target_baud = FACTORY_BAUD;
+    }
+    if (baud_register_value(target_baud) < 0)
+    {
+        fprintf(stderr, "An AX-12 can't run at %d bps\n", target_baud);
+        return 1;
+    }
+    if (config.pan_id == config.tilt_id)
+    {
+        fprintf(stderr, "The pan and tilt servos need different IDs\n");
+        return 1;
+    }
+
+    port_handler = dynamixel::PortHandler::getPortHandler(config.port.c_str());
+    packet_handler = dynamixel::PacketHandler::getPacketHandler(PROTOCOL_VERSION);
+    if (!port_handler->openPort())
+    {
+        fprintf(stderr, "Failed to open %s\n", config.port.c_str());
+        return 1;
+    }
+
+    std::vector<int> ids = {config.pan_id, config.tilt_id};
+    std::vector<FoundServo> found = scan_bus(scan_only ? std::vector<int>() : ids);
+    if (scan_only)
+    {
+        port_handler->closePort();
+        return 0;
+    }
+
+    FoundServo pan;
+    FoundServo tilt;
+    if (!find_servo(found, config.pan_id, pan) || !find_servo(found, config.tilt_id, tilt))
+    {
+        fprintf(stderr, "Didn't find both the pan (ID %d) and tilt (ID %d) servos; see --pan-id and --tilt-id\n",
+                config.pan_id, config.tilt_id);
+        port_handler->closePort();
+        return 1;
+    }
+
+    if (pan.baud_rate == tilt.baud_rate)
+    {
+        port_handler->setBaudRate(pan.baud_rate);
+        bench_bus("Before", ids);
+    }
+
+    int status_return_level = factory ? STATUS_RETURN_ALL : STATUS_RETURN_READ;
+    int return_delay_us = factory ? FACTORY_RETURN_DELAY_US : 0;
+    bool ok = configure_servo(pan, target_baud, status_return_level, return_delay_us);
+    ok = configure_servo(tilt, target_baud, status_return_level, return_delay_us) && ok;
+    if (!ok)
+    {
+        fprintf(stderr, "The bus is only partly configured; run again to finish\n");
+        port_handler->closePort();
+        return 1;
+    }
+
+    port_handler->setBaudRate(target_baud);
+    bench_bus("After", ids);
+    port_handler->closePort();
+
+    config.baud_rate = target_baud;
+    config.status_return_level = status_return_level;
+    config.return_delay_us = return_delay_us;
+    if (!save_bus_config(config_path, config))
+    {
+        return 1;
+    }
+    printf("Saved to %s\n", config_path.c_str());
+    return 0;
+}
@@ -0,0 +1,646 @@
+/* AUTHOR: Ethan Robinson
+ *
+ * Dynamixel AX-12 emulator on a pseudo-terminal.
+ *
+ * Opens a pty, prints (and optionally symlinks) the slave side, and answers
+ * Protocol 1.0 packets on it the way a bus of AX-12s would. CameraMaan and
+ * start_up can then be pointed at it with DXL_PORT=<slave path> and run with
+ * no hardware attached.
+ *
+ * Supported instructions: PING, READ, WRITE, REG_WRITE, ACTION, RESET and
+ * SYNC_WRITE. Each servo has the 50 byte AX-12 control table; goal position
+ * makes the present position move at the moving speed (speed 0 = full
+ * speed), and replies are delayed by the time the bytes would take on the
+ * wire at the configured baud rate plus the servo's return delay time.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+// Control table address (AX-12)
+#define ADDR_MODEL_NUMBER 0
+#define ADDR_FIRMWARE_VERSION 2
+#define ADDR_ID 3
+#define ADDR_BAUD_RATE 4
+#define ADDR_RETURN_DELAY_TIME 5
+#define ADDR_CW_ANGLE_LIMIT 6
+#define ADDR_CCW_ANGLE_LIMIT 8
+#define ADDR_STATUS_RETURN_LEVEL 16
+#define ADDR_TORQUE_ENABLE 24
+#define ADDR_GOAL_POSITION 30
+#define ADDR_MOVING_SPEED 32
+#define ADDR_TORQUE_LIMIT 34
+#define ADDR_PRESENT_POSITION 36
+#define ADDR_PRESENT_SPEED 38
+#define ADDR_PRESENT_LOAD 40
+#define ADDR_PRESENT_VOLTAGE 42
+#define ADDR_PRESENT_TEMPERATURE 43
+#define ADDR_REGISTERED 44
+#define ADDR_MOVING 46
+#define ADDR_LOCK 47
+#define CONTROL_TABLE_SIZE 50
+
+// Instructions
+#define INST_PING 0x01
+#define INST_READ 0x02
+#define INST_WRITE 0x03
+#define INST_REG_WRITE 0x04
+#define INST_ACTION 0x05
+#define INST_RESET 0x06
+#define INST_SYNC_WRITE 0x83
+
+#define BROADCAST_ID 0xFE
+
+// Error bits in the status packet
+#define ERRBIT_RANGE 8
+#define ERRBIT_CHECKSUM 16
+#define ERRBIT_INSTRUCTION 64
+
+// One speed unit is about 0.111 rpm and one position unit 0.29296875 degrees
+#define POSITION_UNITS_PER_SPEED_UNIT (0.111 * 360.0 / 60.0 / 0.29296875)
+#define MAXIMUM_SPEED_UNITS 1023
+
+using namespace std;
+
+struct Servo
+{
+    uint8_t table[CONTROL_TABLE_SIZE];
+    double position;           // Present position in position units, kept fractional
+    uint8_t registered[CONTROL_TABLE_SIZE];
+    int registered_address;    // REG_WRITE waiting for ACTION, -1 if none
+    int registered_length;
+};
+
+struct EmulatorStats
+{
+    unsigned long instructions[256];
+    unsigned long checksum_errors;
+    unsigned long replies;
+    unsigned long bytes_in;
+    unsigned long bytes_out;
+};
+
+static vector<Servo> servos;
+static EmulatorStats stats;
+static bool timing_model = true;
+static bool verbose = false;
+static long wire_baud = 57600; // Used for the timing model
+static int64_t last_update_ns = 0;
+static volatile sig_atomic_t running = 1;
+
+static int64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+static void sleep_ns(int64_t ns)
+{
+    if (ns <= 0)
+    {
+        return;
+    }
+    struct timespec pause = {time_t(ns / 1000000000), long(ns % 1000000000)};
+    while (nanosleep(&pause, &pause) == -1 && errno == EINTR)
+    {
+    }
+}
+
+static uint16_t read_word(const uint8_t *table, int address)
+{
+    return table[address] | (table[address + 1] << 8);
+}
+
+static void write_word(uint8_t *table, int address, uint16_t value)
+{
+    table[address] = value & 0xff;
+    table[address + 1] = (value >> 8) & 0xff;
+}
+
+static long baud_from_register(uint8_t value)
+{
+    return 2000000 / (value + 1);
+}
+
+static void reset_servo(Servo &servo, uint8_t id)
+{
+    memset(servo.table, 0, sizeof(servo.table));
+    write_word(servo.table, ADDR_MODEL_NUMBER, 12);
+    servo.table[ADDR_FIRMWARE_VERSION] = 24;
+    servo.table[ADDR_ID] = id;
+    servo.table[ADDR_BAUD_RATE] = 34; // 57142 bps, what the rig runs at
+    servo.table[ADDR_RETURN_DELAY_TIME] = 250; // 500us, factory default
+    write_word(servo.table, ADDR_CW_ANGLE_LIMIT, 0);
+    write_word(servo.table, ADDR_CCW_ANGLE_LIMIT, 1023);
+    servo.table[ADDR_STATUS_RETURN_LEVEL] = 2;
+    write_word(servo.table, ADDR_TORQUE_LIMIT, 1023);
+    servo.table[ADDR_PRESENT_VOLTAGE] = 120;
+    servo.table[ADDR_PRESENT_TEMPERATURE] = 35;
+    servo.position = 511;
+    write_word(servo.table, ADDR_GOAL_POSITION, 511);
+    write_word(servo.table, ADDR_PRESENT_POSITION, 511);
+    servo.registered_address = -1;
+    servo.registered_length = 0;
+}
+
+static Servo *find_servo(uint8_t id)
+{
+    for (size_t i = 0; i < servos.size(); i++)
+    {
+        if (servos[i].table[ADDR_ID] == id)
+        {
+            return &servos[i];
+        }
+    }
+    return nullptr;
+}
+
+// Moves every servo towards its goal for the time since the last call
+static void update_motion()
+{
+    int64_t now = monotonic_ns();
+    double elapsed_s = last_update_ns ? (now - last_update_ns) / 1e9 : 0.0;
+    last_update_ns = now;
+
+    for (size_t i = 0; i < servos.size(); i++)
+    {
+        Servo &servo = servos[i];
+        double goal = read_word(servo.table, ADDR_GOAL_POSITION);
+        int speed = read_word(servo.table, ADDR_MOVING_SPEED) & 0x3ff;
+        if (speed == 0)
+        {
+            speed = MAXIMUM_SPEED_UNITS;
+        }
+        double rate = speed * POSITION_UNITS_PER_SPEED_UNIT;
+        double distance = goal - servo.position;
+        bool moving = servo.table[ADDR_TORQUE_ENABLE] && fabs(distance) > 0.5;
+
+        if (moving)
+        {
+            double step = rate * elapsed_s;
+            servo.position = fabs(distance) <= step ? goal : servo.position + (distance > 0 ? step : -step);
+        }
+        write_word(servo.table, ADDR_PRESENT_POSITION, (uint16_t)lround(servo.position));
+        // Speed and load bit 10 is the direction
+        uint16_t present_speed = moving ? (uint16_t)speed | (distance < 0 ? 0x400 : 0) : 0;
+        write_word(servo.table, ADDR_PRESENT_SPEED, present_speed);
+        write_word(servo.table, ADDR_PRESENT_LOAD, moving ? 64 | (distance < 0 ? 0x400 : 0) : 0);
+        servo.table[ADDR_MOVING] = moving ? 1 : 0;
+    }
+}
+
+/*
+ * Applies a write to a servo's control table.
+ *
+ * @return the error bits for the status packet.
+ */
+static uint8_t write_table(Servo &servo, int address, const uint8_t *data, int length)
+{
+    if (address < 0 || length <= 0 || address + length > CONTROL_TABLE_SIZE)
+    {
+        return ERRBIT_RANGE;
+    }
+
+    for (int i = 0; i < length; i++)
+    {
+        int target = address + i;
+        // Read-only regions are silently left alone, like the real thing
+        if (target < ADDR_ID || (target >= ADDR_PRESENT_POSITION && target <= ADDR_MOVING))
+        {
+            continue;
+        }
+        servo.table[target] = data[i];
+    }
+
+    // Writing a goal position switches the torque on
+    if (address <= ADDR_GOAL_POSITION + 1 && address + length > ADDR_GOAL_POSITION)
+    {
+        servo.table[ADDR_TORQUE_ENABLE] = 1;
+    }
+    if (address <= ADDR_BAUD_RATE && address + length > ADDR_BAUD_RATE)
+    {
+        wire_baud = baud_from_register(servo.table[ADDR_BAUD_RATE]);
+        printf("[EMULATOR]: ID %d switched the bus to %ld bps\n", servo.table[ADDR_ID], wire_baud);
+    }
+    return 0;
+}
+
+static void send_status(int fd, uint8_t id, uint8_t error, const uint8_t *parameters, int count, size_t request_bytes)
+{
+    uint8_t packet[6 + CONTROL_TABLE_SIZE];
+    packet[0] = 0xFF;
+    packet[1] = 0xFF;
+    packet[2] = id;
+    packet[3] = count + 2;
+    packet[4] = error;
+    uint8_t checksum = id + packet[3] + error;
+    for (int i = 0; i < count; i++)
+    {
+        packet[5 + i] = parameters[i];
+        checksum += parameters[i];
+    }
+    packet[5 + count] = ~checksum;
+    size_t length = 6 + count;
+
+    if (timing_model)
+    {
+        // The request and the reply both cross the wire at 10 bits per byte,
+        // and the servo waits its return delay time (2us per unit) in between
+        Servo *servo = find_servo(id);
+        int64_t return_delay_ns = servo ? servo->table[ADDR_RETURN_DELAY_TIME] * 2000 : 0;
+        int64_t wire_ns = int64_t((request_bytes + length) * 10 * 1e9 / wire_baud);
+        sleep_ns(return_delay_ns + wire_ns);
+    }
+
+    ssize_t written = write(fd, packet, length);
+    if (written > 0)
+    {
+        stats.bytes_out += written;
+        stats.replies++;
+    }
+}
+
+// Whether a status packet goes back for this instruction (status return level)
+static bool wants_reply(const Servo &servo, uint8_t instruction)
+{
+    uint8_t level = servo.table[ADDR_STATUS_RETURN_LEVEL];
+    if (instruction == INST_PING)
+    {
+        return true;
+    }
+    if (instruction == INST_READ)
+    {
+        return level >= 1;
+    }
+    return level >= 2;
+}
+
+static void handle_packet(int fd, uint8_t id, uint8_t instruction, const uint8_t *parameters, int count)
+{
+    size_t request_bytes = 6 + count;
+    stats.instructions[instruction]++;
+    update_motion();
+
+    if (verbose)
+    {
+        printf("[EMULATOR]: ID %d instruction 0x%02X with %d parameters\n", id, instruction, count);
+    }
+
+    if (instruction == INST_SYNC_WRITE)
+    {
+        // start address, data length, then (id, data...) per servo; never answered
+        if (count < 2 || parameters[1] == 0)
+        {
+            return;
+        }
+        int address = parameters[0];
+        int length = parameters[1];
+        for (int offset = 2; offset + 1 + length <= count; offset += 1 + length)
+        {
+            Servo *servo = find_servo(parameters[offset]);
+            if (servo != nullptr)
+            {
+                write_table(*servo, address, parameters + offset + 1, length);
+            }
+        }
+        return;
+    }
+
+    if (id == BROADCAST_ID)
+    {
+        // Broadcasts are applied to every servo and never answered
+        for (size_t i = 0; i < servos.size(); i++)
+        {
+            if (instruction == INST_WRITE && count >= 2)
+            {
+                write_table(servos[i], parameters[0], parameters + 1, count - 1);
+            }
+            else if (instruction == INST_ACTION && servos[i].registered_address >= 0)
+            {
+                write_table(servos[i], servos[i].registered_address, servos[i].registered, servos[i].registered_length);
+                servos[i].registered_address = -1;
+                servos[i].table[ADDR_REGISTERED] = 0;
+            }
+        }
+        return;
+    }
+
+    Servo *servo = find_servo(id);
+    if (servo == nullptr)
+    {
+        // Nobody home, the host times out
+        return;
+    }
+
+    uint8_t error = 0;
+    uint8_t reply[CONTROL_TABLE_SIZE];
+    int reply_count = 0;
+
+    switch (instruction)
+    {
+    case INST_PING:
+        break;
+    case INST_READ:
+        if (count != 2 || parameters[0] + parameters[1] > CONTROL_TABLE_SIZE)
+        {
+            error |= ERRBIT_RANGE;
+        }
+        else
+        {
+            memcpy(reply, servo->table + parameters[0], parameters[1]);
+            reply_count = parameters[1];
+        }
+        break;
+    case INST_WRITE:
+        error |= count >= 2 ? write_table(*servo, parameters[0], parameters + 1, count - 1) : ERRBIT_INSTRUCTION;
+        break;
+    case INST_REG_WRITE:
+        if (count >= 2 && parameters[0] + count - 1 <= CONTROL_TABLE_SIZE)
+        {
+            servo->registered_address = parameters[0];
+            servo->registered_length = count - 1;
+            memcpy(servo->registered, parameters + 1, count - 1);
+            servo->table[ADDR_REGISTERED] = 1;
+        }
+        else
+        {
+            error |= ERRBIT_RANGE;
+        }
+        break;
+    case INST_ACTION:
+        if (servo->registered_address >= 0)
+        {
+            write_table(*servo, servo->registered_address, servo->registered, servo->registered_length);
+            servo->registered_address = -1;
+            servo->table[ADDR_REGISTERED] = 0;
+        }
+        break;
+    case INST_RESET:
+        reset_servo(*servo, 1);
+        break;
+    default:
+        error |= ERRBIT_INSTRUCTION;
+        break;
+    }
+
+    if (wants_reply(*servo, instruction))
+    {
+        send_status(fd, servo->table[ADDR_ID], error, reply, reply_count, request_bytes);
+    }
+}
+
+/*
+ * Incremental Protocol 1.0 parser: 0xFF 0xFF ID LENGTH INSTRUCTION PARAMS... CHECKSUM
+ * Bytes can arrive in any split; garbage before a header is skipped.
+ */
+class PacketParser
+{
+public:
+    PacketParser() : length(0) {}
+
+    void feed(int fd, const uint8_t *data, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            buffer[length++] = data[i];
+            parse(fd);
+        }
+    }
+
+private:
+    uint8_t buffer[260];
+    size_t length;
+
+    void parse(int fd)
+    {
+        // Resynchronise on the header
+        if (length == 1 && buffer[0] != 0xFF)
+        {
+            length = 0;
+            return;
+        }
+        if (length == 2 && buffer[1] != 0xFF)
+        {
+            length = 0;
+            return;
+        }
+        if (length == 3 && buffer[2] == 0xFF)
+        {
+            // Three 0xFFs in a row: the first one was noise
+            length = 2;
+            return;
+        }
+        if (length < 4)
+        {
+            return;
+        }
+
+        size_t packet_length = 4 + buffer[3];
+        if (buffer[3] < 2)
+        {
+            length = 0;
+            return;
+        }
+        if (length < packet_length)
+        {
+            return;
+        }
+
+        uint8_t checksum = 0;
+        for (size_t i = 2; i < packet_length - 1; i++)
+        {
+            checksum += buffer[i];
+        }
+        checksum = ~checksum;
+
+        if (checksum != buffer[packet_length - 1])
+        {
+            stats.checksum_errors++;
+            Servo *servo = find_servo(buffer[2]);
+            if (servo != nullptr)
+            {
+                send_status(fd, buffer[2], ERRBIT_CHECKSUM, nullptr, 0, packet_length);
+            }
+        }
+        else
+        {
+            handle_packet(fd, buffer[2], buffer[4], buffer + 5, buffer[3] - 2);
+        }
+        length = 0;
+    }
+};
+
+static void print_stats()
+{
+    static const struct
+    {
+        uint8_t code;
+        const char *name;
+    } names[] = {{INST_PING, "PING"}, {INST_READ, "READ"}, {INST_WRITE, "WRITE"}, {INST_REG_WRITE, "REG_WRITE"},
+                 {INST_ACTION, "ACTION"}, {INST_RESET, "RESET"}, {INST_SYNC_WRITE, "SYNC_WRITE"}};
+
+    printf("[EMULATOR]: instructions received:");
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        printf(" %s=%lu", names[i].name, stats.instructions[names[i].code]);
+    }
+    printf("\n[EMULATOR]: replies = %lu, checksum errors = %lu, bytes in = %lu, bytes out = %lu\n",
+           stats.replies, stats.checksum_errors, stats.bytes_in, stats.bytes_out);
+    for (size_t i = 0; i < servos.size(); i++)
+    {
+        printf("[EMULATOR]: ID %d at position %d\n", servos[i].table[ADDR_ID], read_word(servos[i].table, ADDR_PRESENT_POSITION));
+    }
+}
+
+static void stop(int)
+{
+    running = 0;
+}
+
+static void print_usage(const char *program)
+{
+    printf("Usage: %s [options]\n", program);
+    printf("  --ids=5,10        Servo IDs on the emulated bus (default 5,10)\n");
+    printf("  --baud=N          Bus speed for the timing model (default 57600)\n");
+    printf("  --link=PATH       Also make PATH a symlink to the pty, e.g. /tmp/ttyDXL\n");
+    printf("  --no-timing       Reply immediately instead of modelling the wire time\n");
+    printf("  --verbose         Print every instruction\n");
+}
+
+int main(int argc, char *argv[])
+{
+    string ids = "5,10";
+    string link_path;
+
+    static const struct option long_options[] = {
+        {"ids", required_argument, NULL, 'i'},
+        {"baud", required_argument, NULL, 'b'},
+        {"link", required_argument, NULL, 'l'},
+        {"no-timing", no_argument, NULL, 'n'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            ids = optarg;
+            break;
+        case 'b':
+            wire_baud = atol(optarg);
+            break;
+        case 'l':
+            link_path = optarg;
+            break;
+        case 'n':
+            timing_model = false;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            print_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (wire_baud <= 0)
+    {
+        fprintf(stderr, "--baud must be positive\n");
+        return 1;
+    }
+
+    for (char *token = strtok(&ids[0], ","); token != nullptr; token = strtok(nullptr, ","))
+    {
+        Servo servo;
+        reset_servo(servo, (uint8_t)atoi(token));
+        servos.push_back(servo);
+    }
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+    {
+        fprintf(stderr, "Failed to create a pseudo-terminal: %s\n", strerror(errno));
+        return 1;
+    }
+    const char *slave_path = ptsname(master);
+
+    // Keep the slave open ourselves so the master doesn't see EIO whenever the
+    // client closes it, and make it raw until the client sets it up
+    int slave = open(slave_path, O_RDWR | O_NOCTTY);
+    struct termios raw;
+    tcgetattr(slave, &raw);
+    cfmakeraw(&raw);
+    tcsetattr(slave, TCSANOW, &raw);
+
+    if (!link_path.empty())
+    {
+        unlink(link_path.c_str());
+        if (symlink(slave_path, link_path.c_str()) < 0)
+        {
+            fprintf(stderr, "Failed to link %s: %s\n", link_path.c_str(), strerror(errno));
+        }
+    }
+
+    struct sigaction exit_action;
+    memset(&exit_action, 0, sizeof(exit_action));
+    exit_action.sa_handler = stop;
+    sigemptyset(&exit_action.sa_mask);
+    sigaction(SIGINT, &exit_action, nullptr);
+    sigaction(SIGTERM, &exit_action, nullptr);
+
+    printf("[EMULATOR]: %zu AX-12 servos on %s%s%s at %ld bps\n", servos.size(), slave_path,
+           link_path.empty() ? "" : " -> ", link_path.c_str(), wire_baud);
+    printf("[EMULATOR]: run with DXL_PORT=%s\n", link_path.empty() ? slave_path : link_path.c_str());
+    fflush(stdout);
+
+    PacketParser parser;
+    uint8_t data[256];
+    struct pollfd waiter;
+    waiter.fd = master;
+    waiter.events = POLLIN;
+
+    while (running)
+    {
+        int ready = poll(&waiter, 1, 20);
+        if (ready > 0)
+        {
+            ssize_t count = read(master, data, sizeof(data));
+            if (count > 0)
+            {
+                stats.bytes_in += count;
+                parser.feed(master, data, count);
+            }
+        }
+        else if (ready < 0 && errno != EINTR)
+        {
+            break;
+        }
+        update_motion();
+    }
+
+    print_stats();
+    if (!link_path.empty())
+    {
+        unlink(link_path.c_str());
+    }
+    close(slave);
+    close(master);
+    return 0;
+}
@@ -7,6 +7,8 @@
 #include <signal.h>
 #include <string>
 #include <iostream>
+#include <stdint.h>
+#include <time.h>
 
 #include "dynamixel_sdk.h" // Uses Dynamixel SDK library
 
@@ -23,7 +25,11 @@
 #define DXL_ID_PAN 5   // Dynamixel ID: 5
 #define DXL_ID_TILT 10 // Dynamixel ID: 10
 #define BAUDRATE 57600
+#ifndef PORT_PATH
 #define PORT_PATH "/dev/ttyUSB0"
+#endif
+// Environment variable that overrides PORT_PATH, e.g. DXL_PORT=/tmp/ttyDXL for dxl_emulator
+#define PORT_PATH_ENV "DXL_PORT"
 
 #define TORQUE_ENABLE 1  // Value for enabling the torque
 #define TORQUE_DISABLE 0 // Value for disabling the torque
@@ -41,16 +47,95 @@
 
 using namespace std;
 
+// The serial port in use: $DXL_PORT if set, otherwise PORT_PATH
+const char *port_path()
+{
+    const char *path = getenv(PORT_PATH_ENV);
+    return (path != NULL && path[0] != '\0') ? path : PORT_PATH;
+}
+
 // Initialize PortHandler instance
 // Gives access and methods for handling port: /dev/ttyUSB0
 // Both devices use /dev/ttyUSB0 so we only need 1 port handler
-dynamixel::PortHandler *PORT_HANDLER = dynamixel::PortHandler::getPortHandler(PORT_PATH);
+dynamixel::PortHandler *PORT_HANDLER = dynamixel::PortHandler::getPortHandler(port_path());
 
 // Initialize PacketHandler instance
 // Set the protocol version
 // We are using Dynamixel AX-12's and they use PROTOCOL 1.0
 dynamixel::PacketHandler *PACKET_HANDLER = dynamixel::PacketHandler::getPacketHandler(PROTOCOL_VERSION);
 
+// Request/status round trips on the servo bus
+unsigned long BUS_TRANSACTIONS = 0;
+unsigned long BUS_FAILURES = 0;
+int64_t BUS_TOTAL_NS = 0;
+int64_t BUS_MAX_NS = 0;
+
+int64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+void record_transaction(int64_t start_ns, int dxl_comm_result)
+{
+    int64_t elapsed = monotonic_ns() - start_ns;
+    BUS_TRANSACTIONS++;
+    BUS_TOTAL_NS += elapsed;
+    if (elapsed > BUS_MAX_NS)
+    {
+        BUS_MAX_NS = elapsed;
+    }
+    if (dxl_comm_result != COMM_SUCCESS)
+    {
+        BUS_FAILURES++;
+    }
+}
+
+// Timed and counted wrappers around the SDK's TxRx calls
+int write1ByteTxRx(uint8_t servo_id, uint16_t address, uint8_t data, uint8_t *dxl_error)
+{
+    int64_t start = monotonic_ns();
+    int dxl_comm_result = PACKET_HANDLER->write1ByteTxRx(PORT_HANDLER, servo_id, address, data, dxl_error);
+    record_transaction(start, dxl_comm_result);
+    return dxl_comm_result;
+}
+
+int write2ByteTxRx(uint8_t servo_id, uint16_t address, uint16_t data, uint8_t *dxl_error)
+{
+    int64_t start = monotonic_ns();
+    int dxl_comm_result = PACKET_HANDLER->write2ByteTxRx(PORT_HANDLER, servo_id, address, data, dxl_error);
+    record_transaction(start, dxl_comm_result);
+    return dxl_comm_result;
+}
+
+int read2ByteTxRx(uint8_t servo_id, uint16_t address, uint16_t *data, uint8_t *dxl_error)
+{
+    int64_t start = monotonic_ns();
+    int dxl_comm_result = PACKET_HANDLER->read2ByteTxRx(PORT_HANDLER, servo_id, address, data, dxl_error);
+    record_transaction(start, dxl_comm_result);
+    return dxl_comm_result;
+}
+
+// Sends a GroupSyncWrite; Protocol 1.0 servos don't reply to it
+int syncWriteTxOnly(dynamixel::GroupSyncWrite &sync_write)
+{
+    int64_t start = monotonic_ns();
+    int dxl_comm_result = sync_write.txPacket();
+    record_transaction(start, dxl_comm_result);
+    return dxl_comm_result;
+}
+
+void print_bus_stats()
+{
+    printf("%lu bus transactions on %s, %lu failed", BUS_TRANSACTIONS, port_path(), BUS_FAILURES);
+    if (BUS_TRANSACTIONS > 0)
+    {
+        printf(", mean round trip = %.2f ms, max = %.2f ms", BUS_TOTAL_NS / 1e6 / BUS_TRANSACTIONS, BUS_MAX_NS / 1e6);
+    }
+    printf("\n");
+}
+
 // This is a signal handler that disables the servos and closes ports before exiting the program
 void clean_up(int)
 {
@@ -60,7 +145,7 @@ void clean_up(int)
     cout << "Servo ID: " << DXL_ID_PAN << " -- [Disabling Torque!]" << endl;
 
     // Disable Dynamixel Torque for Pan servo
-    dxl_comm_result = PACKET_HANDLER->write1ByteTxRx(PORT_HANDLER, DXL_ID_PAN, ADDR_MX_TORQUE_ENABLE, TORQUE_DISABLE, &dxl_error);
+    dxl_comm_result = write1ByteTxRx(DXL_ID_PAN, ADDR_MX_TORQUE_ENABLE, TORQUE_DISABLE, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         printf("%s\n", PACKET_HANDLER->getTxRxResult(dxl_comm_result));
@@ -73,7 +158,7 @@ void clean_up(int)
     cout << "Servo ID: " << DXL_ID_TILT << " -- [Disabling Torque!]" << endl;
 
     // Disable Dynamixel Torque for Tilt servo
-    dxl_comm_result = PACKET_HANDLER->write1ByteTxRx(PORT_HANDLER, DXL_ID_TILT, ADDR_MX_TORQUE_ENABLE, TORQUE_DISABLE, &dxl_error);
+    dxl_comm_result = write1ByteTxRx(DXL_ID_TILT, ADDR_MX_TORQUE_ENABLE, TORQUE_DISABLE, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         printf("%s\n", PACKET_HANDLER->getTxRxResult(dxl_comm_result));
@@ -83,6 +168,8 @@ void clean_up(int)
         printf("%s\n", PACKET_HANDLER->getRxPacketError(dxl_error));
     }
 
+    print_bus_stats();
+
     // Close ports
     PORT_HANDLER->closePort();
     exit(1);
@@ -97,7 +184,7 @@ int clean_up()
     cout << "Servo ID: " << DXL_ID_PAN << " -- [Disabling Torque!]" << endl;
 
     // Disable Dynamixel Torque for Pan servo
-    dxl_comm_result = PACKET_HANDLER->write1ByteTxRx(PORT_HANDLER, DXL_ID_PAN, ADDR_MX_TORQUE_ENABLE, TORQUE_DISABLE, &dxl_error);
+    dxl_comm_result = write1ByteTxRx(DXL_ID_PAN, ADDR_MX_TORQUE_ENABLE, TORQUE_DISABLE, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         printf("%s\n", PACKET_HANDLER->getTxRxResult(dxl_comm_result));
@@ -110,7 +197,7 @@ int clean_up()
     cout << "Servo ID: " << DXL_ID_TILT << " -- [Disabling Torque!]" << endl;
 
     // Disable Dynamixel Torque for Tilt servo
-    dxl_comm_result = PACKET_HANDLER->write1ByteTxRx(PORT_HANDLER, DXL_ID_TILT, ADDR_MX_TORQUE_ENABLE, TORQUE_DISABLE, &dxl_error);
+    dxl_comm_result = write1ByteTxRx(DXL_ID_TILT, ADDR_MX_TORQUE_ENABLE, TORQUE_DISABLE, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         printf("%s\n", PACKET_HANDLER->getTxRxResult(dxl_comm_result));
@@ -120,6 +207,8 @@ int clean_up()
         printf("%s\n", PACKET_HANDLER->getRxPacketError(dxl_error));
     }
 
+    print_bus_stats();
+
     // Close ports
     PORT_HANDLER->closePort();
     return 0;
@@ -175,7 +264,7 @@ int getPosition(int servo_id)
     uint16_t dxl_present_position = 0;  // Present position
 
     // Read present position for PAN servo
-    dxl_comm_result = PACKET_HANDLER->read2ByteTxRx(PORT_HANDLER, servo_id, ADDR_MX_PRESENT_POSITION, &dxl_present_position, &dxl_error);
+    dxl_comm_result = read2ByteTxRx(servo_id, ADDR_MX_PRESENT_POSITION, &dxl_present_position, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         printf("%s\n", PACKET_HANDLER->getTxRxResult(dxl_comm_result));
@@ -212,7 +301,7 @@ int relative_PAN(int PAN_degrees)
     // Write goal position for PAN servo
     if (goal_position <= DXL_PAN_MAXIMUM_POSITION_VALUE && goal_position >= DXL_PAN_MINIMUM_POSITION_VALUE)
     {
-        dxl_comm_result = PACKET_HANDLER->write2ByteTxRx(PORT_HANDLER, DXL_ID_PAN, ADDR_MX_GOAL_POSITION, goal_position, &dxl_error);
+        dxl_comm_result = write2ByteTxRx(DXL_ID_PAN, ADDR_MX_GOAL_POSITION, goal_position, &dxl_error);
     }
     else
     {
@@ -257,7 +346,7 @@ int relative_TILT(int TILT_degrees)
     // Write goal position for PAN servo
     if (goal_position <= DXL_TILT_MAXIMUM_POSITION_VALUE && goal_position >= DXL_TILT_MINIMUM_POSITION_VALUE)
     {
-        dxl_comm_result = PACKET_HANDLER->write2ByteTxRx(PORT_HANDLER, DXL_ID_TILT, ADDR_MX_GOAL_POSITION, goal_position, &dxl_error);
+        dxl_comm_result = write2ByteTxRx(DXL_ID_TILT, ADDR_MX_GOAL_POSITION, goal_position, &dxl_error);
     }
     else
     {
@@ -303,48 +392,122 @@ void WAIT_for_goal(int servo_ID, int goal_position)
     } while ((abs(goal_position - current_position) > DXL_MOVING_STATUS_THRESHOLD));
 }
 
-bool return_home()
+// Whether goal_position is within the servo's range; prints why not
+bool goal_in_bounds(int servo_id, int goal_position)
 {
-    cout << "Returning home..." << endl;
-    // Error checking variables
-    uint8_t dxl_error = 0;              // Dynamixel error
-    int dxl_comm_result = COMM_TX_FAIL; // Communication result
-
-    dxl_comm_result = PACKET_HANDLER->write2ByteTxRx(PORT_HANDLER, DXL_ID_PAN, ADDR_MX_GOAL_POSITION, 511, &dxl_error);
-    if (dxl_comm_result != COMM_SUCCESS)
+    int minimum = servo_id == DXL_ID_TILT ? DXL_TILT_MINIMUM_POSITION_VALUE : DXL_PAN_MINIMUM_POSITION_VALUE;
+    int maximum = servo_id == DXL_ID_TILT ? DXL_TILT_MAXIMUM_POSITION_VALUE : DXL_PAN_MAXIMUM_POSITION_VALUE;
+    if (goal_position > maximum || goal_position < minimum)
     {
-        cout << "FAILED to write goal position for PAN servo. ID:" << DXL_ID_PAN << endl;
-        printf("%s\n", PACKET_HANDLER->getTxRxResult(dxl_comm_result));
+        printf("Target position %i for ID %d is out of bounds\n", goal_position, servo_id);
         return false;
     }
-    else if (dxl_error != 0)
+    return true;
+}
+
+/* The goal position relative_PAN/relative_TILT would write, without writing it.
+ *
+ * @return the goal position, or -1 if it is out of bounds or the current position can't be read
+ */
+int relative_goal(int servo_id, int degrees)
+{
+    int current_pos = getPosition(servo_id);
+    if (current_pos < 0)
     {
-        cout << "FAILED to write goal position for PAN servo. ID:" << DXL_ID_PAN << endl;
-        printf("%s\n", PACKET_HANDLER->getRxPacketError(dxl_error));
-        return false;
+        return -1;
     }
 
-    WAIT_for_goal(DXL_ID_PAN, 511);
+    // Convert from degrees to servo position unit
+    int goal_position = current_pos - int(degrees / .29296875);
+
+    return goal_in_bounds(servo_id, goal_position) ? goal_position : -1;
+}
 
-    dxl_comm_result = PACKET_HANDLER->write2ByteTxRx(PORT_HANDLER, DXL_ID_TILT, ADDR_MX_GOAL_POSITION, 511, &dxl_error);
+// Waits until every servo is within DXL_MOVING_STATUS_THRESHOLD of its goal
+void WAIT_for_goals(const int *servo_ids, const int *goal_positions, int count)
+{
+    bool arrived;
+    do
+    {
+        arrived = true;
+        for (int i = 0; i < count; i++)
+        {
+            int current_position = getPosition(servo_ids[i]);
+            if (current_position < 0)
+            {
+                cout << "Error in WAIT_for_goals. getPosition(int) failed" << endl;
+                arrived = false;
+            }
+            else if (abs(goal_positions[i] - current_position) > DXL_MOVING_STATUS_THRESHOLD)
+            {
+                arrived = false;
+            }
+        }
+    } while (!arrived);
+}
+
+/* Writes the goal positions of several servos in one SYNC_WRITE broadcast, so they
+ * start (and with equal distances, arrive) together.
+ *
+ * @param wait whether to wait for all of them to get there.
+ * @return false if a goal is out of bounds (nothing is sent) or the packet couldn't be sent
+ */
+bool move_together(const int *servo_ids, const int *goal_positions, int count, bool wait)
+{
+    dynamixel::GroupSyncWrite sync_write(PORT_HANDLER, PACKET_HANDLER, ADDR_MX_GOAL_POSITION, 2);
+    for (int i = 0; i < count; i++)
+    {
+        if (!goal_in_bounds(servo_ids[i], goal_positions[i]))
+        {
+            return false;
+        }
+        uint8_t param[2] = {DXL_LOBYTE(goal_positions[i]), DXL_HIBYTE(goal_positions[i])};
+        // Otherwise the packet would go out without this servo
+        if (!sync_write.addParam(servo_ids[i], param))
+        {
+            printf("Can't add ID %d to the sync write\n", servo_ids[i]);
+            return false;
+        }
+    }
+
+    int dxl_comm_result = syncWriteTxOnly(sync_write);
     if (dxl_comm_result != COMM_SUCCESS)
     {
-        cout << "FAILED to write goal position for TILT servo. ID:" << DXL_ID_TILT << endl;
+        cout << "FAILED to sync write goal positions" << endl;
         printf("%s\n", PACKET_HANDLER->getTxRxResult(dxl_comm_result));
         return false;
     }
-    else if (dxl_error != 0)
+
+    if (wait)
     {
-        cout << "FAILED to write goal position for TILT servo. ID:" << DXL_ID_TILT << endl;
-        printf("%s\n", PACKET_HANDLER->getRxPacketError(dxl_error));
-        return false;
+        WAIT_for_goals(servo_ids, goal_positions, count);
     }
-    
-    WAIT_for_goal(DXL_ID_TILT, 511);
-
     return true;
 }
 
+bool return_home()
+{
+    cout << "Returning home..." << endl;
+
+    // Both axes in one packet, arriving together
+    const int ids[2] = {DXL_ID_PAN, DXL_ID_TILT};
+    const int home[2] = {511, 511};
+    return move_together(ids, home, 2, true);
+}
+
+// Pans by PAN_degrees while tilting by TILT_degrees
+bool relative_PAN_TILT(int PAN_degrees, int TILT_degrees)
+{
+    const int ids[2] = {DXL_ID_PAN, DXL_ID_TILT};
+    int goals[2] = {relative_goal(DXL_ID_PAN, PAN_degrees), relative_goal(DXL_ID_TILT, TILT_degrees)};
+    if (goals[0] < 0 || goals[1] < 0)
+    {
+        cout << "Relative pan and tilt failed!" << endl;
+        return false;
+    }
+    return move_together(ids, goals, 2, true);
+}
+
 int main()
 {
     // We need a signal handler for SIGINT, SIGHUP, and SIGTERM that disables the servos.
@@ -387,7 +550,7 @@ int main()
     }
 
     // Enable Torque for PAN servo (port1)
-    dxl_comm_result = PACKET_HANDLER->write1ByteTxRx(PORT_HANDLER, DXL_ID_PAN, ADDR_MX_TORQUE_ENABLE, TORQUE_ENABLE, &dxl_error);
+    dxl_comm_result = write1ByteTxRx(DXL_ID_PAN, ADDR_MX_TORQUE_ENABLE, TORQUE_ENABLE, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         printf("%s\n", PACKET_HANDLER->getTxRxResult(dxl_comm_result));
@@ -404,7 +567,7 @@ int main()
     }
 
     // Enable Torque for TILT servo (port2)
-    dxl_comm_result = PACKET_HANDLER->write1ByteTxRx(PORT_HANDLER, DXL_ID_PAN, ADDR_MX_TORQUE_ENABLE, TORQUE_ENABLE, &dxl_error);
+    dxl_comm_result = write1ByteTxRx(DXL_ID_TILT, ADDR_MX_TORQUE_ENABLE, TORQUE_ENABLE, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         printf("%s\n", PACKET_HANDLER->getTxRxResult(dxl_comm_result));
@@ -419,7 +582,7 @@ int main()
     }
 
     //Change PAN moving speed
-    dxl_comm_result = PACKET_HANDLER->write2ByteTxRx(PORT_HANDLER, DXL_ID_PAN, ADDR_MX_MOVEMENT_SPEED, MOVE_SPEED, &dxl_error);
+    dxl_comm_result = write2ByteTxRx(DXL_ID_PAN, ADDR_MX_MOVEMENT_SPEED, MOVE_SPEED, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         printf("%s\n", PACKET_HANDLER->getTxRxResult(dxl_comm_result));
@@ -434,7 +597,7 @@ int main()
     }
 
     // Change TILT moving speed
-    dxl_comm_result = PACKET_HANDLER->write2ByteTxRx(PORT_HANDLER, DXL_ID_TILT, ADDR_MX_MOVEMENT_SPEED, MOVE_SPEED, &dxl_error);
+    dxl_comm_result = write2ByteTxRx(DXL_ID_TILT, ADDR_MX_MOVEMENT_SPEED, MOVE_SPEED, &dxl_error);
     if (dxl_comm_result != COMM_SUCCESS)
     {
         printf("%s\n", PACKET_HANDLER->getTxRxResult(dxl_comm_result));
@@ -455,14 +618,12 @@ int main()
         return clean_up();
     }
 
-    WAIT_for_goal(DXL_ID_PAN, relative_PAN(-90));
-    WAIT_for_goal(DXL_ID_TILT, relative_TILT(30));
+    relative_PAN_TILT(-90, 30);
     WAIT_for_goal(DXL_ID_TILT, relative_TILT(-60));
 
     return_home();
 
-    WAIT_for_goal(DXL_ID_PAN, relative_PAN(90));
-    WAIT_for_goal(DXL_ID_TILT, relative_TILT(30));
+    relative_PAN_TILT(90, 30);
     WAIT_for_goal(DXL_ID_TILT, relative_TILT(-60));
 
     return_home();
@@ -0,0 +1,545 @@
+/*
+ * Tracker benchmark.
+ *
+ * Runs every OpenCV tracker over a set of clips at several input scales and
+ * prints one CSV row per (clip, scale, tracker):
+ *
+ *      clip,scale,tracker,frames,init_ms,mean_ms,p50_ms,p90_ms,p99_ms,max_ms,
+ *      fps,rss_delta_kb,mean_iou,success_rate,lost_frames
+ *
+ * Times are for tracker->update() only; decoding and resizing the frame is
+ * not counted. success_rate is the share of scored frames with IoU >= 0.5
+ * and lost_frames counts updates that returned false. rss_delta_kb is how
+ * much the resident set grew over the run, which is mostly the tracker's
+ * model and scratch buffers.
+ *
+ * Clips are frame source specs (see CameraMaan/frame_source.h), optionally
+ * followed by @FILE with the ground truth: one "x,y,w,h" line per frame, in
+ * the clip's own pixel coordinates, with an empty line or 0,0,0,0 where the
+ * target is not visible. The synthetic source brings its own ground truth.
+ *
+ *      ./tracker_bench synthetic file:run1.mp4@run1.txt images:run2@run2.txt
+ *
+ * With --targets=1,2,4,8 it measures multi-target scaling instead: each
+ * tracker follows that many copies of the first box through a
+ * MultiTargetTracker, whose updates run in parallel on a worker pool, and
+ * prints one row per (clip, scale, tracker, targets):
+ *
+ *      clip,scale,tracker,targets,threads,frames,mean_ms,p50_ms,p99_ms,
+ *      max_ms,fps,speedup
+ *
+ * Times are for the whole frame's update, all targets together. speedup is
+ * how much faster that is than updating the targets one after the other,
+ * estimated from the first count in the list: with perfect scaling it is
+ * min(targets, threads) when the list starts at 1.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/tracking/tracking.hpp>
+
+#include "frame_source.h"
+#include "latency_stats.h"
+#include "multi_target_tracker.h"
+#include "tracker_factory.h"
+
+using namespace std;
+using namespace cv;
+
+#define DEFAULT_SCALES "1280x720,640x360,320x180"
+#define DEFAULT_FRAMES 300
+#define SUCCESS_IOU 0.5
+
+struct Clip
+{
+    string spec;
+    vector<Rect2d> truth; // Empty boxes where the target isn't visible
+};
+
+struct RunResult
+{
+    uint64_t frames;
+    int64_t init_ns;
+    LatencyHistogram update_ns;
+    long rss_delta_kb;
+    uint64_t scored;
+    double iou_sum;
+    uint64_t successes;
+    uint64_t lost;
+};
+
+static void print_usage(const char *program)
+{
+    printf("Usage: %s [options] [CLIP[@GROUNDTRUTH] ...]\n", program);
+    printf("  --trackers=A,B,...      Trackers to run (default all: ");
+    for (size_t i = 0; i < tracker_names().size(); i++)
+    {
+        printf("%s%s", i ? "," : "", tracker_names()[i].c_str());
+    }
+    printf(")\n");
+    printf("  --scales=WxH,...        Input sizes (default %s)\n", DEFAULT_SCALES);
+    printf("  --frames=N              Frames per run, 0 for the whole clip (default %d)\n", DEFAULT_FRAMES);
+    printf("  --roi=x,y,w,h           Initial box in clip coordinates for clips without\n");
+    printf("                          ground truth on their first frame\n");
+    printf("  --targets=N,...         Measure multi-target scaling with these target counts\n");
+    printf("                          (e.g. 1,2,4,8) instead of the single tracker table\n");
+    printf("  --help                  Show this message\n");
+    printf("With no clips the synthetic source is used.\n");
+}
+
+static vector<string> split(const string &text, char separator)
+{
+    vector<string> parts;
+    size_t start = 0;
+    while (start <= text.size())
+    {
+        size_t end = text.find(separator, start);
+        if (end == string::npos)
+        {
+            end = text.size();
+        }
+        if (end > start)
+        {
+            parts.push_back(text.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return parts;
+}
+
+static bool load_ground_truth(const string &path, vector<Rect2d> &truth)
+{
+    FILE *file = fopen(path.c_str(), "r");
+    if (file == NULL)
+    {
+        perror(path.c_str());
+        return false;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        double x, y, w, h;
+        if (sscanf(line, "%lf,%lf,%lf,%lf", &x, &y, &w, &h) == 4 && w > 0 && h > 0)
+        {
+            truth.push_back(Rect2d(x, y, w, h));
+        }
+        else
+        {
+            truth.push_back(Rect2d());
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+// Resident set size in kB, from /proc/self/statm
+static long resident_kb()
+{
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+    long size = 0, resident = 0;
+    if (fscanf(file, "%ld %ld", &size, &resident) != 2)
+    {
+        resident = 0;
+    }
+    fclose(file);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static Rect2d scale_box(const Rect2d &box, Size from, Size to)
+{
+    if (from.width == 0 || from.height == 0)
+    {
+        return box;
+    }
+    double sx = double(to.width) / from.width;
+    double sy = double(to.height) / from.height;
+    return Rect2d(box.x * sx, box.y * sy, box.width * sx, box.height * sy);
+}
+
+/*
+ * Where the target is in the frame just read, in frame (scaled) coordinates.
+ *
+ * @return false if the frame has no ground truth.
+ */
+static bool frame_truth(const Clip &clip, FrameSource *source, uint64_t frame, Size scale, Rect2d &box)
+{
+    if (frame < clip.truth.size())
+    {
+        box = scale_box(clip.truth[frame], source->last_frame_size(), scale);
+    }
+    else if (clip.truth.empty() && source->ground_truth(box))
+    {
+        box = scale_box(box, source->last_frame_size(), scale);
+    }
+    else
+    {
+        return false;
+    }
+    return box.area() > 0;
+}
+
+/*
+ * Opens a clip and reads its first frame into frame, at scale.
+ *
+ * @param box where to start tracking, in frame coordinates.
+ * @return the source, or NULL if the clip can't be read or has no first box.
+ */
+static FrameSource *open_clip(const Clip &clip, Size scale, bool has_roi, const Rect2d &roi, Mat &frame, Rect2d &box)
+{
+    FrameSource *source = create_frame_source(clip.spec, PACING_FAST, 0);
+    if (source == NULL || !source->isOpened())
+    {
+        fprintf(stderr, "Can't open clip '%s'\n", clip.spec.c_str());
+        delete source;
+        return NULL;
+    }
+
+    frame.create(scale, CV_8UC3);
+    if (!source->read(frame))
+    {
+        fprintf(stderr, "Clip '%s' has no frames\n", clip.spec.c_str());
+        delete source;
+        return NULL;
+    }
+    if (has_roi)
+    {
+        box = scale_box(roi, source->last_frame_size(), scale);
+    }
+    else if (!frame_truth(clip, source, 0, scale, box))
+    {
+        fprintf(stderr, "Clip '%s' has no box for the first frame, use --roi\n", clip.spec.c_str());
+        delete source;
+        return NULL;
+    }
+    return source;
+}
+
+/*
+ * Runs one tracker over one clip at one scale.
+ *
+ * @return false if the clip or the tracker could not be set up.
+ */
+static bool run(const Clip &clip, Size scale, const string &tracker_name, uint64_t max_frames,
+                bool has_roi, const Rect2d &roi, RunResult &result)
+{
+    Mat frame;
+    Rect2d box;
+    FrameSource *source = open_clip(clip, scale, has_roi, roi, frame, box);
+    if (source == NULL)
+    {
+        return false;
+    }
+
+    long rss_before = resident_kb();
+    Ptr<Tracker> tracker = create_tracker(tracker_name);
+    if (!tracker)
+    {
+        delete source;
+        return false;
+    }
+
+    int64_t start_ns = monotonic_ns();
+    tracker->init(frame, box);
+    result.init_ns = monotonic_ns() - start_ns;
+    result.frames = 0;
+    result.scored = 0;
+    result.iou_sum = 0;
+    result.successes = 0;
+    result.lost = 0;
+    result.update_ns.reset();
+
+    long rss_peak = resident_kb();
+    for (uint64_t n = 1; max_frames == 0 || n < max_frames; n++)
+    {
+        if (!source->read(frame))
+        {
+            break;
+        }
+
+        start_ns = monotonic_ns();
+        bool found = tracker->update(frame, box);
+        result.update_ns.record(monotonic_ns() - start_ns);
+        result.frames++;
+
+        if (!found)
+        {
+            result.lost++;
+        }
+        Rect2d truth;
+        if (frame_truth(clip, source, n, scale, truth))
+        {
+            double iou = found ? box_iou(box, truth) : 0.0;
+            result.scored++;
+            result.iou_sum += iou;
+            if (iou >= SUCCESS_IOU)
+            {
+                result.successes++;
+            }
+        }
+
+        // Reading /proc costs more than a small tracker update, so only now and then
+        if (n % 30 == 0)
+        {
+            long rss = resident_kb();
+            rss_peak = rss > rss_peak ? rss : rss_peak;
+        }
+    }
+    long rss = resident_kb();
+    rss_peak = rss > rss_peak ? rss : rss_peak;
+    result.rss_delta_kb = rss_peak - rss_before;
+
+    tracker.reset();
+    delete source;
+    return true;
+}
+
+/*
+ * Runs count copies of one tracker over one clip at one scale, all of them
+ * updated on every frame by a MultiTargetTracker.
+ *
+ * @param threads set to how many updates ran at once.
+ * @return false if the clip or the trackers could not be set up.
+ */
+static bool run_multi(const Clip &clip, Size scale, const string &tracker_name, size_t count, uint64_t max_frames,
+                      bool has_roi, const Rect2d &roi, RunResult &result, int &threads)
+{
+    Mat frame;
+    Rect2d box;
+    FrameSource *source = open_clip(clip, scale, has_roi, roi, frame, box);
+    if (source == NULL)
+    {
+        return false;
+    }
+
+    // Full resolution and the whole frame, so each target costs what a lone tracker does
+    MultiTargetTracker tracker(vector<string>{tracker_name}, 0, 1, 0, SELECT_PRIORITY);
+    int64_t start_ns = monotonic_ns();
+    if (!tracker.init(frame, vector<Rect2d>(count, box)))
+    {
+        fprintf(stderr, "Can't start %zu %s trackers\n", count, tracker_name.c_str());
+        delete source;
+        return false;
+    }
+    result.init_ns = monotonic_ns() - start_ns;
+    result.frames = 0;
+    result.update_ns.reset();
+    threads = tracker.parallelism();
+
+    for (uint64_t n = 1; max_frames == 0 || n < max_frames; n++)
+    {
+        if (!source->read(frame))
+        {
+            break;
+        }
+        start_ns = monotonic_ns();
+        tracker.update(frame, box);
+        result.update_ns.record(monotonic_ns() - start_ns);
+        result.frames++;
+    }
+
+    delete source;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    enum
+    {
+        OPT_TRACKERS = 256,
+        OPT_SCALES,
+        OPT_FRAMES,
+        OPT_ROI,
+        OPT_TARGETS,
+        OPT_HELP
+    };
+    static const struct option long_options[] = {
+        {"trackers", required_argument, NULL, OPT_TRACKERS},
+        {"scales", required_argument, NULL, OPT_SCALES},
+        {"frames", required_argument, NULL, OPT_FRAMES},
+        {"roi", required_argument, NULL, OPT_ROI},
+        {"targets", required_argument, NULL, OPT_TARGETS},
+        {"help", no_argument, NULL, OPT_HELP},
+        {NULL, 0, NULL, 0}};
+
+    vector<string> trackers = tracker_names();
+    vector<Size> scales;
+    vector<string> scale_specs = split(DEFAULT_SCALES, ',');
+    uint64_t max_frames = DEFAULT_FRAMES;
+    bool has_roi = false;
+    Rect2d roi;
+    vector<size_t> target_counts;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case OPT_TRACKERS:
+            trackers.clear();
+            for (const string &name : split(optarg, ','))
+            {
+                string canonical = canonical_tracker_name(name);
+                if (canonical.empty())
+                {
+                    fprintf(stderr, "Unknown tracker '%s'\n", name.c_str());
+                    return 1;
+                }
+                trackers.push_back(canonical);
+            }
+            break;
+        case OPT_SCALES:
+            scale_specs = split(optarg, ',');
+            break;
+        case OPT_FRAMES:
+            max_frames = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_ROI:
+        {
+            double x, y, w, h;
+            if (sscanf(optarg, "%lf,%lf,%lf,%lf", &x, &y, &w, &h) != 4 || w <= 0 || h <= 0)
+            {
+                fprintf(stderr, "--roi expects x,y,width,height\n");
+                return 1;
+            }
+            roi = Rect2d(x, y, w, h);
+            has_roi = true;
+            break;
+        }
+        case OPT_TARGETS:
+            target_counts.clear();
+            for (const string &count : split(optarg, ','))
+            {
+                int targets = atoi(count.c_str());
+                if (targets < 1)
+                {
+                    fprintf(stderr, "--targets expects counts of at least 1\n");
+                    return 1;
+                }
+                target_counts.push_back(targets);
+            }
+            break;
+        case OPT_HELP:
+            print_usage(argv[0]);
+            return 0;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    for (const string &spec : scale_specs)
+    {
+        int w, h;
+        if (sscanf(spec.c_str(), "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0)
+        {
+            fprintf(stderr, "Bad scale '%s', expected WIDTHxHEIGHT\n", spec.c_str());
+            return 1;
+        }
+        scales.push_back(Size(w, h));
+    }
+
+    vector<Clip> clips;
+    for (int i = optind; i < argc; i++)
+    {
+        Clip clip;
+        string arg = argv[i];
+        size_t at = arg.rfind('@');
+        clip.spec = arg.substr(0, at);
+        if (at != string::npos && !load_ground_truth(arg.substr(at + 1), clip.truth))
+        {
+            return 1;
+        }
+        clips.push_back(clip);
+    }
+    if (clips.empty())
+    {
+        clips.push_back(Clip{"synthetic", vector<Rect2d>()});
+    }
+
+    // The histogram is too big for the stack
+    RunResult *result = new RunResult();
+    if (!target_counts.empty())
+    {
+        printf("clip,scale,tracker,targets,threads,frames,mean_ms,p50_ms,p99_ms,max_ms,fps,speedup\n");
+        fflush(stdout);
+        for (const Clip &clip : clips)
+        {
+            for (const Size &scale : scales)
+            {
+                for (const string &tracker : trackers)
+                {
+                    // Per target, from the first count, for the speedup column
+                    double baseline_ns = 0;
+                    for (size_t count : target_counts)
+                    {
+                        fprintf(stderr, "[BENCH]: %s %dx%d %s x%zu\n", clip.spec.c_str(), scale.width, scale.height,
+                                tracker.c_str(), count);
+                        int threads = 1;
+                        if (!run_multi(clip, scale, tracker, count, max_frames, has_roi, roi, *result, threads))
+                        {
+                            continue;
+                        }
+
+                        const LatencyHistogram &update = result->update_ns;
+                        if (baseline_ns == 0)
+                        {
+                            baseline_ns = update.mean() / count;
+                        }
+                        printf("%s,%dx%d,%s,%zu,%d,%llu,%.3f,%.3f,%.3f,%.3f,%.1f,%.2f\n", clip.spec.c_str(),
+                               scale.width, scale.height, tracker.c_str(), count, threads,
+                               (unsigned long long)result->frames, update.mean() / 1e6, update.percentile(50) / 1e6,
+                               update.percentile(99) / 1e6, update.max() / 1e6,
+                               update.mean() > 0 ? 1e9 / update.mean() : 0.0,
+                               update.mean() > 0 ? baseline_ns * count / update.mean() : 0.0);
+                        fflush(stdout);
+                    }
+                }
+            }
+        }
+        delete result;
+        return 0;
+    }
+
+    printf("clip,scale,tracker,frames,init_ms,mean_ms,p50_ms,p90_ms,p99_ms,max_ms,fps,rss_delta_kb,mean_iou,success_rate,lost_frames\n");
+    fflush(stdout);
+
+    for (const Clip &clip : clips)
+    {
+        for (const Size &scale : scales)
+        {
+            for (const string &tracker : trackers)
+            {
+                fprintf(stderr, "[BENCH]: %s %dx%d %s\n", clip.spec.c_str(), scale.width, scale.height, tracker.c_str());
+                if (!run(clip, scale, tracker, max_frames, has_roi, roi, *result))
+                {
+                    continue;
+                }
+
+                const LatencyHistogram &update = result->update_ns;
+                printf("%s,%dx%d,%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f,%ld,%.4f,%.4f,%llu\n",
+                       clip.spec.c_str(), scale.width, scale.height, tracker.c_str(),
+                       (unsigned long long)result->frames, result->init_ns / 1e6,
+                       update.mean() / 1e6, update.percentile(50) / 1e6, update.percentile(90) / 1e6,
+                       update.percentile(99) / 1e6, update.max() / 1e6,
+                       update.mean() > 0 ? 1e9 / update.mean() : 0.0, result->rss_delta_kb,
+                       result->scored ? result->iou_sum / result->scored : 0.0,
+                       result->scored ? double(result->successes) / result->scored : 0.0,
+                       (unsigned long long)result->lost);
+                fflush(stdout);
+            }
+        }
+    }
+    delete result;
+    return 0;
+}